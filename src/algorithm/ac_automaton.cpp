@@ -1,159 +1,1355 @@
 #include "algorithm/ac_automaton.h"
 
+#include "base/color_print.h"
+#include "base/fold/fold.h"
+#include "base/telemetry/telemetry.h"
 #include "base/types.h"
+#include "base/utf8/utf8.h"
 
+#include <algorithm>
+#include <bit>
 #include <cstddef>
+#include <ios>
 #include <queue>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Matcher generated by `punp --emit-cpp`, see the `PUNP_COMPILED_RULES` CMake option
+#ifdef PUNP_COMPILED_RULES_FILE
+#include PUNP_COMPILED_RULES_FILE
+#endif
 
 namespace punp {
+    /// Build-time trie. Edges live in one arena chained per state and are found through
+    /// an open addressing table keyed by (state, class), so large dictionaries do not
+    /// allocate a container per state.
+    struct ACAutomaton::Trie {
+        static constexpr uint32_t NONE = UINT32_MAX;
+        static constexpr uint64_t EMPTY = UINT64_MAX;
+
+        struct Link {
+            uint32_t cls;
+            state_t target;
+            uint32_t next; // Next edge of the same state, `NONE` ends the chain
+        };
+
+        std::vector<uint32_t> first; // First edge of each state
+        std::vector<Link> links;
+        std::vector<uint64_t> keys; // `state << 32 | cls`, `EMPTY` for a free slot
+        std::vector<state_t> targets;
+
+        explicit Trie(size_t n_states = 1) : first(n_states, NONE), keys(16, EMPTY), targets(16, ROOT) {}
+
+        size_t size() const noexcept { return first.size(); }
+
+        state_t add_state() {
+            first.emplace_back(NONE);
+            return static_cast<state_t>(first.size() - 1);
+        }
+
+        state_t find(state_t s, uint32_t cls) const {
+            const uint64_t key = (static_cast<uint64_t>(s) << 32) | cls;
+            const size_t mask = keys.size() - 1;
+            for (size_t i = slot_of(key, mask);; i = (i + 1) & mask) {
+                if (keys[i] == key)
+                    return targets[i];
+                if (keys[i] == EMPTY)
+                    return NONE;
+            }
+        }
+
+        void add_edge(state_t s, uint32_t cls, state_t target) {
+            if ((links.size() + 1) * 2 > keys.size()) {
+                rehash(keys.size() * 2);
+            }
+            insert((static_cast<uint64_t>(s) << 32) | cls, target);
+            links.emplace_back(Link{cls, target, first[s]});
+            first[s] = static_cast<uint32_t>(links.size() - 1);
+        }
+
+        template <typename F>
+        void for_each_edge(state_t s, F &&f) const {
+            for (uint32_t l = first[s]; l != NONE; l = links[l].next) {
+                f(links[l].cls, links[l].target);
+            }
+        }
+
+    private:
+        static size_t slot_of(uint64_t key, size_t mask) {
+            uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+            return static_cast<size_t>(h ^ (h >> 32)) & mask;
+        }
+
+        void insert(uint64_t key, state_t target) {
+            const size_t mask = keys.size() - 1;
+            size_t i = slot_of(key, mask);
+            while (keys[i] != EMPTY) {
+                i = (i + 1) & mask;
+            }
+            keys[i] = key;
+            targets[i] = target;
+        }
+
+        void rehash(size_t n_slots) {
+            std::vector<uint64_t> old_keys(n_slots, EMPTY);
+            std::vector<state_t> old_targets(n_slots, ROOT);
+            old_keys.swap(keys);
+            old_targets.swap(targets);
+            for (size_t i = 0; i < old_keys.size(); ++i) {
+                if (old_keys[i] != EMPTY) {
+                    insert(old_keys[i], old_targets[i]);
+                }
+            }
+        }
+    };
+
     ACAutomaton::ACAutomaton() {
-        root = new Node();
+        clear();
     }
     ACAutomaton::~ACAutomaton() {
         clear();
     }
 
-    void ACAutomaton::build_from_map(const ReplacementMap &rep_map) {
+    void ACAutomaton::build_from_map(const ReplacementMap &rep_map, const RangeRules &range_rules,
+                                     const ReplacementMap &fold_map, bool minimize, bool patchable) {
         clear();
-        root = new Node();
+        // `patch` relies on a plain trie, so it goes without minimization
+        const bool keep_trie = patchable;
+        minimize = minimize && !keep_trie;
 
-        // Build the Trie tree from the replacement map
+        // Single chars used by literal patterns keep their own class, so a range char that is
+        // also a pattern char becomes an explicit one-char rule. Literal rules take priority.
+        ReplacementMap range_chars;
+        auto add_range_char = [&](wchar_t ch) {
+            text_t key(1, ch);
+            if (rep_map.find(key) != rep_map.end() || fold_map.find(fold::fold(key)) != fold_map.end())
+                return;
+            for (const auto &rule : range_rules) {
+                if (rule.from_start <= ch && ch <= rule.from_end) {
+                    range_chars.try_emplace(std::move(key), 1, static_cast<wchar_t>(rule.to_start + (ch - rule.from_start)));
+                    return;
+                }
+            }
+        };
+
+        std::vector<text_t> patterns;
+        std::vector<wchar_t> chars;
+        patterns.reserve(rep_map.size());
         for (const auto &pair : rep_map) {
+            if (pair.first.empty())
+                continue;
+            patterns.emplace_back(pair.first);
+            _max_pattern_len = std::max(_max_pattern_len, pair.first.length());
+            chars.insert(chars.end(), pair.first.begin(), pair.first.end());
+            for (wchar_t ch : pair.first) {
+                add_range_char(ch);
+            }
+        }
+        wchar_t variants[fold::MAX_VARIANTS];
+        for (const auto &pair : fold_map) {
+            _max_pattern_len = std::max(_max_pattern_len, pair.first.length());
+            for (wchar_t ch : pair.first) {
+                size_t n = fold::variants(ch, variants);
+                for (size_t i = 0; i < n; ++i) {
+                    add_range_char(variants[i]);
+                }
+            }
+        }
+        for (const auto &pair : range_chars) {
+            chars.emplace_back(pair.first[0]);
+        }
+
+        // Compress the alphabet first, the trie is then keyed by class id. Chars of exact
+        // patterns get their own class, the remaining variants of a `FOLD` char share one,
+        // so folding the input costs nothing beyond the class lookup. Every range takes one
+        // more class covering its remaining chars.
+        _alphabet.build(chars);
+        for (const auto &pair : fold_map) {
+            for (wchar_t ch : pair.first) {
+                size_t n = fold::variants(ch, variants);
+                _alphabet.add_group(variants, n);
+            }
+        }
+        std::vector<uint32_t> range_classes;
+        range_classes.reserve(range_rules.size());
+        for (const auto &rule : range_rules) {
+            range_classes.emplace_back(_alphabet.add_range(rule.from_start, rule.from_end));
+        }
+
+        // Identical replacement texts are stored once
+        std::unordered_map<text_t, uint32_t> rep_ids;
+        auto add_replacement = [&](const text_t &rep) {
+            auto [it, inserted] = rep_ids.try_emplace(rep, static_cast<uint32_t>(_rep_begin.size() - 1));
+            if (inserted) {
+                _rep_pool += rep;
+                _rep_begin.emplace_back(static_cast<uint32_t>(_rep_pool.length()));
+            }
+            return it->second;
+        };
+
+        // Build the Trie tree from the replacement map
+        Trie go;
+        std::vector<uint32_t> term_len(1, 0);
+        std::vector<uint32_t> term_rep(1, 0);
+        std::vector<state_t> parent(1, ROOT);
+        std::vector<uint32_t> parent_cls(1, AlphabetMap::OTHER);
+        auto child = [&](state_t cur, uint32_t cls) {
+            state_t next = go.find(cur, cls);
+            if (next != Trie::NONE) {
+                return next;
+            }
+            next = go.add_state();
+            go.add_edge(cur, cls, next);
+            term_len.emplace_back(0);
+            term_rep.emplace_back(0);
+            parent.emplace_back(cur);
+            parent_cls.emplace_back(cls);
+            _depth.emplace_back(_depth[cur] + 1);
+            return next;
+        };
+        auto insert_rules = [&](const ReplacementMap &rules) {
+            for (const auto &pair : rules) {
+                const text_t &pat = pair.first;
+                if (pat.empty())
+                    continue;
+
+                state_t cur = ROOT;
+                for (wchar_t ch : pat) {
+                    cur = child(cur, _alphabet.class_of(ch));
+                }
+                term_len[cur] = static_cast<uint32_t>(pat.length());
+                term_rep[cur] = add_replacement(pair.second);
+            }
+        };
+
+        // A `FOLD` pattern follows every class of each char's variants. Exact rules are
+        // inserted afterwards, so they win where both spell the same text.
+        std::vector<state_t> frontier;
+        std::vector<state_t> next_frontier;
+        for (const auto &pair : fold_map) {
             const text_t &pat = pair.first;
-            const text_t &rep = pair.second;
             if (pat.empty())
                 continue;
 
-            Node *cur = root;
+            frontier.assign(1, ROOT);
             for (wchar_t ch : pat) {
-                if (cur->children.find(ch) == cur->children.end()) {
-                    cur->children[ch] = new Node();
+                uint32_t classes[fold::MAX_VARIANTS];
+                size_t n_classes = 0;
+                size_t n = fold::variants(ch, variants);
+                for (size_t i = 0; i < n; ++i) {
+                    uint32_t cls = _alphabet.class_of(variants[i]);
+                    if (std::find(classes, classes + n_classes, cls) == classes + n_classes) {
+                        classes[n_classes++] = cls;
+                    }
                 }
-                cur = cur->children[ch];
+                if (frontier.size() * n_classes > FOLD_MAX_PATHS) {
+                    frontier.clear();
+                    break;
+                }
+
+                next_frontier.clear();
+                for (state_t cur : frontier) {
+                    for (size_t i = 0; i < n_classes; ++i) {
+                        next_frontier.emplace_back(child(cur, classes[i]));
+                    }
+                }
+                frontier.swap(next_frontier);
+            }
+            if (frontier.empty()) {
+                std::string from;
+                utf8::encode(pat, from);
+                warn("FOLD rule '", from, "' has too many variants split by exact rules, skipped");
+                continue;
+            }
+
+            uint32_t rep = add_replacement(pair.second);
+            for (state_t cur : frontier) {
+                term_len[cur] = static_cast<uint32_t>(pat.length());
+                term_rep[cur] = rep;
             }
-            cur->replacement = rep;
-            cur->pattern_len = pat.length();
         }
+        insert_rules(rep_map);
+        insert_rules(range_chars);
+
+        // A range is a single root child whose output is computed from the matched char
+        for (size_t k = 0; k < range_rules.size(); ++k) {
+            if (range_classes[k] == AlphabetMap::OTHER)
+                continue;
 
-        // NOTE: Simplified failure link construction for non-overlapping patterns
-        // Since patterns don't overlap, we only need basic failure links
-        std::queue<Node *> q;
-        for (auto &pair : root->children) {
-            pair.second->fail = root;
-            q.emplace(pair.second);
+            state_t next = go.add_state();
+            go.add_edge(ROOT, range_classes[k], next);
+            term_len.emplace_back(1);
+            term_rep.emplace_back(RANGE_REP_FLAG | static_cast<uint32_t>(_range_offsets.size()));
+            parent.emplace_back(ROOT);
+            parent_cls.emplace_back(range_classes[k]);
+            _depth.emplace_back(1);
+            _range_offsets.emplace_back(static_cast<int32_t>(range_rules[k].to_start) -
+                                        static_cast<int32_t>(range_rules[k].from_start));
+        }
+        if (!range_rules.empty()) {
+            _max_pattern_len = std::max<size_t>(_max_pattern_len, 1);
         }
 
+        // Standard failure links in BFS order, so a state's failure target
+        // (always shallower) is complete before the state itself
+        std::vector<state_t> order;
+        order.reserve(go.size());
+        _fail.assign(go.size(), ROOT);
+        _out_len.assign(go.size(), 0);
+        _out_rep.assign(go.size(), 0);
+
+        std::queue<state_t> q;
+        q.emplace(ROOT);
         while (!q.empty()) {
-            Node *current = q.front();
+            state_t u = q.front();
             q.pop();
+            order.emplace_back(u);
 
-            for (auto &pair : current->children) {
-                wchar_t ch = pair.first;
-                Node *child = pair.second;
+            if (term_len[u] > 0) {
+                _out_len[u] = term_len[u];
+                _out_rep[u] = term_rep[u];
+            } else if (u != ROOT) {
+                _out_len[u] = _out_len[_fail[u]];
+                _out_rep[u] = _out_rep[_fail[u]];
+            }
 
-                // NOTE: For non-overlapping patterns, failure typically goes back to root
-                // This simplification is valid when patterns don't have common prefixes
-                // that could lead to overlapping matches
-                child->fail = root;
+            go.for_each_edge(u, [&](uint32_t cls, state_t v) {
+                if (u != ROOT) {
+                    state_t f = _fail[u];
+                    while (f != ROOT && go.find(f, cls) == Trie::NONE) {
+                        f = _fail[f];
+                    }
+                    state_t target = go.find(f, cls);
+                    if (target != Trie::NONE && target != v) {
+                        _fail[v] = target;
+                    }
+                }
+                q.emplace(v);
+            });
+        }
+
+        _trie_states = go.size();
+        for (state_t s = 0; s < go.size(); ++s) {
+            size_t n_children = 0;
+            go.for_each_edge(s, [&n_children](uint32_t, state_t) { ++n_children; });
+            if (n_children >= _fanout.size()) {
+                _fanout.resize(n_children + 1, 0);
+            }
+            ++_fanout[n_children];
+        }
 
-                // Check if root has a direct transition for this character
-                auto root_child = root->children.find(ch);
-                if (root_child != root->children.end() && root_child->second != child) {
-                    child->fail = root_child->second;
+        if (minimize) {
+            // Outputs move from the states to a table keyed by the pattern's class path
+            build_match_table(parent, parent_cls, term_len, term_rep);
+            minimize_states(go, order);
+        }
+        const size_t n_states = go.size();
+        const size_t n_classes = _alphabet.size();
+
+        if (n_states * n_classes <= DENSE_TABLE_MAX_ENTRIES) {
+            // Dense DFA: missing transitions are copied from the failure state
+            _delta.assign(n_states * n_classes, ROOT);
+            for (state_t u : order) {
+                state_t *row = _delta.data() + static_cast<size_t>(u) * n_classes;
+                if (u != ROOT) {
+                    const state_t *fail_row = _delta.data() + static_cast<size_t>(_fail[u]) * n_classes;
+                    std::copy(fail_row, fail_row + n_classes, row);
                 }
+                go.for_each_edge(u, [row](uint32_t cls, state_t v) { row[cls] = v; });
+            }
+            if (!keep_trie) {
+                _fail.clear();
+                _fail.shrink_to_fit();
+            }
+        } else {
+            // Too large for a dense table, keep sorted edge lists plus failure links
+            _edge_begin.assign(n_states, 0);
+            _edge_end.assign(n_states, 0);
+            _edges.reserve(go.links.size());
+            for (state_t s = 0; s < n_states; ++s) {
+                _edge_begin[s] = static_cast<uint32_t>(_edges.size());
+                go.for_each_edge(s, [this](uint32_t cls, state_t v) { _edges.emplace_back(Edge{cls, v}); });
+                _edge_end[s] = static_cast<uint32_t>(_edges.size());
+                std::sort(_edges.begin() + _edge_begin[s], _edges.end(),
+                          [](const Edge &a, const Edge &b) { return a.cls < b.cls; });
+            }
+        }
 
-                q.emplace(child);
+        if (keep_trie) {
+            _patchable = true;
+            _parent = std::move(parent);
+            _parent_cls = std::move(parent_cls);
+            _fail_child.assign(n_states, Trie::NONE);
+            _fail_next.assign(n_states, Trie::NONE);
+            _fail_prev.assign(n_states, Trie::NONE);
+            for (state_t s = 1; s < n_states; ++s) {
+                link_fail(s, _fail[s]);
+                _n_patterns += term_len[s] > 0;
+            }
+            _class_chars.assign(n_classes, 0);
+            _alphabet.for_each([this](uint32_t, uint32_t cls) { ++_class_chars[cls]; });
+            _rep_ids = std::move(rep_ids);
+            for (const auto &pair : fold_map) {
+                _fold_keys.insert(pair.first);
             }
+            _range_rules = range_rules;
         }
+
+        // Small rule sets are scanned with the packed prefilter first,
+        // larger ones feed every char through the automaton. Ranges and `FOLD` rules
+        // match more chars than the prefilter's fingerprints, so they always take the automaton.
+        if (range_rules.empty() && fold_map.empty()) {
+            _prefilter.build(patterns);
+        }
+        _narrow_alphabet = _alphabet.narrow();
+#ifdef PUNP_COMPILED_RULES_FILE
+        _compiled = !_delta.empty() && fingerprint() == compiled::FINGERPRINT;
+#endif
     }
 
-    size_t ACAutomaton::apply_replace(text_t &text) const {
-        if (!root || text.empty()) {
-            return 0;
+    /// Insert and remove patterns without a rebuild
+    ///
+    /// New patterns extend the trie and removed ones only lose their output, so state
+    /// ids stay stable. Work is limited to the states whose failure chain runs through
+    /// a changed one, found by walking the failure tree down from it: see `add_state`
+    /// for a new state and `update_outputs` for a changed output. States of removed
+    /// patterns stay, and too many of them, or of edge lists moved away from, refuse
+    /// the patch.
+    ///
+    /// Chars sharing a class (`FOLD` variants, ranges) can't start exact rules of their
+    /// own, and a removed pattern that a `FOLD` or range rule also spells would have to
+    /// fall back to it, so both refuse the patch too.
+    bool ACAutomaton::patch(const ReplacementMap &added, const std::vector<text_t> &removed) {
+        if (!_patchable || _stale_states * 2 > _depth.size() || _stale_edges * 2 > _edges.size()) {
+            return false;
         }
 
-        text_t result;
-        result.reserve(text.length());
+        std::vector<wchar_t> new_chars;
+        size_t max_new_states = 0;
+        for (const auto &pair : added) {
+            max_new_states += pair.first.length();
+            for (wchar_t ch : pair.first) {
+                const uint32_t cls = _alphabet.class_of(ch);
+                if (cls != AlphabetMap::OTHER && _class_chars[cls] > 1) {
+                    return false;
+                }
+                if (cls == AlphabetMap::OTHER && std::find(new_chars.begin(), new_chars.end(), ch) == new_chars.end()) {
+                    new_chars.emplace_back(ch);
+                }
+            }
+        }
+        for (const text_t &pat : removed) {
+            if (!_fold_keys.empty() && _fold_keys.count(fold::fold(pat))) {
+                return false;
+            }
+            for (const auto &rule : _range_rules) {
+                if (pat.length() == 1 && rule.from_start <= pat[0] && pat[0] <= rule.from_end) {
+                    return false;
+                }
+            }
+        }
 
-        size_t text_pos = 0;
-        size_t replacement_count = 0;
+        // The dense table must still fit once new chars and states are added
+        const size_t old_width = _alphabet.size();
+        if (!_delta.empty() && (_depth.size() + max_new_states) * (old_width + new_chars.size()) > DENSE_TABLE_MAX_ENTRIES) {
+            return false;
+        }
 
-        size_t copy_start = 0; // Start of the pending copy region
-        size_t copy_end = 0;   // End of the pending copy region (exclusive)
+        // New chars get their own class, no goto edge uses it yet, so every state goes to the root
+        for (wchar_t ch : new_chars) {
+            _alphabet.add_group(&ch, 1);
+            _class_chars.emplace_back(1);
+        }
+        const size_t width = _alphabet.size();
+        if (!_delta.empty() && width != old_width) {
+            std::vector<state_t> delta(_depth.size() * width, ROOT);
+            for (size_t s = 0; s < _depth.size(); ++s) {
+                std::copy_n(_delta.data() + s * old_width, old_width, delta.data() + s * width);
+            }
+            _delta.swap(delta);
+        }
+
+        // Removed first, so a pattern both removed and added ends up added
+        for (const text_t &pat : removed) {
+            state_t cur = pat.empty() ? Trie::NONE : ROOT;
+            for (size_t i = 0; i < pat.length() && cur != Trie::NONE; ++i) {
+                cur = goto_of(cur, _alphabet.class_of(pat[i]));
+            }
+            if (cur == Trie::NONE || _out_len[cur] != _depth[cur]) {
+                continue;
+            }
+            _out_len[cur] = 0;
+            update_outputs(cur);
+            _stale_states += pat.length();
+            --_n_patterns;
+        }
 
-        auto flush_copy = [&result, &text, &copy_start, &copy_end]() {
-            if (copy_end > copy_start) {
-                result.reserve(result.length() + (copy_end - copy_start));
-                result.append(text.begin() + copy_start, text.begin() + copy_end);
-                copy_start = copy_end;
+        // Identical replacement texts are stored once, as in `build_from_map`
+        auto add_replacement = [&](const text_t &rep) {
+            auto [it, inserted] = _rep_ids.try_emplace(rep, static_cast<uint32_t>(_rep_begin.size() - 1));
+            if (inserted) {
+                _rep_pool += rep;
+                _rep_begin.emplace_back(static_cast<uint32_t>(_rep_pool.length()));
             }
+            return it->second;
         };
 
-        while (text_pos < text.length()) {
-            // Try to find and apply replacements
-            bool found_match = false;
-            Node *cur = root;
-            size_t match_length = 0;
-            text_t replacement;
-
-            // Try to find the longest match starting at current position
-            for (size_t i = text_pos; i < text.length(); ++i) {
-                wchar_t ch = text[i];
-
-                // Check if current character exists in children
-                auto it = cur->children.find(ch);
-                if (it == cur->children.end()) {
-                    // No match possible from this path
-                    break;
+        for (const auto &[pat, rep] : added) {
+            if (pat.empty())
+                continue;
+
+            state_t cur = ROOT;
+            for (wchar_t ch : pat) {
+                const uint32_t cls = _alphabet.class_of(ch);
+                const state_t next = goto_of(cur, cls);
+                cur = next != Trie::NONE ? next : add_state(cur, cls);
+            }
+            _n_patterns += _out_len[cur] != _depth[cur];
+            _out_len[cur] = static_cast<uint32_t>(pat.length());
+            _out_rep[cur] = add_replacement(rep);
+            update_outputs(cur);
+            _max_pattern_len = std::max(_max_pattern_len, pat.length());
+        }
+
+        // Spelling the patterns back only pays off while the prefilter takes them
+        if (_range_rules.empty() && _fold_keys.empty() && _n_patterns <= TeddyMatcher::MAX_PATTERNS) {
+            build_prefilter();
+        } else {
+            _prefilter.clear();
+        }
+        _narrow_alphabet = _alphabet.narrow();
+        // The built-in matcher was generated for other rules
+        _compiled = false;
+        return true;
+    }
+
+    ACAutomaton::state_t ACAutomaton::goto_of(state_t s, uint32_t cls) const {
+        if (!_delta.empty()) {
+            // A transition one level deeper is a goto edge
+            const state_t t = _delta[static_cast<size_t>(s) * _alphabet.size() + cls];
+            return _depth[t] == _depth[s] + 1 ? t : Trie::NONE;
+        }
+        const Edge *begin = _edges.data() + _edge_begin[s];
+        const Edge *end = _edges.data() + _edge_end[s];
+        const Edge *it = std::lower_bound(begin, end, cls, [](const Edge &e, uint32_t c) { return e.cls < c; });
+        return it != end && it->cls == cls ? it->target : Trie::NONE;
+    }
+
+    /// Append the trie child of `parent` on `cls`, with every transition and failure link
+    /// it changes
+    ///
+    /// Its failure target `f` is found as in the BFS build. The new string also becomes
+    /// a suffix of the states `y.cls` for every `y` whose failure chain runs through
+    /// `parent`: where `y` has no `cls` edge, its dense `cls` transition now leads to the
+    /// new state, and where it has one, the child fails to the new state instead of `f`.
+    /// Failure chains below such a child already meet a deeper `cls` edge, so the walk
+    /// stops there. The new state shares the row and output of `f`, and so did every
+    /// state moved onto it, so nothing else changes.
+    ACAutomaton::state_t ACAutomaton::add_state(state_t parent, uint32_t cls) {
+        const size_t width = _alphabet.size();
+        const bool dense = !_delta.empty();
+        const state_t f = parent == ROOT ? ROOT
+                          : dense        ? _delta[static_cast<size_t>(_fail[parent]) * width + cls]
+                                         : sparse_step(_fail[parent], cls);
+
+        // `parent` gets one more child
+        size_t n_children = 0;
+        if (dense) {
+            for (size_t k = 0; k < width; ++k) {
+                n_children += goto_of(parent, static_cast<uint32_t>(k)) != Trie::NONE;
+            }
+        } else {
+            n_children = _edge_end[parent] - _edge_begin[parent];
+        }
+        _fanout.resize(std::max(_fanout.size(), n_children + 2), 0);
+        --_fanout[n_children];
+        ++_fanout[n_children + 1];
+        ++_fanout[0];
+        ++_trie_states;
+
+        const state_t s = static_cast<state_t>(_depth.size());
+        const uint32_t depth = _depth[parent] + 1;
+        const uint32_t out_len = _out_len[f];
+        const uint32_t out_rep = _out_rep[f];
+        _depth.emplace_back(depth);
+        _out_len.emplace_back(out_len);
+        _out_rep.emplace_back(out_rep);
+        _fail.emplace_back(f);
+        _parent.emplace_back(parent);
+        _parent_cls.emplace_back(cls);
+        _fail_child.emplace_back(Trie::NONE);
+        _fail_next.emplace_back(Trie::NONE);
+        _fail_prev.emplace_back(Trie::NONE);
+        if (dense) {
+            _delta.resize(_delta.size() + width);
+        } else {
+            _edge_begin.emplace_back(static_cast<uint32_t>(_edges.size()));
+            _edge_end.emplace_back(static_cast<uint32_t>(_edges.size()));
+        }
+        add_edge(parent, cls, s);
+        if (dense) {
+            std::copy_n(_delta.data() + static_cast<size_t>(f) * width, width, _delta.data() + static_cast<size_t>(s) * width);
+        }
+        link_fail(s, f);
+
+        std::vector<state_t> stack;
+        for (state_t y = _fail_child[parent]; y != Trie::NONE; y = _fail_next[y]) {
+            stack.emplace_back(y);
+        }
+        while (!stack.empty()) {
+            const state_t y = stack.back();
+            stack.pop_back();
+            const state_t x = goto_of(y, cls);
+            if (x != Trie::NONE) {
+                unlink_fail(x);
+                link_fail(x, s);
+                continue;
+            }
+            if (dense) {
+                _delta[static_cast<size_t>(y) * width + cls] = s;
+            }
+            for (state_t z = _fail_child[y]; z != Trie::NONE; z = _fail_next[z]) {
+                stack.emplace_back(z);
+            }
+        }
+        return s;
+    }
+
+    void ACAutomaton::add_edge(state_t s, uint32_t cls, state_t target) {
+        if (!_delta.empty()) {
+            _delta[static_cast<size_t>(s) * _alphabet.size() + cls] = target;
+            return;
+        }
+
+        // Only the last list can grow in place, any other one moves to the end first
+        const uint32_t begin = _edge_begin[s];
+        const uint32_t end = _edge_end[s];
+        if (end != _edges.size()) {
+            const std::vector<Edge> list(_edges.begin() + begin, _edges.begin() + end);
+            _edge_begin[s] = static_cast<uint32_t>(_edges.size());
+            _edges.insert(_edges.end(), list.begin(), list.end());
+            _stale_edges += list.size();
+        }
+        auto it = std::lower_bound(_edges.begin() + _edge_begin[s], _edges.end(), cls,
+                                   [](const Edge &e, uint32_t c) { return e.cls < c; });
+        _edges.insert(it, Edge{cls, target});
+        _edge_end[s] = static_cast<uint32_t>(_edges.size());
+    }
+
+    void ACAutomaton::link_fail(state_t s, state_t fail) {
+        _fail[s] = fail;
+        _fail_prev[s] = Trie::NONE;
+        _fail_next[s] = _fail_child[fail];
+        if (_fail_next[s] != Trie::NONE) {
+            _fail_prev[_fail_next[s]] = s;
+        }
+        _fail_child[fail] = s;
+    }
+
+    void ACAutomaton::unlink_fail(state_t s) {
+        if (_fail_prev[s] != Trie::NONE) {
+            _fail_next[_fail_prev[s]] = _fail_next[s];
+        } else {
+            _fail_child[_fail[s]] = _fail_next[s];
+        }
+        if (_fail_next[s] != Trie::NONE) {
+            _fail_prev[_fail_next[s]] = _fail_prev[s];
+        }
+    }
+
+    /// `s` gained, lost or changed its pattern: states without a pattern of their own
+    /// take the output of their failure state, down the failure tree until a state
+    /// that has one
+    void ACAutomaton::update_outputs(state_t s) {
+        if (_out_len[s] != _depth[s]) {
+            _out_len[s] = _out_len[_fail[s]];
+            _out_rep[s] = _out_rep[_fail[s]];
+        }
+        std::vector<state_t> stack{s};
+        while (!stack.empty()) {
+            const state_t u = stack.back();
+            stack.pop_back();
+            for (state_t v = _fail_child[u]; v != Trie::NONE; v = _fail_next[v]) {
+                if (_out_len[v] != _depth[v]) {
+                    _out_len[v] = _out_len[u];
+                    _out_rep[v] = _out_rep[u];
+                    stack.emplace_back(v);
+                }
+            }
+        }
+    }
+
+    void ACAutomaton::build_prefilter() {
+        // Patterns are spelled back from the trie, only while few enough for the prefilter
+        std::vector<state_t> terminals;
+        for (state_t s = 1; s < _depth.size(); ++s) {
+            if (_out_len[s] == _depth[s]) {
+                if (terminals.size() == TeddyMatcher::MAX_PATTERNS) {
+                    _prefilter.clear();
+                    return;
+                }
+                terminals.emplace_back(s);
+            }
+        }
+
+        std::vector<wchar_t> chars(_alphabet.size(), 0);
+        _alphabet.for_each([&chars](uint32_t cp, uint32_t cls) { chars[cls] = static_cast<wchar_t>(cp); });
+        std::vector<text_t> patterns;
+        patterns.reserve(terminals.size());
+        for (state_t s : terminals) {
+            text_t pat;
+            for (state_t u = s; u != ROOT; u = _parent[u]) {
+                pat += chars[_parent_cls[u]];
+            }
+            std::reverse(pat.begin(), pat.end());
+            patterns.emplace_back(std::move(pat));
+        }
+        _prefilter.build(patterns);
+    }
+
+    /// Merge equivalent states, so patterns sharing a suffix share its states (as in a DAWG)
+    ///
+    /// Two states are merged when they have the same output length, their failure
+    /// targets are merged and their goto edges carry the same classes to merged
+    /// targets, which makes every transition of the automaton agree. The coarsest
+    /// such partition is found by Moore-style refinement starting from output lengths.
+    /// Outputs are no longer per state, see `lookup_rep`, and the depth of a merged
+    /// state is the deepest of its members, which only delays emitting a match.
+    ///
+    /// Every block keeps a member whose failure target lies in a block of smaller
+    /// minimum depth, so blocks ordered by minimum depth still have their failure
+    /// target first, as required by the dense table build, and failure chains end at
+    /// the root. `order` is rewritten in that order.
+    void ACAutomaton::minimize_states(Trie &go, std::vector<state_t> &order) {
+        const size_t n_states = go.size();
+
+        // Goto edges sorted by class, `edges[edge_begin[s], edge_begin[s + 1])`
+        std::vector<uint32_t> edge_begin(n_states + 1, 0);
+        std::vector<Edge> edges;
+        edges.reserve(go.links.size());
+        for (state_t s = 0; s < n_states; ++s) {
+            go.for_each_edge(s, [&edges](uint32_t cls, state_t v) { edges.emplace_back(Edge{cls, v}); });
+            edge_begin[s + 1] = static_cast<uint32_t>(edges.size());
+            std::sort(edges.begin() + edge_begin[s], edges.end(),
+                      [](const Edge &a, const Edge &b) { return a.cls < b.cls; });
+        }
+
+        // Initial partition: the root alone, everything else by output length
+        std::vector<uint32_t> block(n_states, 0);
+        size_t n_blocks = 1;
+        {
+            std::unordered_map<uint32_t, uint32_t> ids;
+            for (size_t s = 1; s < n_states; ++s) {
+                block[s] = ids.try_emplace(_out_len[s], static_cast<uint32_t>(ids.size() + 1)).first->second;
+            }
+            n_blocks += ids.size();
+        }
+
+        // Refine by (block, failure block, edges into blocks) until no block splits.
+        // States are grouped through an open addressing table on the signature hash.
+        constexpr state_t EMPTY_SLOT = UINT32_MAX;
+        std::vector<uint32_t> sig;
+        std::vector<size_t> sig_begin(n_states + 1, 0);
+        std::vector<uint64_t> sig_hash(n_states);
+        std::vector<state_t> table(std::bit_ceil(n_states * 2));
+        std::vector<uint32_t> next_block(n_states);
+        auto sig_equal = [&](state_t a, state_t b) {
+            return sig_hash[a] == sig_hash[b] &&
+                   std::equal(sig.begin() + sig_begin[a], sig.begin() + sig_begin[a + 1],
+                              sig.begin() + sig_begin[b], sig.begin() + sig_begin[b + 1]);
+        };
+        while (true) {
+            sig.clear();
+            for (state_t s = 0; s < n_states; ++s) {
+                sig_begin[s] = sig.size();
+                sig.emplace_back(block[s]);
+                sig.emplace_back(block[_fail[s]]);
+                for (uint32_t k = edge_begin[s]; k < edge_begin[s + 1]; ++k) {
+                    sig.emplace_back(edges[k].cls);
+                    sig.emplace_back(block[edges[k].target]);
                 }
 
-                cur = it->second;
+                uint64_t h = MATCH_HASH_SEED;
+                for (size_t k = sig_begin[s]; k < sig.size(); ++k) {
+                    h = (h ^ sig[k]) * MATCH_HASH_PRIME;
+                }
+                sig_hash[s] = h;
+            }
+            sig_begin[n_states] = sig.size();
+
+            std::fill(table.begin(), table.end(), EMPTY_SLOT);
+            const size_t mask = table.size() - 1;
+            uint32_t n_next = 0;
+            for (state_t s = 0; s < n_states; ++s) {
+                size_t i = static_cast<size_t>(sig_hash[s] ^ (sig_hash[s] >> 32)) & mask;
+                while (table[i] != EMPTY_SLOT && !sig_equal(table[i], s)) {
+                    i = (i + 1) & mask;
+                }
+                if (table[i] == EMPTY_SLOT) {
+                    table[i] = s;
+                    next_block[s] = n_next++;
+                } else {
+                    next_block[s] = next_block[table[i]];
+                }
+            }
+
+            // The signature starts with the old block, so an equal count means nothing split
+            bool stable = n_next == n_blocks;
+            n_blocks = n_next;
+            block.swap(next_block);
+            if (stable)
+                break;
+        }
+
+        // Renumber blocks by minimum depth, the root stays 0
+        std::vector<state_t> member(n_blocks, ROOT);
+        std::vector<uint32_t> min_depth(n_blocks, UINT32_MAX);
+        std::vector<uint32_t> max_depth(n_blocks, 0);
+        for (size_t s = 0; s < n_states; ++s) {
+            uint32_t b = block[s];
+            if (_depth[s] < min_depth[b]) {
+                min_depth[b] = _depth[s];
+                member[b] = static_cast<state_t>(s);
+            }
+            max_depth[b] = std::max(max_depth[b], _depth[s]);
+        }
+        std::vector<uint32_t> by_depth(n_blocks);
+        for (uint32_t b = 0; b < n_blocks; ++b) {
+            by_depth[b] = b;
+        }
+        std::stable_sort(by_depth.begin(), by_depth.end(),
+                         [&](uint32_t a, uint32_t b) { return min_depth[a] < min_depth[b]; });
+        std::vector<state_t> id(n_blocks);
+        for (uint32_t i = 0; i < n_blocks; ++i) {
+            id[by_depth[i]] = i;
+        }
+
+        Trie merged(n_blocks);
+        std::vector<state_t> fail(n_blocks);
+        std::vector<uint32_t> out_len(n_blocks);
+        std::vector<uint32_t> depth(n_blocks);
+        for (uint32_t b = 0; b < n_blocks; ++b) {
+            state_t s = member[b];
+            state_t u = id[b];
+            fail[u] = id[block[_fail[s]]];
+            out_len[u] = _out_len[s];
+            depth[u] = max_depth[b];
+            for (uint32_t k = edge_begin[s]; k < edge_begin[s + 1]; ++k) {
+                merged.add_edge(u, edges[k].cls, id[block[edges[k].target]]);
+            }
+        }
+
+        go = std::move(merged);
+        _fail.swap(fail);
+        _out_len.swap(out_len);
+        _depth.swap(depth);
+        _out_rep.clear();
+        _out_rep.shrink_to_fit();
+        order.resize(n_blocks);
+        for (uint32_t u = 0; u < n_blocks; ++u) {
+            order[u] = u;
+        }
+    }
+
+    void ACAutomaton::build_match_table(const std::vector<state_t> &parent, const std::vector<uint32_t> &parent_cls,
+                                        const std::vector<uint32_t> &term_len, const std::vector<uint32_t> &term_rep) {
+        std::vector<state_t> terminals;
+        for (state_t u = 0; u < term_len.size(); ++u) {
+            if (term_len[u] > 0) {
+                terminals.emplace_back(u);
+            }
+        }
 
-                // Check if this node represents a complete pattern
-                if (cur->pattern_len > 0) {
-                    // Found a match - since patterns don't overlap,
-                    // this is the only possible match at this position
-                    match_length = cur->pattern_len;
-                    replacement = cur->replacement;
-                    found_match = true;
-                    break; // No need to continue as patterns don't overlap
+        // Hash every pattern along its path, reseeding until the hashes are distinct
+        std::vector<uint32_t> path;
+        std::vector<uint64_t> sorted;
+        for (uint64_t attempt = 0;; ++attempt) {
+            _match_seed = MATCH_HASH_SEED + attempt * MATCH_HASH_PRIME;
+            _match_hash.clear();
+            for (state_t u : terminals) {
+                path.clear();
+                for (state_t s = u; s != ROOT; s = parent[s]) {
+                    path.emplace_back(parent_cls[s]);
+                }
+                uint64_t h = _match_seed;
+                for (auto it = path.rbegin(); it != path.rend(); ++it) {
+                    h = (h ^ *it) * MATCH_HASH_PRIME;
                 }
+                _match_hash.emplace_back(h);
             }
+            sorted = _match_hash;
+            std::sort(sorted.begin(), sorted.end());
+            if (std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end())
+                break;
+        }
 
-            if (found_match) {
-                // Flush pending copy buffer before adding replacement
-                flush_copy();
+        _match_rep.clear();
+        for (state_t u : terminals) {
+            _match_rep.emplace_back(term_rep[u]);
+        }
+        _match_slots.assign(std::bit_ceil(terminals.size() * 2 + 1), 0);
+        const size_t mask = _match_slots.size() - 1;
+        for (size_t i = 0; i < _match_hash.size(); ++i) {
+            size_t slot = static_cast<size_t>(_match_hash[i]) & mask;
+            while (_match_slots[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            _match_slots[slot] = static_cast<uint32_t>(i + 1);
+        }
+    }
 
-                // Add the replacement
-                result += replacement;
-                text_pos += match_length;
+    uint32_t ACAutomaton::lookup_rep(view_t match) const {
+        uint64_t h = _match_seed;
+        for (wchar_t ch : match) {
+            h = (h ^ _alphabet.class_of(ch)) * MATCH_HASH_PRIME;
+        }
 
-                // Update copy pointers to skip matched text
-                copy_start = text_pos;
-                copy_end = text_pos;
+        // Every match spells some pattern, so the probe always ends on it
+        const size_t mask = _match_slots.size() - 1;
+        size_t slot = static_cast<size_t>(h) & mask;
+        while (_match_hash[_match_slots[slot] - 1] != h) {
+            slot = (slot + 1) & mask;
+        }
+        return _match_rep[_match_slots[slot] - 1];
+    }
+
+    size_t ACAutomaton::memory_bytes() const noexcept {
+        auto bytes = [](const auto &v) { return v.size() * sizeof(v[0]); };
+        return _alphabet.memory_bytes() + bytes(_depth) + bytes(_out_len) + bytes(_out_rep) + bytes(_rep_pool) +
+               bytes(_rep_begin) + bytes(_range_offsets) + bytes(_delta) + bytes(_edge_begin) + bytes(_edge_end) +
+               bytes(_edges) + bytes(_fail) + bytes(_parent) + bytes(_parent_cls) + bytes(_fail_child) +
+               bytes(_fail_next) + bytes(_fail_prev) + bytes(_class_chars) + bytes(_match_hash) + bytes(_match_rep) +
+               bytes(_match_slots);
+    }
 
-                replacement_count++;
+    ACAutomaton::Stats ACAutomaton::stats() const {
+        Stats stats;
+        stats.trie_states = _trie_states;
+        stats.states = _depth.size();
+        stats.classes = _alphabet.size();
+        stats.max_depth = *std::max_element(_depth.begin(), _depth.end());
+        stats.memory_bytes = memory_bytes();
+        stats.fanout = _fanout;
+        stats.dense = !_delta.empty();
+        stats.minimized = !_match_slots.empty();
+        stats.prefilter = _prefilter.enabled();
+        stats.narrow_alphabet = _narrow_alphabet;
+        stats.compiled = _compiled;
+        stats.patchable = _patchable;
+        return stats;
+    }
+
+    uint64_t ACAutomaton::fingerprint() const {
+        uint64_t h = MATCH_HASH_SEED;
+        auto mix = [&h](uint64_t word) { h = (h ^ word) * MATCH_HASH_PRIME; };
+        auto mix_all = [&mix](const auto &values) {
+            mix(values.size());
+            for (auto value : values) {
+                mix(static_cast<uint64_t>(value));
+            }
+        };
+
+        _alphabet.for_each([&mix](uint32_t cp, uint32_t cls) {
+            mix(cp);
+            mix(cls);
+        });
+        mix_all(_depth);
+        mix_all(_out_len);
+        mix_all(_out_rep);
+        mix_all(_rep_pool);
+        mix_all(_rep_begin);
+        mix_all(_range_offsets);
+        mix_all(_delta);
+        mix(_match_seed);
+        mix_all(_match_rep);
+        return h;
+    }
+
+    /// Emit the alphabet and the transitions as `switch` statements
+    ///
+    /// Only the per-character work is generated, the output tables are taken from the
+    /// automaton built at runtime, which the fingerprint guarantees to be the same one.
+    bool ACAutomaton::emit_cpp(std::string &source) const {
+        if (_delta.empty()) {
+            return false;
+        }
+        const size_t n_classes = _alphabet.size();
+        const size_t n_states = _depth.size();
+
+        std::ostringstream os;
+        os << "// Generated by `punp --emit-cpp`, do not edit.\n"
+           << "// " << n_states << " states, " << n_classes << " classes.\n"
+           << "// Build it in with `cmake -DPUNP_COMPILED_RULES=<this file>`, it is used whenever the\n"
+           << "// loaded rules (and `--minimize-automaton`) produce the automaton it was generated from.\n"
+           << "#pragma once\n\n#include <cstdint>\n\nnamespace punp {\n    namespace compiled {\n\n";
+        os << std::hex << "        constexpr uint64_t FINGERPRINT = 0x" << fingerprint() << "ULL;\n\n";
+
+        // Runs of consecutive chars sharing a class, long ones become range checks
+        constexpr uint32_t MIN_RANGE_RUN = 4;
+        struct Run {
+            uint32_t first, last, cls;
+        };
+        std::vector<Run> runs;
+        _alphabet.for_each([&runs](uint32_t cp, uint32_t cls) {
+            if (!runs.empty() && runs.back().last + 1 == cp && runs.back().cls == cls) {
+                runs.back().last = cp;
             } else {
-                // No match found, extend the copy region
-                copy_end = text_pos + 1;
-                text_pos++;
+                runs.push_back(Run{cp, cp, cls});
+            }
+        });
+
+        os << "        inline uint32_t classify(wchar_t ch) noexcept {\n"
+           << "            const uint32_t cp = static_cast<uint32_t>(ch);\n";
+        for (const Run &run : runs) {
+            if (run.last - run.first + 1 >= MIN_RANGE_RUN) {
+                os << "            if (cp >= 0x" << run.first << " && cp <= 0x" << run.last << ") {\n"
+                   << "                return " << std::dec << run.cls << std::hex << ";\n            }\n";
             }
         }
+        os << "            switch (cp) {\n";
+        for (const Run &run : runs) {
+            if (run.last - run.first + 1 < MIN_RANGE_RUN) {
+                for (uint32_t cp = run.first; cp <= run.last; ++cp) {
+                    os << "            case 0x" << cp << ": return " << std::dec << run.cls << std::hex << ";\n";
+                }
+            }
+        }
+        os << std::dec << "            default: return 0;\n            }\n        }\n\n";
 
-        // Flush any remaining pending copy buffer
-        flush_copy();
+        // One `switch` per state, the most frequent target becomes the default
+        os << "        inline uint32_t step(uint32_t state, uint32_t cls) noexcept {\n"
+           << "            switch (state) {\n";
+        std::unordered_map<state_t, size_t> freq;
+        for (size_t s = 0; s < n_states; ++s) {
+            const state_t *row = _delta.data() + s * n_classes;
+            freq.clear();
+            state_t fallback = row[0];
+            for (size_t c = 0; c < n_classes; ++c) {
+                if (++freq[row[c]] > freq[fallback]) {
+                    fallback = row[c];
+                }
+            }
 
-        if (replacement_count > 0) {
+            os << "            case " << s << ":\n";
+            if (freq[fallback] == n_classes) {
+                os << "                return " << fallback << ";\n";
+                continue;
+            }
+            os << "                switch (cls) {\n";
+            for (size_t c = 0; c < n_classes; ++c) {
+                if (row[c] != fallback) {
+                    os << "                case " << c << ": return " << row[c] << ";\n";
+                }
+            }
+            os << "                default: return " << fallback << ";\n                }\n";
+        }
+        os << "            default: return 0;\n            }\n        }\n\n"
+           << "    } // namespace compiled\n} // namespace punp\n";
+
+        source = std::move(os).str();
+        return true;
+    }
+
+    ACAutomaton::state_t ACAutomaton::sparse_step(state_t state, uint32_t cls) const {
+        while (true) {
+            const Edge *begin = _edges.data() + _edge_begin[state];
+            const Edge *end = _edges.data() + _edge_end[state];
+            const Edge *it = std::lower_bound(begin, end, cls,
+                                              [](const Edge &e, uint32_t c) { return e.cls < c; });
+            if (it != end && it->cls == cls) {
+                return it->target;
+            }
+            if (state == ROOT) {
+                return ROOT;
+            }
+            state = _fail[state];
+        }
+    }
+
+    struct ACAutomaton::RewriteOutput {
+        static constexpr bool REWRITE = true;
+        text_t &out;
+    };
+
+    struct ACAutomaton::CountOutput {
+        static constexpr bool REWRITE = false;
+        void add(size_t, size_t) {}
+    };
+
+    struct ACAutomaton::LocateOutput {
+        static constexpr bool REWRITE = false;
+        std::vector<Match> matches;
+        void add(size_t start, size_t length) { matches.push_back(Match{start, length}); }
+    };
+
+    struct ACAutomaton::Unbounded {
+        static constexpr bool LIMITED = false;
+    };
+
+    struct ACAutomaton::Bounded {
+        static constexpr bool LIMITED = true;
+    };
+
+    /// Leftmost-shortest, non-overlapping replacement on top of a streaming automaton
+    ///
+    /// The automaton state always spells the longest suffix of the scanned text that
+    /// is a pattern prefix, so no partial match can start before `pos - depth`. The
+    /// best match seen so far (smallest start, shortest at that start) is emitted as
+    /// soon as every live partial match starts at or after it; scanning then resumes
+    /// right after the replaced text with a fresh state.
+    ///
+    /// Only matches starting before `limit` are considered. Scanning stops once no
+    /// live partial match starts before `limit`, so the text from there on can be
+    /// rescanned later with a fresh state.
+    ///
+    /// `Output`, `Bound`, `Classify` and `Step` are fixed per instantiation, so the
+    /// replacement bookkeeping, the limit checks, the alphabet lookup and the
+    /// transition lookup a run does not need never reach the inner loop.
+    template <typename Output, typename Bound, typename Classify, typename Step>
+    ACAutomaton::ScanResult ACAutomaton::scan(view_t text, size_t limit, Output &output, Classify classify,
+                                              Step step) const {
+        const size_t len = text.length();
+        constexpr size_t NONE = text_t::npos;
+
+        ScanResult res;
+        size_t copy_start = 0; // Start of the pending copy region
+        telemetry::Tally tally;
+        tally.add(telemetry::Counter::SCANS);
+
+        size_t pos = 0;
+        state_t state = ROOT;
+        size_t best_start = NONE;
+        size_t best_len = 0;
+        uint32_t best_rep = 0;
+
+        while (true) {
+            if (best_start != NONE && (pos >= len || pos >= best_start + _depth[state])) {
+                if constexpr (Output::REWRITE) {
+                    text_t &out = output.out;
+                    if (res.n_rep == 0) {
+                        out.reserve(out.length() + len);
+                    }
+                    // Flush pending copy region, then add the replacement
+                    out.append(text.data() + copy_start, best_start - copy_start);
+                    tally.add(telemetry::Counter::CHARS_COPIED, best_start - copy_start);
+                    if (!_match_slots.empty()) {
+                        best_rep = lookup_rep(text.substr(best_start, best_len));
+                    }
+                    if (best_rep & RANGE_REP_FLAG) {
+                        out += static_cast<wchar_t>(text[best_start] + _range_offsets[best_rep & ~RANGE_REP_FLAG]);
+                        tally.add(telemetry::Counter::CHARS_EMITTED);
+                    } else {
+                        out.append(_rep_pool.data() + _rep_begin[best_rep],
+                                   _rep_begin[best_rep + 1] - _rep_begin[best_rep]);
+                        tally.add(telemetry::Counter::CHARS_EMITTED, _rep_begin[best_rep + 1] - _rep_begin[best_rep]);
+                    }
+                } else {
+                    output.add(best_start, best_len);
+                }
+                res.n_rep++;
+                tally.add(telemetry::Counter::MATCHES);
+                tally.add(telemetry::Counter::CHARS_REPLACED, best_len);
+
+                pos = copy_start = best_start + best_len;
+                state = ROOT;
+                best_start = NONE;
+                continue;
+            }
+
+            if (best_start == NONE) {
+                if (pos >= len || (Bound::LIMITED && pos >= limit + _depth[state])) {
+                    break;
+                }
+
+                // Jump straight to the next position where a pattern may start
+                if (state == ROOT && _prefilter.enabled()) {
+                    const size_t candidate = _prefilter.find_candidate(text, pos);
+                    tally.add(telemetry::Counter::CHARS_SKIPPED, std::min(candidate, len) - pos);
+                    pos = candidate;
+                    if (pos >= limit) {
+                        break;
+                    }
+                }
+            }
+
+            if constexpr (telemetry::ENABLED) {
+                const state_t prev = state;
+                state = step(state, classify(text[pos]));
+                tally.add(telemetry::Counter::TRANSITIONS);
+                tally.add(telemetry::Counter::FAILED_PARTIALS, prev != ROOT && _depth[state] <= _depth[prev]);
+            } else {
+                state = step(state, classify(text[pos]));
+            }
+            ++pos;
+
+            uint32_t out_len = _out_len[state];
+            if (out_len > 0 && pos - out_len < best_start && (!Bound::LIMITED || pos - out_len < limit)) {
+                best_start = pos - out_len;
+                best_len = out_len;
+                if constexpr (Output::REWRITE) {
+                    best_rep = _out_rep.empty() ? 0 : _out_rep[state];
+                }
+            }
+        }
+
+        tally.add(telemetry::Counter::CHARS_SCANNED, std::min(pos, len));
+        res.copied = copy_start;
+        res.resume = std::max(copy_start, limit);
+        return res;
+    }
+
+    /// Pick the alphabet and transition lookups for this automaton
+    ///
+    /// Both are fixed once the automaton is built, so every call takes the same branch.
+    template <typename Output, typename Bound>
+    ACAutomaton::ScanResult ACAutomaton::dispatch_scan(view_t text, size_t limit, Output &output) const {
+#ifdef PUNP_COMPILED_RULES_FILE
+        if (_compiled) {
+            return scan<Output, Bound>(
+                text, limit, output, [](wchar_t ch) { return compiled::classify(ch); },
+                [](state_t state, uint32_t cls) { return compiled::step(state, cls); });
+        }
+#endif
+        auto scan_with = [&](auto classify) {
+            if (!_delta.empty()) {
+                const state_t *delta = _delta.data();
+                const size_t stride = _alphabet.size();
+                return scan<Output, Bound>(text, limit, output, classify, [delta, stride](state_t state, uint32_t cls) {
+                    return delta[static_cast<size_t>(state) * stride + cls];
+                });
+            }
+            return scan<Output, Bound>(text, limit, output, classify, [this](state_t state, uint32_t cls) {
+                return sparse_step(state, cls);
+            });
+        };
+
+        if (_narrow_alphabet) {
+            const uint32_t *table = _alphabet.narrow_table();
+            return scan_with([table](wchar_t ch) {
+                uint32_t cp = static_cast<uint32_t>(ch);
+                return cp < 256 ? table[cp] : AlphabetMap::OTHER;
+            });
+        }
+        return scan_with([this](wchar_t ch) { return _alphabet.class_of(ch); });
+    }
+
+    size_t ACAutomaton::apply_replace(text_t &text) const {
+        if (_depth.size() <= 1 || text.empty()) {
+            return 0;
+        }
+
+        text_t result;
+        RewriteOutput output{result};
+        ScanResult res = dispatch_scan<RewriteOutput, Unbounded>(text, text.length(), output);
+        if (res.n_rep > 0) {
+            // Flush any remaining pending copy region
+            result.append(text, res.copied, text_t::npos);
+            telemetry::Tally tally;
+            tally.add(telemetry::Counter::CHARS_COPIED, text.length() - res.copied);
             text.swap(result);
         }
+        return res.n_rep;
+    }
 
-        return replacement_count;
+    size_t ACAutomaton::apply_replace(view_t text, size_t limit, text_t &out, size_t &resume) const {
+        limit = std::min(limit, text.length());
+        if (_depth.size() <= 1 || limit == 0) {
+            out.append(text.data(), limit);
+            resume = limit;
+            return 0;
+        }
+
+        RewriteOutput output{out};
+        ScanResult res = dispatch_scan<RewriteOutput, Bounded>(text, limit, output);
+        out.append(text.data() + res.copied, res.resume - res.copied);
+        telemetry::Tally tally;
+        tally.add(telemetry::Counter::CHARS_COPIED, res.resume - res.copied);
+        resume = res.resume;
+        return res.n_rep;
     }
 
-    void ACAutomaton::clear() {
-        if (root) {
-            delete root;
-            root = nullptr;
+    size_t ACAutomaton::count_matches(view_t text) const {
+        if (_depth.size() <= 1 || text.empty()) {
+            return 0;
+        }
+
+        CountOutput output;
+        return dispatch_scan<CountOutput, Unbounded>(text, text.length(), output).n_rep;
+    }
+
+    size_t ACAutomaton::count_matches(view_t text, size_t limit, size_t &resume) const {
+        limit = std::min(limit, text.length());
+        if (_depth.size() <= 1 || limit == 0) {
+            resume = limit;
+            return 0;
+        }
+
+        CountOutput output;
+        ScanResult res = dispatch_scan<CountOutput, Bounded>(text, limit, output);
+        resume = res.resume;
+        return res.n_rep;
+    }
+
+    std::vector<ACAutomaton::Match> ACAutomaton::find_matches(view_t text) const {
+        if (_depth.size() <= 1 || text.empty()) {
+            return {};
+        }
+
+        LocateOutput output;
+        dispatch_scan<LocateOutput, Unbounded>(text, text.length(), output);
+        return std::move(output.matches);
+    }
+
+    std::vector<ACAutomaton::Match> ACAutomaton::find_matches(view_t text, size_t limit, size_t &resume) const {
+        limit = std::min(limit, text.length());
+        if (_depth.size() <= 1 || limit == 0) {
+            resume = limit;
+            return {};
         }
+
+        LocateOutput output;
+        resume = dispatch_scan<LocateOutput, Bounded>(text, limit, output).resume;
+        return std::move(output.matches);
+    }
+
+    void ACAutomaton::clear() {
+        _alphabet.clear();
+        _depth.assign(1, 0);
+        _out_len.assign(1, 0);
+        _out_rep.assign(1, 0);
+        _rep_pool.clear();
+        _rep_begin.assign(1, 0);
+        _match_seed = MATCH_HASH_SEED;
+        _match_hash.clear();
+        _match_rep.clear();
+        _match_slots.clear();
+        _range_offsets.clear();
+        _delta.clear();
+        _edge_begin.clear();
+        _edge_end.clear();
+        _edges.clear();
+        _fail.clear();
+        _parent.clear();
+        _parent_cls.clear();
+        _fail_child.clear();
+        _fail_next.clear();
+        _fail_prev.clear();
+        _class_chars.clear();
+        _rep_ids.clear();
+        _fold_keys.clear();
+        _range_rules.clear();
+        _n_patterns = 0;
+        _stale_states = 0;
+        _stale_edges = 0;
+        _trie_states = 1;
+        _fanout.clear();
+        _prefilter.clear();
+        _narrow_alphabet = false;
+        _compiled = false;
+        _patchable = false;
+        _max_pattern_len = 0;
     }
 } // namespace punp
@@ -1,33 +1,195 @@
 #pragma once
 
+#include "algorithm/alphabet.h"
+#include "algorithm/teddy.h"
 #include "base/types.h"
 
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 namespace punp {
     class ACAutomaton {
     public:
+        struct Match {
+            size_t start;
+            size_t length;
+        };
+
+        // Shape of the automaton and the matcher it runs, see `--explain-rules`
+        struct Stats {
+            size_t trie_states = 0; // Before minimization
+            size_t states = 0;
+            size_t classes = 0;
+            size_t max_depth = 0;
+            size_t memory_bytes = 0;
+            std::vector<size_t> fanout; // `fanout[k]` trie states have `k` children
+            bool dense = false;
+            bool minimized = false;
+            bool prefilter = false;
+            bool narrow_alphabet = false;
+            bool compiled = false;
+            bool patchable = false;
+        };
+
         explicit ACAutomaton();
         ~ACAutomaton();
 
-        void build_from_map(const ReplacementMap &rep_map);
+        // `fold_map` holds `FOLD` rules keyed by the folded pattern, see `fold::fold`.
+        // `minimize` merges equivalent states, see `minimize_states`. `patchable` keeps
+        // what `patch` needs and takes precedence over `minimize`.
+        void build_from_map(const ReplacementMap &rep_map, const RangeRules &range_rules = {},
+                            const ReplacementMap &fold_map = {}, bool minimize = false, bool patchable = false);
+
+        // Update the rules in place, as `REPLACE` and `DEL` would: `added` patterns are
+        // inserted or take the new replacement, `removed` ones stop matching. Returns
+        // false without changing anything if this automaton can't be patched, the caller
+        // rebuilds it then. Patching two equal automata the same way keeps them equal.
+        bool patch(const ReplacementMap &added, const std::vector<text_t> &removed);
+        bool patchable() const noexcept { return _patchable; }
         size_t apply_replace(text_t &text) const;
 
+        // Streaming variant: only matches starting before `limit` are applied, though they
+        // may extend past it. The rewritten text up to `resume` (>= limit) is appended to
+        // `out`; the caller continues from `resume` with the following input.
+        size_t apply_replace(view_t text, size_t limit, text_t &out, size_t &resume) const;
+
+        // The matches `apply_replace` would replace, without rewriting anything
+        size_t count_matches(view_t text) const;
+        std::vector<Match> find_matches(view_t text) const;
+        // Streaming variants, as `apply_replace`: matches starting before `limit`, scanning
+        // can continue at `resume` (>= limit) with a fresh state
+        size_t count_matches(view_t text, size_t limit, size_t &resume) const;
+        std::vector<Match> find_matches(view_t text, size_t limit, size_t &resume) const;
+
+        size_t max_pattern_len() const noexcept { return _max_pattern_len; }
+        size_t state_count() const noexcept { return _depth.size(); }
+        size_t memory_bytes() const noexcept;
+        Stats stats() const;
+
+        // Hash of everything matching depends on, equal automata have equal fingerprints
+        uint64_t fingerprint() const;
+        // Whether scanning uses the matcher built in from `PUNP_COMPILED_RULES`
+        bool compiled() const noexcept { return _compiled; }
+        // Write C++ source for a matcher specialized to this automaton, see `--emit-cpp`.
+        // Fails for automata too large for a dense table.
+        bool emit_cpp(std::string &source) const;
+
     private:
-        struct Node {
-            std::unordered_map<wchar_t, Node *> children;
-            Node *fail = nullptr;
-
-            text_t replacement;
-            size_t pattern_len = 0;
-
-            Node() = default;
-            ~Node() {
-                for (auto &pair : children) {
-                    delete pair.second;
-                }
-            }
+        using state_t = uint32_t;
+        static constexpr state_t ROOT = 0;
+        // Dense tables larger than this (in entries) use sparse transitions instead
+        static constexpr size_t DENSE_TABLE_MAX_ENTRIES = size_t(1) << 22;
+        // Set in `_out_rep` for range states, the low bits index `_range_offsets`
+        static constexpr uint32_t RANGE_REP_FLAG = 1u << 31;
+        // Trie paths a single `FOLD` pattern may expand to once exact rules split its variants
+        static constexpr size_t FOLD_MAX_PATHS = size_t(1) << 12;
+        // FNV-1a over class ids, for minimization and the match table of minimized automata
+        static constexpr uint64_t MATCH_HASH_SEED = 0xcbf29ce484222325ULL;
+        static constexpr uint64_t MATCH_HASH_PRIME = 0x100000001b3ULL;
+
+        struct Edge {
+            uint32_t cls;
+            state_t target;
+        };
+
+        AlphabetMap _alphabet; // Pattern chars -> equivalence classes
+
+        // Per-state data, indexed by state id (root is 0)
+        std::vector<uint32_t> _depth;   // Length of the string spelled by the state (an upper bound once minimized)
+        std::vector<uint32_t> _out_len; // Longest pattern that is a suffix of the state, 0 if none
+        std::vector<uint32_t> _out_rep; // Replacement index for that pattern, empty once minimized
+
+        // Distinct replacement texts back to back, `i` is `_rep_pool[_rep_begin[i], _rep_begin[i + 1])`
+        text_t _rep_pool;
+        std::vector<uint32_t> _rep_begin;
+        std::vector<int32_t> _range_offsets; // REPLACE_RANGE target minus source, per range state
+
+        // Dense DFA, `_delta[state * _alphabet.size() + cls]`, failure transitions precomputed
+        std::vector<state_t> _delta;
+
+        // Sparse fallback: edges of state `s` are `_edges[_edge_begin[s], _edge_end[s])`, sorted by class
+        std::vector<uint32_t> _edge_begin;
+        std::vector<uint32_t> _edge_end;
+        std::vector<Edge> _edges;
+        std::vector<state_t> _fail; // Also kept with the dense table when patchable
+
+        // Only when patchable: trie parent of each state and the class leading to it,
+        // and the failure tree as intrusive lists of the states failing to each state
+        std::vector<state_t> _parent;
+        std::vector<uint32_t> _parent_cls;
+        std::vector<state_t> _fail_child;
+        std::vector<state_t> _fail_next;
+        std::vector<state_t> _fail_prev;
+        std::vector<uint32_t> _class_chars; // Chars per class, shared classes can't take exact rules
+        std::unordered_map<text_t, uint32_t> _rep_ids; // Replacement text -> index, as in `build_from_map`
+        std::unordered_set<text_t> _fold_keys;         // `FOLD` patterns, their states can't be removed
+        RangeRules _range_rules;
+        size_t _n_patterns = 0; // States that end a pattern
+        // States left without a pattern by `patch`, an upper bound, and edges `patch` moved away from
+        size_t _stale_states = 0;
+        size_t _stale_edges = 0;
+
+        // A minimized state is shared by several patterns, so the output of a match is looked
+        // up by the hash of its class sequence instead. Every match spells a pattern, and the
+        // seed is chosen so that no two patterns collide, which makes the hash an exact key.
+        uint64_t _match_seed = MATCH_HASH_SEED;
+        std::vector<uint64_t> _match_hash; // Per pattern
+        std::vector<uint32_t> _match_rep;  // Per pattern, as in `_out_rep`
+        std::vector<uint32_t> _match_slots; // Open addressing, pattern index + 1, 0 is empty
+
+        // Trie shape before minimization, for `stats`
+        size_t _trie_states = 1;
+        std::vector<size_t> _fanout;
+
+        // Candidate prefilter for small rule sets, see `TeddyMatcher`
+        TeddyMatcher _prefilter;
+        size_t _max_pattern_len = 0;
+
+        // Every pattern char is below 256, classes come from a flat table
+        bool _narrow_alphabet = false;
+        // The built-in generated matcher has this automaton's fingerprint
+        bool _compiled = false;
+        // Built with `patchable` and eligible for it
+        bool _patchable = false;
+
+        struct ScanResult {
+            size_t n_rep = 0;  // Number of replacements
+            size_t copied = 0; // `text[0, copied)` has been written to the output
+            size_t resume = 0; // `text[copied, resume)` is final but still has to be copied
         };
 
-        Node *root = nullptr;
+        // Compile-time policies of `scan`, defined in ac_automaton.cpp.
+        // Output: what a match produces
+        struct RewriteOutput;
+        struct CountOutput;
+        struct LocateOutput;
+        // Bound: whether matches must start before a `limit` short of the text end
+        struct Unbounded;
+        struct Bounded;
+
+        template <typename Output, typename Bound, typename Classify, typename Step>
+        ScanResult scan(view_t text, size_t limit, Output &output, Classify classify, Step step) const;
+        template <typename Output, typename Bound>
+        ScanResult dispatch_scan(view_t text, size_t limit, Output &output) const;
+        state_t sparse_step(state_t state, uint32_t cls) const;
+
+        // `patch` steps, see there
+        state_t goto_of(state_t s, uint32_t cls) const;
+        state_t add_state(state_t parent, uint32_t cls);
+        void add_edge(state_t s, uint32_t cls, state_t target);
+        void link_fail(state_t s, state_t fail);
+        void unlink_fail(state_t s);
+        void update_outputs(state_t s);
+
+        struct Trie; // Build-time goto function
+        void minimize_states(Trie &go, std::vector<state_t> &order);
+        void build_match_table(const std::vector<state_t> &parent, const std::vector<uint32_t> &parent_cls,
+                               const std::vector<uint32_t> &term_len, const std::vector<uint32_t> &term_rep);
+        uint32_t lookup_rep(view_t match) const;
+        void build_prefilter();
 
         void clear();
     };
@@ -0,0 +1,68 @@
+#include "algorithm/alphabet.h"
+
+namespace punp {
+
+    void AlphabetMap::build(const std::vector<wchar_t> &chars) {
+        clear();
+
+        for (wchar_t ch : chars) {
+            uint32_t cp = static_cast<uint32_t>(ch);
+            if (cp > MAX_CODE_POINT || class_of(ch) != OTHER) {
+                continue;
+            }
+
+            slot(cp) = static_cast<uint32_t>(_n_classes++);
+        }
+    }
+
+    uint32_t AlphabetMap::add_range(wchar_t first, wchar_t last) {
+        uint32_t lo = static_cast<uint32_t>(first);
+        uint32_t hi = std::min(static_cast<uint32_t>(last), MAX_CODE_POINT);
+        uint32_t cls = static_cast<uint32_t>(_n_classes);
+        bool used = false;
+        for (uint32_t cp = lo; cp <= hi; ++cp) {
+            if (class_of(static_cast<wchar_t>(cp)) == OTHER) {
+                slot(cp) = cls;
+                used = true;
+            }
+        }
+        if (!used) {
+            return OTHER;
+        }
+        ++_n_classes;
+        return cls;
+    }
+
+    uint32_t AlphabetMap::add_group(const wchar_t *chars, size_t n) {
+        uint32_t cls = static_cast<uint32_t>(_n_classes);
+        bool used = false;
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t cp = static_cast<uint32_t>(chars[i]);
+            if (cp <= MAX_CODE_POINT && class_of(chars[i]) == OTHER) {
+                slot(cp) = cls;
+                used = true;
+            }
+        }
+        if (!used) {
+            return OTHER;
+        }
+        ++_n_classes;
+        return cls;
+    }
+
+    uint32_t &AlphabetMap::slot(uint32_t cp) {
+        uint16_t &page = _page_index[cp >> PAGE_BITS];
+        if (page == 0) {
+            page = static_cast<uint16_t>(_pages.size() >> PAGE_BITS);
+            _pages.resize(_pages.size() + PAGE_SIZE, OTHER);
+        }
+        return _pages[(static_cast<size_t>(page) << PAGE_BITS) | (cp & PAGE_MASK)];
+    }
+
+    void AlphabetMap::clear() {
+        _page_index.assign(NUM_PAGES, 0);
+        _pages.assign(PAGE_SIZE, OTHER);
+        _n_classes = 1;
+    }
+
+} // namespace punp
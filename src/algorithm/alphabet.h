@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace punp {
+
+    /// Maps characters to dense equivalence class ids.
+    ///
+    /// Every distinct character used by a pattern gets its own class, everything
+    /// else shares class `OTHER`. The lookup is a two-level page table: the upper
+    /// bits of the code point select a 256-entry page, pages without any pattern
+    /// character all alias the zero page. For punctuation rule sets only a handful
+    /// of pages exist, so the whole map stays in L1.
+    class AlphabetMap {
+    public:
+        static constexpr uint32_t OTHER = 0;
+
+        AlphabetMap() { clear(); }
+        ~AlphabetMap() = default;
+
+        // Assign a class to each distinct char, in order of first appearance
+        void build(const std::vector<wchar_t> &chars);
+        // Give every still unclassified char in `[first, last]` one shared new class,
+        // returns `OTHER` if the whole range is already classified
+        uint32_t add_range(wchar_t first, wchar_t last);
+        // Same for an arbitrary set of chars, e.g. the case/width variants of a `FOLD` char
+        uint32_t add_group(const wchar_t *chars, size_t n);
+        void clear();
+
+        uint32_t class_of(wchar_t ch) const noexcept {
+            uint32_t cp = std::min(static_cast<uint32_t>(ch), MAX_CODE_POINT + 1);
+            size_t page = _page_index[cp >> PAGE_BITS];
+            return _pages[(page << PAGE_BITS) | (cp & PAGE_MASK)];
+        }
+
+        // Every classified char is below 256, so `narrow_table()` alone decides the class
+        bool narrow() const noexcept {
+            return _pages.size() == PAGE_SIZE || (_pages.size() == 2 * PAGE_SIZE && _page_index[0] != 0);
+        }
+        // Classes of chars 0..255, anything above is `OTHER` when `narrow()`
+        const uint32_t *narrow_table() const noexcept {
+            return _pages.data() + (static_cast<size_t>(_page_index[0]) << PAGE_BITS);
+        }
+
+        // Call `fn(code_point, cls)` for every classified char, in code point order
+        template <typename Fn>
+        void for_each(Fn fn) const {
+            for (uint32_t page = 0; page < NUM_PAGES - 1; ++page) {
+                const size_t base = static_cast<size_t>(_page_index[page]) << PAGE_BITS;
+                if (base == 0) {
+                    continue;
+                }
+                for (uint32_t i = 0; i < PAGE_SIZE; ++i) {
+                    if (_pages[base + i] != OTHER) {
+                        fn((page << PAGE_BITS) | i, _pages[base + i]);
+                    }
+                }
+            }
+        }
+
+        // Number of classes, including `OTHER`
+        size_t size() const noexcept { return _n_classes; }
+        size_t memory_bytes() const noexcept {
+            return _page_index.size() * sizeof(uint16_t) + _pages.size() * sizeof(uint32_t);
+        }
+
+    private:
+        static constexpr uint32_t MAX_CODE_POINT = 0x10FFFF;
+        static constexpr uint32_t PAGE_BITS = 8;
+        static constexpr uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+        static constexpr uint32_t PAGE_MASK = PAGE_SIZE - 1;
+        // One extra slot so clamped out-of-range chars land on the zero page
+        static constexpr size_t NUM_PAGES = ((MAX_CODE_POINT + 1) >> PAGE_BITS) + 1;
+
+        uint32_t &slot(uint32_t cp);
+
+        std::vector<uint16_t> _page_index; // Code point page -> page in `_pages`
+        std::vector<uint32_t> _pages;      // Page 0 is all `OTHER`
+        size_t _n_classes = 1;
+    };
+
+} // namespace punp
@@ -0,0 +1,187 @@
+#include "algorithm/teddy.h"
+
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#define PUNP_TEDDY_SIMD 1
+#endif
+
+namespace punp {
+
+    namespace {
+        inline uint8_t low_byte(wchar_t ch) {
+            return static_cast<uint8_t>(static_cast<uint32_t>(ch) & 0xFF);
+        }
+
+#ifdef PUNP_TEDDY_SIMD
+        static_assert(sizeof(wchar_t) == 4, "SIMD Teddy expects 32-bit wchar_t");
+
+#if defined(__AVX2__)
+        constexpr size_t BLOCK = 32;
+
+        // Pack the low bytes of 32 consecutive wide chars into one register
+        inline __m256i load_low_bytes(const wchar_t *p) {
+            const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+            const auto *src = reinterpret_cast<const __m256i *>(p);
+            __m256i v0 = _mm256_and_si256(_mm256_loadu_si256(src + 0), byte_mask);
+            __m256i v1 = _mm256_and_si256(_mm256_loadu_si256(src + 1), byte_mask);
+            __m256i v2 = _mm256_and_si256(_mm256_loadu_si256(src + 2), byte_mask);
+            __m256i v3 = _mm256_and_si256(_mm256_loadu_si256(src + 3), byte_mask);
+            __m256i w01 = _mm256_packus_epi32(v0, v1);
+            __m256i w23 = _mm256_packus_epi32(v2, v3);
+            __m256i bytes = _mm256_packus_epi16(w01, w23);
+            // Packs work per 128-bit lane, restore the original dword order
+            return _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        }
+
+        inline __m256i load_table(const uint8_t *table) {
+            return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(table)));
+        }
+
+        inline uint32_t candidate_bits(const wchar_t *p, size_t fp_len,
+                                       const uint8_t *const *lo, const uint8_t *const *hi) {
+            const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+            __m256i acc = _mm256_set1_epi8(static_cast<char>(0xFF));
+            for (size_t k = 0; k < fp_len; ++k) {
+                __m256i bytes = load_low_bytes(p + k);
+                __m256i lo_nib = _mm256_and_si256(bytes, nibble_mask);
+                __m256i hi_nib = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble_mask);
+                __m256i buckets = _mm256_and_si256(_mm256_shuffle_epi8(load_table(lo[k]), lo_nib),
+                                                   _mm256_shuffle_epi8(load_table(hi[k]), hi_nib));
+                acc = _mm256_and_si256(acc, buckets);
+            }
+            __m256i empty = _mm256_cmpeq_epi8(acc, _mm256_setzero_si256());
+            return ~static_cast<uint32_t>(_mm256_movemask_epi8(empty));
+        }
+#else
+        constexpr size_t BLOCK = 16;
+
+        // Pack the low bytes of 16 consecutive wide chars into one register
+        inline __m128i load_low_bytes(const wchar_t *p) {
+            const __m128i byte_mask = _mm_set1_epi32(0xFF);
+            const auto *src = reinterpret_cast<const __m128i *>(p);
+            __m128i v0 = _mm_and_si128(_mm_loadu_si128(src + 0), byte_mask);
+            __m128i v1 = _mm_and_si128(_mm_loadu_si128(src + 1), byte_mask);
+            __m128i v2 = _mm_and_si128(_mm_loadu_si128(src + 2), byte_mask);
+            __m128i v3 = _mm_and_si128(_mm_loadu_si128(src + 3), byte_mask);
+            return _mm_packus_epi16(_mm_packus_epi32(v0, v1), _mm_packus_epi32(v2, v3));
+        }
+
+        inline uint32_t candidate_bits(const wchar_t *p, size_t fp_len,
+                                       const uint8_t *const *lo, const uint8_t *const *hi) {
+            const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+            __m128i acc = _mm_set1_epi8(static_cast<char>(0xFF));
+            for (size_t k = 0; k < fp_len; ++k) {
+                __m128i bytes = load_low_bytes(p + k);
+                __m128i lo_nib = _mm_and_si128(bytes, nibble_mask);
+                __m128i hi_nib = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble_mask);
+                __m128i lo_tab = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo[k]));
+                __m128i hi_tab = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi[k]));
+                __m128i buckets = _mm_and_si128(_mm_shuffle_epi8(lo_tab, lo_nib),
+                                                _mm_shuffle_epi8(hi_tab, hi_nib));
+                acc = _mm_and_si128(acc, buckets);
+            }
+            __m128i empty = _mm_cmpeq_epi8(acc, _mm_setzero_si128());
+            return ~static_cast<uint32_t>(_mm_movemask_epi8(empty)) & 0xFFFFu;
+        }
+#endif
+#endif
+    } // namespace
+
+    bool TeddyMatcher::build(const std::vector<text_t> &patterns) {
+        clear();
+
+        if (patterns.empty() || patterns.size() > MAX_PATTERNS) {
+            return false;
+        }
+
+        size_t min_len = MAX_FINGERPRINT;
+        for (const auto &pat : patterns) {
+            if (pat.empty()) {
+                return false;
+            }
+            min_len = std::min(min_len, pat.length());
+        }
+
+        // Keep patterns sharing a leading char in the same bucket, so that
+        // a candidate usually confirms against a single group of patterns
+        std::vector<const text_t *> sorted;
+        sorted.reserve(patterns.size());
+        for (const auto &pat : patterns) {
+            sorted.emplace_back(&pat);
+        }
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const text_t *a, const text_t *b) { return *a < *b; });
+
+        size_t per_bucket = (sorted.size() + NUM_BUCKETS - 1) / NUM_BUCKETS;
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            const text_t &pat = *sorted[i];
+            uint8_t bucket_bit = static_cast<uint8_t>(1u << (i / per_bucket));
+            for (size_t k = 0; k < min_len; ++k) {
+                uint8_t b = low_byte(pat[k]);
+                _lo_tables[k][b & 0x0F] |= bucket_bit;
+                _hi_tables[k][b >> 4] |= bucket_bit;
+            }
+        }
+
+        _fp_len = min_len;
+        return true;
+    }
+
+    void TeddyMatcher::clear() {
+        for (auto &table : _lo_tables) {
+            table.fill(0);
+        }
+        for (auto &table : _hi_tables) {
+            table.fill(0);
+        }
+        _fp_len = 0;
+    }
+
+    uint8_t TeddyMatcher::scalar_buckets(const wchar_t *p) const {
+        uint8_t acc = 0xFF;
+        for (size_t k = 0; k < _fp_len; ++k) {
+            uint8_t b = low_byte(p[k]);
+            acc &= _lo_tables[k][b & 0x0F] & _hi_tables[k][b >> 4];
+        }
+        return acc;
+    }
+
+    size_t TeddyMatcher::find_candidate(view_t text, size_t pos) const {
+        const size_t len = text.length();
+        if (_fp_len == 0 || len < _fp_len) {
+            return text_t::npos;
+        }
+
+        // A match needs at least `_fp_len` chars, so later positions can be ignored
+        const size_t last = len - _fp_len;
+        const wchar_t *data = text.data();
+
+#ifdef PUNP_TEDDY_SIMD
+        const uint8_t *lo[MAX_FINGERPRINT];
+        const uint8_t *hi[MAX_FINGERPRINT];
+        for (size_t k = 0; k < _fp_len; ++k) {
+            lo[k] = _lo_tables[k].data();
+            hi[k] = _hi_tables[k].data();
+        }
+
+        // Every block reads chars [pos, pos + BLOCK + _fp_len - 1)
+        while (pos + BLOCK <= last + 1) {
+            uint32_t bits = candidate_bits(data + pos, _fp_len, lo, hi);
+            if (bits != 0) {
+                return pos + static_cast<size_t>(__builtin_ctz(bits));
+            }
+            pos += BLOCK;
+        }
+#endif
+
+        for (; pos <= last; ++pos) {
+            if (scalar_buckets(data + pos) != 0) {
+                return pos;
+            }
+        }
+        return text_t::npos;
+    }
+
+} // namespace punp
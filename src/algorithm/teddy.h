@@ -0,0 +1,48 @@
+#pragma once
+
+#include "base/types.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace punp {
+
+    /// Packed multi-literal prefilter in the spirit of Hyperscan's Teddy.
+    ///
+    /// Patterns are spread over 8 buckets. For each of the first few characters of
+    /// a pattern, the low and high nibble of the character's low byte select a bucket
+    /// bit in two 16-entry shuffle tables. A text position is a candidate when the
+    /// tables of every fingerprint character agree on at least one bucket.
+    /// Candidates are not guaranteed matches, the caller must verify them.
+    class TeddyMatcher {
+    public:
+        static constexpr size_t MAX_PATTERNS = 64;
+        static constexpr size_t MAX_FINGERPRINT = 3;
+        static constexpr size_t NUM_BUCKETS = 8;
+
+        TeddyMatcher() = default;
+        ~TeddyMatcher() = default;
+
+        // Returns false (and stays disabled) if the pattern set is not suitable
+        bool build(const std::vector<text_t> &patterns);
+        void clear();
+
+        bool enabled() const noexcept { return _fp_len > 0; }
+        size_t fingerprint_len() const noexcept { return _fp_len; }
+
+        // Position of the first candidate at or after `pos`, or `text_t::npos`
+        size_t find_candidate(view_t text, size_t pos) const;
+
+    private:
+        using nibble_table_t = std::array<uint8_t, 16>;
+
+        std::array<nibble_table_t, MAX_FINGERPRINT> _lo_tables{};
+        std::array<nibble_table_t, MAX_FINGERPRINT> _hi_tables{};
+        size_t _fp_len = 0;
+
+        uint8_t scalar_buckets(const wchar_t *p) const;
+    };
+
+} // namespace punp
@@ -10,7 +10,12 @@
 #define FILENO fileno
 #endif
 
+#include "base/logging/logging.h"
+
 #include <iostream>
+#include <source_location>
+#include <sstream>
+#include <string>
 #include <string_view>
 #include <utility>
 
@@ -27,58 +32,56 @@ namespace punp {
     }
 
     inline bool is_terminal(std::ostream &os) {
+        // Checked once, every log line asks
+        static const bool out_tty = ISATTY(FILENO(stdout));
+        static const bool err_tty = ISATTY(FILENO(stderr));
         if (&os == &std::cout) {
-            return ISATTY(FILENO(stdout));
+            return out_tty;
         } else if (&os == &std::cerr) {
-            return ISATTY(FILENO(stderr));
+            return err_tty;
         }
         return false;
     }
 
+    // Format one line up front so the sink writes it in one piece, even from several threads
     template <typename... Args>
-    inline void colored_print(std::string_view color_code, Args &&...args) {
-        if (is_terminal(std::cout)) {
-            std::cout << color_code;
+    inline std::string format_colored(bool tty, std::string_view color_code, bool newline, Args &&...args) {
+        std::ostringstream oss;
+        if (tty) {
+            oss << color_code;
+        }
+        (oss << ... << std::forward<Args>(args));
+        if (tty) {
+            oss << Colors::RESET;
         }
-        (std::cout << ... << std::forward<Args>(args));
-        if (is_terminal(std::cout)) {
-            std::cout << Colors::RESET;
+        if (newline) {
+            oss << '\n';
         }
+        return std::move(oss).str();
+    }
+
+    template <typename... Args>
+    inline void colored_print(std::string_view color_code, Args &&...args) {
+        logging::write(logging::Stream::OUT,
+                       format_colored(is_terminal(std::cout), color_code, false, std::forward<Args>(args)...));
     }
 
     template <typename... Args>
     inline void colored_println(std::string_view color_code, Args &&...args) {
-        if (is_terminal(std::cout)) {
-            std::cout << color_code;
-        }
-        (std::cout << ... << std::forward<Args>(args));
-        if (is_terminal(std::cout)) {
-            std::cout << Colors::RESET;
-        }
-        std::cout << '\n';
+        logging::write(logging::Stream::OUT,
+                       format_colored(is_terminal(std::cout), color_code, true, std::forward<Args>(args)...));
     }
 
     template <typename... Args>
     inline void colored_print_err(std::string_view color_code, Args &&...args) {
-        if (is_terminal(std::cerr)) {
-            std::cerr << color_code;
-        }
-        (std::cerr << ... << std::forward<Args>(args));
-        if (is_terminal(std::cerr)) {
-            std::cerr << Colors::RESET;
-        }
+        logging::write(logging::Stream::ERR,
+                       format_colored(is_terminal(std::cerr), color_code, false, std::forward<Args>(args)...));
     }
 
     template <typename... Args>
     inline void colored_println_err(std::string_view color_code, Args &&...args) {
-        if (is_terminal(std::cerr)) {
-            std::cerr << color_code;
-        }
-        (std::cerr << ... << std::forward<Args>(args));
-        if (is_terminal(std::cerr)) {
-            std::cerr << Colors::RESET;
-        }
-        std::cerr << '\n';
+        logging::write(logging::Stream::ERR,
+                       format_colored(is_terminal(std::cerr), color_code, true, std::forward<Args>(args)...));
     }
 
 #define PUNP_DEFINE_COLOR_PRINT(FUNC_NAME, COLOR_CONST)          \
@@ -115,10 +118,21 @@ namespace punp {
 
 #undef PUNP_DEFINE_COLOR_PRINTLN
 
+    // Warnings from the same call site are rate limited, see `logging::allow_warning`.
+    // A class template, so the call site can follow the arguments as a default argument.
     template <typename... Args>
-    inline void warn(Args &&...args) {
-        colored_println_err(Colors::YELLOW, "Warn: ", std::forward<Args>(args)...);
-    }
+    struct warn {
+        warn(Args &&...args, std::source_location where = std::source_location::current()) {
+            std::string text = format_colored(false, Colors::RESET, false, std::forward<Args>(args)...);
+            const std::string site = std::string(where.file_name()) + ':' + std::to_string(where.line());
+            if (logging::allow_warning(site, text)) {
+                colored_println_err(Colors::YELLOW, "Warn: ", text);
+            }
+        }
+    };
+
+    template <typename... Args>
+    warn(Args &&...) -> warn<Args...>;
 
     template <typename... Args>
     inline void error(Args &&...args) {
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "base/hardware/hardware.h"
+
+#include <cstdint>
+#include <random>
 #include <string>
 #include <thread>
 
@@ -12,14 +16,98 @@ namespace punp {
     } // namespace RuleFile
 
     namespace Hardware {
-        const size_t HW_MAX_THREADS = std::thread::hardware_concurrency();
-        const size_t AUTO_NUM_THREADS = static_cast<size_t>(HW_MAX_THREADS * 1.5);
+        // CPUs in the affinity mask, capped by the cgroup CPU quota
+        const size_t HW_MAX_THREADS = hardware::resources().cpus;
+        // Oversubscribed to overlap I/O, except under a CPU quota where extra threads only get throttled
+        const size_t AUTO_NUM_THREADS = hardware::resources().cpu_quota > 0
+                                            ? HW_MAX_THREADS
+                                            : static_cast<size_t>(HW_MAX_THREADS * 1.5);
     } // namespace Hardware
 
+    namespace MemoryConfig {
+        constexpr const double BUDGET_FRACTION = 0.5; // Default budget: this share of the usable memory
+        constexpr const size_t BYTES_PER_FILE_BYTE = 10; // Peak footprint of a file processed in memory, per input byte
+    } // namespace MemoryConfig
+
     namespace PageConfig {
         constexpr const size_t SIZE = 16 * 1024; // 16KB per page
     } // namespace PageConfig
 
+    namespace IoConfig {
+        constexpr const size_t MAX_AUTO_THREADS = 8;           // Upper bound of the I/O pool size
+        constexpr const size_t INFLIGHT_FILES_PER_THREAD = 2; // Files loaded ahead per worker
+    } // namespace IoConfig
+
+    namespace StreamConfig {
+        constexpr const size_t THRESHOLD = 256 * 1024 * 1024; // Files above 256MB are streamed
+        constexpr const size_t CHUNK_SIZE = 4 * 1024 * 1024;  // 4MB read window
+        constexpr const size_t WINDOWS_IN_FLIGHT = 2;         // The next window is loaded while one is matched
+        constexpr const char *TMP_SUFFIX = ".punp.tmp";
+    } // namespace StreamConfig
+
+    // Sibling of `path` to write before renaming over it, unique so concurrent runs never share one
+    inline std::string unique_tmp_path(const std::string &path) {
+        static constexpr char HEX[] = "0123456789abcdef";
+        std::random_device rd;
+        uint64_t bits = (static_cast<uint64_t>(rd()) << 32) | rd();
+        std::string suffix(16, '0');
+        for (auto &c : suffix) {
+            c = HEX[bits & 0xf];
+            bits >>= 4;
+        }
+        return path + '.' + suffix + StreamConfig::TMP_SUFFIX;
+    }
+
+    namespace IntraFileConfig {
+        constexpr const size_t CHUNK_SIZE = 4 * 1024 * 1024;        // Bytes decoded, or chars encoded and written, per task
+        constexpr const size_t PARALLEL_THRESHOLD = 2 * CHUNK_SIZE; // Smaller files are decoded and written by one task
+    } // namespace IntraFileConfig
+
+    namespace TraversalCache {
+        constexpr const char *MAGIC = "punp-dircache";
+        constexpr const uint32_t VERSION = 1;
+        const std::string PATH = RuleFile::GLOBAL_RULE_FILE_DIR + "/dircache";
+        constexpr const int64_t RACY_WINDOW_NS = 2'000'000'000; // Directories modified this recently are not cached
+    } // namespace TraversalCache
+
+    namespace WatchdogConfig {
+        constexpr const size_t SLOW_FILE_MS = 10 * 1000; // Files still running after this are reported
+        constexpr const size_t MAX_POLL_MS = 1000;       // Upper bound of the watchdog's check interval
+        constexpr const size_t TOP_N = 10;               // Slowest files listed in the summary
+    } // namespace WatchdogConfig
+
+    namespace ProgressConfig {
+        constexpr const size_t TICK_MS = 250; // Progress line redraw and SIGUSR1 check interval
+    } // namespace ProgressConfig
+
+    namespace LogConfig {
+        constexpr const size_t RING_SIZE = 64 * 1024;    // Per-thread log buffer, power of two
+        constexpr const size_t MAX_RINGS = 256;          // Threads beyond this log synchronously
+        constexpr const int FLUSH_INTERVAL_MS = 20;      // Flusher wakes up at least this often
+        constexpr const size_t WARN_BURST = 10;          // Warnings from the same call site per window
+        constexpr const int64_t WARN_WINDOW_MS = 1000;   // Rate limit window for warnings
+    } // namespace LogConfig
+
+    namespace LspConfig {
+        constexpr const size_t RESCAN_CHUNK = 1024;        // Chars scanned between checks for re-sync with old matches
+        constexpr const size_t MAX_HEADER_LEN = 1024;      // Longest accepted header line
+        constexpr const size_t MAX_MESSAGE_SIZE = 1 << 30; // Largest accepted message body
+    } // namespace LspConfig
+
+    namespace ExplainConfig {
+        constexpr const size_t MAX_LISTED = 20; // Findings of one kind printed by `--explain-rules`
+    } // namespace ExplainConfig
+
+    namespace TuningConfig {
+        constexpr const char *MAGIC = "punp-profile";
+        constexpr const uint32_t VERSION = 1;
+        const std::string PATH = RuleFile::GLOBAL_RULE_FILE_DIR + "/profile";
+        constexpr const size_t RUNS = 3;          // Timed runs per candidate, the fastest one counts
+        constexpr const double MIN_GAIN = 0.03;   // A candidate must be this much faster to replace the best so far
+        constexpr const size_t MAX_IO_THREADS = 32;
+        constexpr const size_t PAGE_SIZES[] = {4 * 1024, 64 * 1024, 256 * 1024}; // Tried besides `PageConfig::SIZE`
+    } // namespace TuningConfig
+
     namespace RemoteStore {
         constexpr const char *repo_url = "https://github.com/haukzero/punp.git";
         constexpr const char *version_file_url = "https://raw.githubusercontent.com/haukzero/punp/refs/heads/master/CMakeLists.txt";
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "base/thread_pool/thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace punp {
+    namespace coro {
+
+        template <typename T = void>
+        class Task;
+
+        namespace detail {
+            // Hands control back to whoever awaited the finished task
+            struct FinalAwaiter {
+                bool await_ready() const noexcept { return false; }
+                template <typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+                    auto continuation = h.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+                void await_resume() const noexcept {}
+            };
+
+            struct PromiseBase {
+                std::coroutine_handle<> continuation;
+                std::exception_ptr exception;
+
+                std::suspend_always initial_suspend() const noexcept { return {}; }
+                FinalAwaiter final_suspend() const noexcept { return {}; }
+                void unhandled_exception() noexcept { exception = std::current_exception(); }
+            };
+        } // namespace detail
+
+        /// Lazily started coroutine, runs when awaited and resumes the awaiter on completion
+        template <typename T>
+        class Task {
+        public:
+            struct promise_type : detail::PromiseBase {
+                std::optional<T> value;
+
+                Task get_return_object() { return Task(handle_t::from_promise(*this)); }
+                template <typename U>
+                void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+            };
+            using handle_t = std::coroutine_handle<promise_type>;
+
+            Task() = default;
+            explicit Task(handle_t h) : _handle(h) {}
+            Task(Task &&other) noexcept : _handle(std::exchange(other._handle, {})) {}
+            Task &operator=(Task &&other) noexcept {
+                if (this != &other) {
+                    destroy();
+                    _handle = std::exchange(other._handle, {});
+                }
+                return *this;
+            }
+            Task(const Task &) = delete;
+            Task &operator=(const Task &) = delete;
+            ~Task() { destroy(); }
+
+            auto operator co_await() && noexcept {
+                struct Awaiter {
+                    handle_t h;
+                    bool await_ready() const noexcept { return !h || h.done(); }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                        h.promise().continuation = awaiting;
+                        return h;
+                    }
+                    T await_resume() {
+                        if (h.promise().exception) {
+                            std::rethrow_exception(h.promise().exception);
+                        }
+                        return std::move(*h.promise().value);
+                    }
+                };
+                return Awaiter{_handle};
+            }
+
+        private:
+            handle_t _handle;
+
+            void destroy() {
+                if (_handle) {
+                    _handle.destroy();
+                    _handle = {};
+                }
+            }
+        };
+
+        template <>
+        class Task<void> {
+        public:
+            struct promise_type : detail::PromiseBase {
+                Task get_return_object() { return Task(handle_t::from_promise(*this)); }
+                void return_void() noexcept {}
+            };
+            using handle_t = std::coroutine_handle<promise_type>;
+
+            Task() = default;
+            explicit Task(handle_t h) : _handle(h) {}
+            Task(Task &&other) noexcept : _handle(std::exchange(other._handle, {})) {}
+            Task &operator=(Task &&other) noexcept {
+                if (this != &other) {
+                    if (_handle) {
+                        _handle.destroy();
+                    }
+                    _handle = std::exchange(other._handle, {});
+                }
+                return *this;
+            }
+            Task(const Task &) = delete;
+            Task &operator=(const Task &) = delete;
+            ~Task() {
+                if (_handle) {
+                    _handle.destroy();
+                }
+            }
+
+            auto operator co_await() && noexcept {
+                struct Awaiter {
+                    handle_t h;
+                    bool await_ready() const noexcept { return !h || h.done(); }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                        h.promise().continuation = awaiting;
+                        return h;
+                    }
+                    void await_resume() {
+                        if (h.promise().exception) {
+                            std::rethrow_exception(h.promise().exception);
+                        }
+                    }
+                };
+                return Awaiter{_handle};
+            }
+
+        private:
+            handle_t _handle;
+        };
+
+        /// Eagerly started, self-destroying coroutine used to launch work from plain code
+        struct DetachedTask {
+            struct promise_type {
+                DetachedTask get_return_object() const noexcept { return {}; }
+                std::suspend_never initial_suspend() const noexcept { return {}; }
+                std::suspend_never final_suspend() const noexcept { return {}; }
+                void return_void() const noexcept {}
+                void unhandled_exception() const noexcept { std::terminate(); }
+            };
+        };
+
+        /// Counting semaphore whose waiters suspend instead of blocking a thread.
+        ///
+        /// Units can be taken several at a time, e.g. bytes of a budget. Waiters are
+        /// served in order, so a large request is not starved by smaller ones; it must
+        /// not exceed the initial count.
+        class AsyncSemaphore {
+        public:
+            AsyncSemaphore(ThreadPool &pool, size_t count) : _pool(pool), _count(count) {}
+
+            auto acquire(size_t n = 1) noexcept {
+                struct Awaiter {
+                    AsyncSemaphore &sem;
+                    size_t n;
+                    bool await_ready() const noexcept { return false; }
+                    bool await_suspend(std::coroutine_handle<> h) {
+                        std::lock_guard<std::mutex> lock(sem._mtx);
+                        if (sem._waiters.empty() && sem._count >= n) {
+                            sem._count -= n;
+                            return false;
+                        }
+                        sem._waiters.emplace_back(h, n);
+                        return true;
+                    }
+                    void await_resume() const noexcept {}
+                };
+                return Awaiter{*this, n};
+            }
+
+            void release(size_t n = 1) {
+                std::vector<std::coroutine_handle<>> ready;
+                {
+                    std::lock_guard<std::mutex> lock(_mtx);
+                    _count += n;
+                    while (!_waiters.empty() && _waiters.front().second <= _count) {
+                        _count -= _waiters.front().second;
+                        ready.push_back(_waiters.front().first);
+                        _waiters.pop_front();
+                    }
+                }
+                // Resume through the pool, so releasing never recurses into the waiter
+                for (auto next : ready) {
+                    _pool.post([next]() { next.resume(); });
+                }
+            }
+
+        private:
+            ThreadPool &_pool;
+            std::mutex _mtx;
+            size_t _count;
+            std::deque<std::pair<std::coroutine_handle<>, size_t>> _waiters;
+        };
+
+        namespace detail {
+            struct WhenAllCounter {
+                std::atomic<size_t> remaining{0};
+                std::coroutine_handle<> waiter;
+                std::exception_ptr exception;
+                std::mutex exception_mtx;
+
+                void arrive() {
+                    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        waiter.resume();
+                    }
+                }
+            };
+
+            template <typename T>
+            DetachedTask when_all_run(ThreadPool &pool, Task<T> &task, T &slot, WhenAllCounter &counter) {
+                co_await pool.schedule();
+                try {
+                    slot = co_await std::move(task);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(counter.exception_mtx);
+                    if (!counter.exception) {
+                        counter.exception = std::current_exception();
+                    }
+                }
+                counter.arrive();
+            }
+
+            template <typename T>
+            struct WhenAllAwaiter {
+                ThreadPool &pool;
+                std::vector<Task<T>> &tasks;
+                std::vector<T> &results;
+                WhenAllCounter &counter;
+
+                bool await_ready() const noexcept { return tasks.empty(); }
+                bool await_suspend(std::coroutine_handle<> h) {
+                    counter.waiter = h;
+                    // One extra count keeps the last task from resuming us before all are launched
+                    counter.remaining.store(tasks.size() + 1, std::memory_order_relaxed);
+                    for (size_t i = 0; i < tasks.size(); ++i) {
+                        when_all_run(pool, tasks[i], results[i], counter);
+                    }
+                    return counter.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+                }
+                void await_resume() const noexcept {}
+            };
+
+            template <typename T>
+            struct SyncState {
+                std::mutex mtx;
+                std::condition_variable cv;
+                bool done = false;
+                std::optional<T> value;
+                std::exception_ptr exception;
+            };
+
+            template <typename T>
+            DetachedTask sync_wait_run(Task<T> &task, SyncState<T> &state) {
+                try {
+                    state.value.emplace(co_await std::move(task));
+                } catch (...) {
+                    state.exception = std::current_exception();
+                }
+                // Notify under the lock, the waiter destroys `state` as soon as it sees `done`
+                std::lock_guard<std::mutex> lock(state.mtx);
+                state.done = true;
+                state.cv.notify_one();
+            }
+        } // namespace detail
+
+        /// Run every task on `pool` in parallel and collect the results in order
+        template <typename T>
+        Task<std::vector<T>> when_all(ThreadPool &pool, std::vector<Task<T>> tasks) {
+            std::vector<T> results(tasks.size());
+            detail::WhenAllCounter counter;
+            co_await detail::WhenAllAwaiter<T>{pool, tasks, results, counter};
+            if (counter.exception) {
+                std::rethrow_exception(counter.exception);
+            }
+            co_return results;
+        }
+
+        /// Block the calling (non-pool) thread until `task` finished
+        template <typename T>
+        T sync_wait(Task<T> task) {
+            detail::SyncState<T> state;
+            detail::sync_wait_run(task, state);
+
+            std::unique_lock<std::mutex> lock(state.mtx);
+            state.cv.wait(lock, [&state] { return state.done; });
+            if (state.exception) {
+                std::rethrow_exception(state.exception);
+            }
+            return std::move(*state.value);
+        }
+
+        /// Awaitable that runs `fn` on `worker` and resumes the awaiting coroutine on `resume_on`
+        template <typename F>
+        auto run_on(ThreadPool &worker, ThreadPool &resume_on, F fn) {
+            using result_t = std::invoke_result_t<F &>;
+            struct Awaiter {
+                ThreadPool &worker;
+                ThreadPool &resume_on;
+                F fn;
+                std::optional<result_t> result;
+                std::exception_ptr exception;
+
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<> h) {
+                    worker.post([this, h]() {
+                        try {
+                            result.emplace(fn());
+                        } catch (...) {
+                            exception = std::current_exception();
+                        }
+                        resume_on.post([h]() { h.resume(); });
+                    });
+                }
+                result_t await_resume() {
+                    if (exception) {
+                        std::rethrow_exception(exception);
+                    }
+                    return std::move(*result);
+                }
+            };
+            return Awaiter{worker, resume_on, std::move(fn), std::nullopt, nullptr};
+        }
+
+    } // namespace coro
+} // namespace punp
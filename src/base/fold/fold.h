@@ -0,0 +1,63 @@
+#pragma once
+
+#include "base/types.h"
+
+#include <cstddef>
+
+namespace punp {
+    namespace fold {
+
+        /// Character folding for `FOLD` rules: ASCII case and full/half width.
+        ///
+        /// Full-width forms U+FF01..U+FF5E fold to ASCII U+0021..U+007E, the ideographic
+        /// space U+3000 folds to ' ', and ASCII upper case folds to lower case.
+
+        constexpr wchar_t WIDE_FIRST = 0xFF01;
+        constexpr wchar_t WIDE_LAST = 0xFF5E;
+        constexpr wchar_t WIDE_OFFSET = 0xFEE0;
+        constexpr wchar_t IDEOGRAPHIC_SPACE = 0x3000;
+
+        // A folded char has at most 4 variants, e.g. 'a', 'A', 'ａ', 'Ａ'
+        constexpr size_t MAX_VARIANTS = 4;
+
+        constexpr wchar_t fold_char(wchar_t ch) noexcept {
+            if (ch >= WIDE_FIRST && ch <= WIDE_LAST) {
+                ch -= WIDE_OFFSET;
+            } else if (ch == IDEOGRAPHIC_SPACE) {
+                ch = L' ';
+            }
+            if (ch >= L'A' && ch <= L'Z') {
+                ch += L'a' - L'A';
+            }
+            return ch;
+        }
+
+        inline text_t fold(view_t text) {
+            text_t result(text);
+            for (wchar_t &ch : result) {
+                ch = fold_char(ch);
+            }
+            return result;
+        }
+
+        // Write every char folding to `ch` into `out` (`ch` itself first), returns the count
+        inline size_t variants(wchar_t ch, wchar_t (&out)[MAX_VARIANTS]) noexcept {
+            ch = fold_char(ch);
+            size_t n = 0;
+            out[n++] = ch;
+            if (ch >= L'a' && ch <= L'z') {
+                out[n++] = ch - (L'a' - L'A');
+            }
+            for (size_t i = 0, narrow = n; i < narrow; ++i) {
+                if (out[i] >= WIDE_FIRST - WIDE_OFFSET && out[i] <= WIDE_LAST - WIDE_OFFSET) {
+                    out[n++] = out[i] + WIDE_OFFSET;
+                }
+            }
+            if (ch == L' ') {
+                out[n++] = IDEOGRAPHIC_SPACE;
+            }
+            return n;
+        }
+
+    } // namespace fold
+} // namespace punp
@@ -0,0 +1,199 @@
+#include "base/hardware/hardware.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace punp {
+    namespace hardware {
+
+        namespace {
+#ifdef __linux__
+            // First line of a small kernel file, empty if it cannot be read
+            std::string read_first_line(const std::string &path) {
+                std::ifstream input(path);
+                std::string line;
+                std::getline(input, line);
+                return line;
+            }
+
+            bool has_option(const std::string &options, const std::string &name) {
+                std::istringstream in(options);
+                std::string option;
+                while (std::getline(in, option, ',')) {
+                    if (option == name) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            /// Directories of this process' cgroup for `controller`, innermost first up to
+            /// the mount point. A v1 hierarchy carrying the controller takes precedence over
+            /// the unified one, as on hybrid setups; `v2` tells which one was found.
+            std::vector<std::string> cgroup_dirs(const std::string &controller, bool &v2) {
+                // "<id> <parent> <dev> <root> <mount point> <options...> - <fs type> <source> <super options>"
+                std::ifstream mountinfo("/proc/self/mountinfo");
+                std::string line;
+                std::string root;
+                std::string mount_point;
+                v2 = false;
+                while (std::getline(mountinfo, line)) {
+                    const size_t sep = line.find(" - ");
+                    if (sep == std::string::npos) {
+                        continue;
+                    }
+                    std::istringstream left(line.substr(0, sep));
+                    std::istringstream right(line.substr(sep + 3));
+                    std::string id, parent, dev, mount_root, point, fs_type, source, super_options;
+                    left >> id >> parent >> dev >> mount_root >> point;
+                    right >> fs_type >> source >> super_options;
+                    if (fs_type == "cgroup" && has_option(super_options, controller)) {
+                        root = mount_root;
+                        mount_point = point;
+                        v2 = false;
+                        break;
+                    }
+                    if (fs_type == "cgroup2" && mount_point.empty()) {
+                        root = mount_root;
+                        mount_point = point;
+                        v2 = true;
+                    }
+                }
+                if (mount_point.empty()) {
+                    return {};
+                }
+
+                // "<id>:<controllers>:<path>", the unified hierarchy is "0::<path>"
+                std::ifstream cgroup("/proc/self/cgroup");
+                std::string path;
+                while (std::getline(cgroup, line)) {
+                    const size_t first = line.find(':');
+                    const size_t second = first == std::string::npos ? first : line.find(':', first + 1);
+                    if (second == std::string::npos) {
+                        continue;
+                    }
+                    const std::string controllers = line.substr(first + 1, second - first - 1);
+                    if (v2 ? controllers.empty() : has_option(controllers, controller)) {
+                        path = line.substr(second + 1);
+                        break;
+                    }
+                }
+
+                // Inside a cgroup namespace the path may not be under the mount root, then
+                // the mount point itself is this process' cgroup
+                std::string relative;
+                if (root == "/") {
+                    relative = path;
+                } else if (path.compare(0, root.length(), root) == 0) {
+                    relative = path.substr(root.length());
+                }
+                while (!relative.empty() && relative.back() == '/') {
+                    relative.pop_back();
+                }
+
+                std::vector<std::string> dirs;
+                for (;;) {
+                    dirs.push_back(mount_point + relative);
+                    if (relative.empty()) {
+                        break;
+                    }
+                    const size_t slash = relative.rfind('/');
+                    relative.resize(slash == std::string::npos ? 0 : slash);
+                }
+                return dirs;
+            }
+
+            // Tightest CPU quota in CPUs, 0 if there is none
+            double cgroup_cpu_quota() {
+                bool v2 = false;
+                double quota = 0;
+                for (const auto &dir : cgroup_dirs("cpu", v2)) {
+                    double cpus = 0;
+                    if (v2) {
+                        // "max <period>" or "<quota> <period>"
+                        std::istringstream in(read_first_line(dir + "/cpu.max"));
+                        std::string max;
+                        double period = 0;
+                        if (in >> max >> period && max != "max" && period > 0) {
+                            cpus = std::strtod(max.c_str(), nullptr) / period;
+                        }
+                    } else {
+                        // -1 for no quota
+                        const double max = std::strtod(read_first_line(dir + "/cpu.cfs_quota_us").c_str(), nullptr);
+                        const double period = std::strtod(read_first_line(dir + "/cpu.cfs_period_us").c_str(), nullptr);
+                        if (max > 0 && period > 0) {
+                            cpus = max / period;
+                        }
+                    }
+                    if (cpus > 0 && (quota == 0 || cpus < quota)) {
+                        quota = cpus;
+                    }
+                }
+                return quota;
+            }
+
+            // Tightest memory limit in bytes, 0 if there is none
+            uint64_t cgroup_memory_limit() {
+                bool v2 = false;
+                uint64_t limit = 0;
+                for (const auto &dir : cgroup_dirs("memory", v2)) {
+                    // "max" on v2; v1 reports no limit as a huge page-aligned number,
+                    // left for the cap by physical memory to sort out
+                    const std::string value = read_first_line(dir + (v2 ? "/memory.max" : "/memory.limit_in_bytes"));
+                    const uint64_t bytes = value.empty() || value == "max" ? 0 : std::strtoull(value.c_str(), nullptr, 10);
+                    if (bytes > 0 && (limit == 0 || bytes < limit)) {
+                        limit = bytes;
+                    }
+                }
+                return limit;
+            }
+#endif
+
+            Resources detect() {
+                Resources res;
+                res.affinity_cpus = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+#ifdef __linux__
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+                    res.affinity_cpus = CPU_COUNT(&set);
+                }
+                res.cpu_quota = cgroup_cpu_quota();
+
+                const long pages = sysconf(_SC_PHYS_PAGES);
+                const long page_size = sysconf(_SC_PAGESIZE);
+                if (pages > 0 && page_size > 0) {
+                    res.physical_memory = static_cast<uint64_t>(pages) * static_cast<uint64_t>(page_size);
+                }
+                res.memory_limit = cgroup_memory_limit();
+                if (res.physical_memory > 0 && res.memory_limit >= res.physical_memory) {
+                    res.memory_limit = 0; // Unlimited, or no tighter than the machine
+                }
+#endif
+                res.cpus = res.affinity_cpus;
+                if (res.cpu_quota > 0) {
+                    res.cpus = std::clamp(static_cast<size_t>(std::ceil(res.cpu_quota)), static_cast<size_t>(1), res.cpus);
+                }
+                res.memory = res.memory_limit ? res.memory_limit : res.physical_memory;
+                return res;
+            }
+        } // namespace
+
+        const Resources &resources() {
+            static const Resources res = detect();
+            return res;
+        }
+
+    } // namespace hardware
+} // namespace punp
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace punp {
+    namespace hardware {
+
+        /// CPUs and memory this process can actually use.
+        ///
+        /// `std::thread::hardware_concurrency()` and the physical memory size describe
+        /// the host; in a container the affinity mask and the cgroup (v1 or v2) CPU
+        /// quota and memory limit are what count. Limits set on ancestor cgroups
+        /// apply too, the tightest one wins.
+        struct Resources {
+            size_t cpus = 1;              // Affinity mask, capped by the CPU quota rounded up
+            size_t affinity_cpus = 1;     // CPUs in the affinity mask
+            double cpu_quota = 0;         // cgroup CPU quota in CPUs, 0 if there is none
+            uint64_t memory = 0;          // Physical memory, capped by the cgroup limit, 0 if unknown
+            uint64_t physical_memory = 0; // 0 if unknown
+            uint64_t memory_limit = 0;    // cgroup memory limit, 0 if there is none
+        };
+
+        // Detected once, on first use
+        const Resources &resources();
+
+    } // namespace hardware
+} // namespace punp
@@ -0,0 +1,464 @@
+#include "base/json/json.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace punp {
+    namespace json {
+
+        namespace {
+            // Deeper documents are rejected instead of exhausting the stack
+            constexpr size_t MAX_DEPTH = 256;
+
+            const Value NULL_VALUE;
+            const std::string EMPTY_STRING;
+            const Array EMPTY_ARRAY;
+            const Object EMPTY_OBJECT;
+
+            void append_utf8(uint32_t cp, std::string &out) {
+                if (cp < 0x80) {
+                    out += static_cast<char>(cp);
+                } else if (cp < 0x800) {
+                    out += static_cast<char>(0xC0 | (cp >> 6));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    out += static_cast<char>(0xE0 | (cp >> 12));
+                    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                } else {
+                    out += static_cast<char>(0xF0 | (cp >> 18));
+                    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                }
+            }
+
+            void dump_string(const std::string &s, std::string &out) {
+                out += '"';
+                for (char c : s) {
+                    switch (c) {
+                    case '"': out += "\\\""; break;
+                    case '\\': out += "\\\\"; break;
+                    case '\n': out += "\\n"; break;
+                    case '\r': out += "\\r"; break;
+                    case '\t': out += "\\t"; break;
+                    case '\b': out += "\\b"; break;
+                    case '\f': out += "\\f"; break;
+                    default:
+                        if (static_cast<unsigned char>(c) < 0x20) {
+                            char buf[8];
+                            std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+                            out += buf;
+                        } else {
+                            out += c;
+                        }
+                    }
+                }
+                out += '"';
+            }
+
+            class Parser {
+            public:
+                Parser(std::string_view text, std::string &err) : _text(text), _err(err) {}
+
+                std::optional<Value> document() {
+                    Value value;
+                    if (!parse_value(value, 0)) {
+                        return std::nullopt;
+                    }
+                    skip_ws();
+                    if (_pos != _text.size()) {
+                        return fail("Trailing characters");
+                    }
+                    return value;
+                }
+
+            private:
+                std::string_view _text;
+                std::string &_err;
+                size_t _pos = 0;
+
+                std::nullopt_t fail(const char *what) {
+                    _err = std::string(what) + " at offset " + std::to_string(_pos);
+                    return std::nullopt;
+                }
+
+                void skip_ws() {
+                    while (_pos < _text.size() &&
+                           (_text[_pos] == ' ' || _text[_pos] == '\t' || _text[_pos] == '\n' || _text[_pos] == '\r')) {
+                        ++_pos;
+                    }
+                }
+
+                bool consume(std::string_view word) {
+                    if (_text.substr(_pos, word.size()) == word) {
+                        _pos += word.size();
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool parse_value(Value &value, size_t depth) {
+                    if (depth > MAX_DEPTH) {
+                        fail("Nesting too deep");
+                        return false;
+                    }
+                    skip_ws();
+                    if (_pos >= _text.size()) {
+                        fail("Unexpected end of input");
+                        return false;
+                    }
+                    switch (_text[_pos]) {
+                    case '{': return parse_object(value, depth);
+                    case '[': return parse_array(value, depth);
+                    case '"': {
+                        std::string s;
+                        if (!parse_string(s)) {
+                            return false;
+                        }
+                        value = Value(std::move(s));
+                        return true;
+                    }
+                    case 't':
+                    case 'f':
+                    case 'n':
+                        if (consume("true")) {
+                            value = Value(true);
+                        } else if (consume("false")) {
+                            value = Value(false);
+                        } else if (consume("null")) {
+                            value = Value();
+                        } else {
+                            fail("Invalid literal");
+                            return false;
+                        }
+                        return true;
+                    default:
+                        return parse_number(value);
+                    }
+                }
+
+                bool parse_number(Value &value) {
+                    const size_t start = _pos;
+                    if (_pos < _text.size() && _text[_pos] == '-') {
+                        ++_pos;
+                    }
+                    auto digits = [this]() {
+                        size_t n = 0;
+                        while (_pos < _text.size() && _text[_pos] >= '0' && _text[_pos] <= '9') {
+                            ++_pos;
+                            ++n;
+                        }
+                        return n;
+                    };
+                    if (digits() == 0) {
+                        fail("Invalid number");
+                        return false;
+                    }
+                    if (_pos < _text.size() && _text[_pos] == '.') {
+                        ++_pos;
+                        if (digits() == 0) {
+                            fail("Invalid number");
+                            return false;
+                        }
+                    }
+                    if (_pos < _text.size() && (_text[_pos] == 'e' || _text[_pos] == 'E')) {
+                        ++_pos;
+                        if (_pos < _text.size() && (_text[_pos] == '+' || _text[_pos] == '-')) {
+                            ++_pos;
+                        }
+                        if (digits() == 0) {
+                            fail("Invalid number");
+                            return false;
+                        }
+                    }
+                    value = Value(std::strtod(std::string(_text.substr(start, _pos - start)).c_str(), nullptr));
+                    return true;
+                }
+
+                bool parse_hex4(uint32_t &cp) {
+                    if (_pos + 4 > _text.size()) {
+                        fail("Truncated escape");
+                        return false;
+                    }
+                    cp = 0;
+                    for (size_t i = 0; i < 4; ++i) {
+                        char c = _text[_pos++];
+                        cp <<= 4;
+                        if (c >= '0' && c <= '9') {
+                            cp |= static_cast<uint32_t>(c - '0');
+                        } else if (c >= 'a' && c <= 'f') {
+                            cp |= static_cast<uint32_t>(c - 'a' + 10);
+                        } else if (c >= 'A' && c <= 'F') {
+                            cp |= static_cast<uint32_t>(c - 'A' + 10);
+                        } else {
+                            fail("Invalid escape");
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+
+                bool parse_string(std::string &out) {
+                    ++_pos; // Opening quote
+                    while (_pos < _text.size()) {
+                        char c = _text[_pos++];
+                        if (c == '"') {
+                            return true;
+                        }
+                        if (static_cast<unsigned char>(c) < 0x20) {
+                            fail("Control character in string");
+                            return false;
+                        }
+                        if (c != '\\') {
+                            out += c;
+                            continue;
+                        }
+                        if (_pos >= _text.size()) {
+                            break;
+                        }
+                        switch (_text[_pos++]) {
+                        case '"': out += '"'; break;
+                        case '\\': out += '\\'; break;
+                        case '/': out += '/'; break;
+                        case 'b': out += '\b'; break;
+                        case 'f': out += '\f'; break;
+                        case 'n': out += '\n'; break;
+                        case 'r': out += '\r'; break;
+                        case 't': out += '\t'; break;
+                        case 'u': {
+                            uint32_t cp;
+                            if (!parse_hex4(cp)) {
+                                return false;
+                            }
+                            // Surrogate pair, a lone surrogate becomes U+FFFD
+                            if (cp >= 0xD800 && cp <= 0xDBFF && consume("\\u")) {
+                                uint32_t low;
+                                if (!parse_hex4(low)) {
+                                    return false;
+                                }
+                                cp = (low >= 0xDC00 && low <= 0xDFFF) ? 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00)
+                                                                      : 0xFFFD;
+                            } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+                                cp = 0xFFFD;
+                            }
+                            append_utf8(cp, out);
+                            break;
+                        }
+                        default:
+                            fail("Invalid escape");
+                            return false;
+                        }
+                    }
+                    fail("Unterminated string");
+                    return false;
+                }
+
+                bool parse_array(Value &value, size_t depth) {
+                    ++_pos;
+                    Array array;
+                    skip_ws();
+                    if (_pos < _text.size() && _text[_pos] == ']') {
+                        ++_pos;
+                        value = Value(std::move(array));
+                        return true;
+                    }
+                    while (true) {
+                        Value item;
+                        if (!parse_value(item, depth + 1)) {
+                            return false;
+                        }
+                        array.push_back(std::move(item));
+                        skip_ws();
+                        if (_pos < _text.size() && _text[_pos] == ',') {
+                            ++_pos;
+                        } else if (_pos < _text.size() && _text[_pos] == ']') {
+                            ++_pos;
+                            value = Value(std::move(array));
+                            return true;
+                        } else {
+                            fail("Expected ',' or ']'");
+                            return false;
+                        }
+                    }
+                }
+
+                bool parse_object(Value &value, size_t depth) {
+                    ++_pos;
+                    Object object;
+                    skip_ws();
+                    if (_pos < _text.size() && _text[_pos] == '}') {
+                        ++_pos;
+                        value = Value(std::move(object));
+                        return true;
+                    }
+                    while (true) {
+                        skip_ws();
+                        std::string key;
+                        if (_pos >= _text.size() || _text[_pos] != '"') {
+                            fail("Expected member name");
+                            return false;
+                        }
+                        if (!parse_string(key)) {
+                            return false;
+                        }
+                        skip_ws();
+                        if (_pos >= _text.size() || _text[_pos] != ':') {
+                            fail("Expected ':'");
+                            return false;
+                        }
+                        ++_pos;
+                        Value member;
+                        if (!parse_value(member, depth + 1)) {
+                            return false;
+                        }
+                        object.emplace_back(std::move(key), std::move(member));
+                        skip_ws();
+                        if (_pos < _text.size() && _text[_pos] == ',') {
+                            ++_pos;
+                        } else if (_pos < _text.size() && _text[_pos] == '}') {
+                            ++_pos;
+                            value = Value(std::move(object));
+                            return true;
+                        } else {
+                            fail("Expected ',' or '}'");
+                            return false;
+                        }
+                    }
+                }
+            };
+        } // namespace
+
+        bool Value::as_bool(bool fallback) const noexcept {
+            return is_bool() ? std::get<bool>(_data) : fallback;
+        }
+
+        double Value::as_number(double fallback) const noexcept {
+            return is_number() ? std::get<double>(_data) : fallback;
+        }
+
+        int64_t Value::as_int(int64_t fallback) const noexcept {
+            return is_number() ? static_cast<int64_t>(std::get<double>(_data)) : fallback;
+        }
+
+        const std::string &Value::as_string() const noexcept {
+            return is_string() ? std::get<std::string>(_data) : EMPTY_STRING;
+        }
+
+        const Array &Value::as_array() const noexcept {
+            return is_array() ? std::get<Array>(_data) : EMPTY_ARRAY;
+        }
+
+        const Object &Value::as_object() const noexcept {
+            return is_object() ? std::get<Object>(_data) : EMPTY_OBJECT;
+        }
+
+        const Value &Value::operator[](std::string_view key) const noexcept {
+            for (const auto &[name, value] : as_object()) {
+                if (name == key) {
+                    return value;
+                }
+            }
+            return NULL_VALUE;
+        }
+
+        bool Value::contains(std::string_view key) const noexcept {
+            for (const auto &member : as_object()) {
+                if (member.first == key) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        Value &Value::set(std::string key, Value value) {
+            if (!is_object()) {
+                _data = Object();
+            }
+            auto &object = std::get<Object>(_data);
+            for (auto &member : object) {
+                if (member.first == key) {
+                    member.second = std::move(value);
+                    return *this;
+                }
+            }
+            object.emplace_back(std::move(key), std::move(value));
+            return *this;
+        }
+
+        Value &Value::push(Value value) {
+            if (!is_array()) {
+                _data = Array();
+            }
+            std::get<Array>(_data).push_back(std::move(value));
+            return *this;
+        }
+
+        std::string Value::dump() const {
+            std::string out;
+            dump(out);
+            return out;
+        }
+
+        void Value::dump(std::string &out) const {
+            switch (_data.index()) {
+            case 0:
+                out += "null";
+                break;
+            case 1:
+                out += std::get<bool>(_data) ? "true" : "false";
+                break;
+            case 2: {
+                double n = std::get<double>(_data);
+                if (!std::isfinite(n)) {
+                    out += "null";
+                } else if (n == std::floor(n) && std::fabs(n) < 1e15) {
+                    out += std::to_string(static_cast<int64_t>(n));
+                } else {
+                    char buf[32];
+                    std::snprintf(buf, sizeof(buf), "%.17g", n);
+                    out += buf;
+                }
+                break;
+            }
+            case 3:
+                dump_string(std::get<std::string>(_data), out);
+                break;
+            case 4: {
+                out += '[';
+                bool first = true;
+                for (const auto &item : std::get<Array>(_data)) {
+                    if (!first) {
+                        out += ',';
+                    }
+                    first = false;
+                    item.dump(out);
+                }
+                out += ']';
+                break;
+            }
+            default: {
+                out += '{';
+                bool first = true;
+                for (const auto &[key, value] : std::get<Object>(_data)) {
+                    if (!first) {
+                        out += ',';
+                    }
+                    first = false;
+                    dump_string(key, out);
+                    out += ':';
+                    value.dump(out);
+                }
+                out += '}';
+                break;
+            }
+            }
+        }
+
+        std::optional<Value> Value::parse(std::string_view text, std::string &err) {
+            return Parser(text, err).document();
+        }
+
+    } // namespace json
+} // namespace punp
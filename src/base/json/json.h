@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace punp {
+    namespace json {
+
+        /// Minimal JSON value for the LSP transport and job manifests.
+        ///
+        /// Objects keep their members in insertion order and are searched linearly,
+        /// which is fine for the small messages this is used for. Numbers are doubles.
+
+        class Value;
+        using Array = std::vector<Value>;
+        using Object = std::vector<std::pair<std::string, Value>>;
+
+        class Value {
+        public:
+            Value() = default;
+            Value(std::nullptr_t) {}
+            Value(bool b) : _data(b) {}
+            Value(double n) : _data(n) {}
+            Value(int n) : _data(static_cast<double>(n)) {}
+            Value(int64_t n) : _data(static_cast<double>(n)) {}
+            Value(size_t n) : _data(static_cast<double>(n)) {}
+            Value(std::string s) : _data(std::move(s)) {}
+            Value(const char *s) : _data(std::string(s)) {}
+            Value(Array a) : _data(std::move(a)) {}
+            Value(Object o) : _data(std::move(o)) {}
+
+            bool is_null() const noexcept { return std::holds_alternative<std::nullptr_t>(_data); }
+            bool is_bool() const noexcept { return std::holds_alternative<bool>(_data); }
+            bool is_number() const noexcept { return std::holds_alternative<double>(_data); }
+            bool is_string() const noexcept { return std::holds_alternative<std::string>(_data); }
+            bool is_array() const noexcept { return std::holds_alternative<Array>(_data); }
+            bool is_object() const noexcept { return std::holds_alternative<Object>(_data); }
+
+            // Typed access, a value of another type yields `fallback` or an empty container
+            bool as_bool(bool fallback = false) const noexcept;
+            double as_number(double fallback = 0) const noexcept;
+            int64_t as_int(int64_t fallback = 0) const noexcept;
+            const std::string &as_string() const noexcept;
+            const Array &as_array() const noexcept;
+            const Object &as_object() const noexcept;
+
+            // Member lookup, a null value if absent or not an object
+            const Value &operator[](std::string_view key) const noexcept;
+            bool contains(std::string_view key) const noexcept;
+            // Add or replace a member, turning a null value into an object
+            Value &set(std::string key, Value value);
+            // Append to an array, turning a null value into an array
+            Value &push(Value value);
+
+            std::string dump() const;
+            void dump(std::string &out) const;
+
+            // Parse a complete document, `err` describes the first error
+            static std::optional<Value> parse(std::string_view text, std::string &err);
+
+        private:
+            std::variant<std::nullptr_t, bool, double, std::string, Array, Object> _data;
+        };
+
+    } // namespace json
+} // namespace punp
@@ -0,0 +1,475 @@
+#include "base/logging/logging.h"
+
+#include "base/color_print.h"
+#include "base/common.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define PUNP_WRITE _write
+#else
+#include <unistd.h>
+#define PUNP_WRITE ::write
+#endif
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace punp {
+    namespace logging {
+
+        namespace {
+            constexpr size_t RING_MASK = LogConfig::RING_SIZE - 1;
+            static_assert((LogConfig::RING_SIZE & RING_MASK) == 0, "RING_SIZE must be a power of two");
+
+            // Batches larger than this are written out before appending more
+            constexpr size_t MAX_BATCH = 64 * 1024;
+
+            struct RecordHeader {
+                uint64_t seq;   // Global order of the record
+                uint32_t len;   // Payload bytes following the header
+                uint32_t stream;
+            };
+
+            /// Single-producer single-consumer byte ring owned by one thread at a time
+            struct Ring {
+                char data[LogConfig::RING_SIZE];
+                alignas(64) std::atomic<size_t> head{0}; // Advanced by the flusher once written
+                alignas(64) std::atomic<size_t> tail{0}; // Advanced by the owner once a record is complete
+                std::atomic<bool> owned{false};
+
+                void put(size_t pos, const void *src, size_t n) {
+                    size_t off = pos & RING_MASK;
+                    size_t first = std::min(n, LogConfig::RING_SIZE - off);
+                    std::memcpy(data + off, src, first);
+                    std::memcpy(data, static_cast<const char *>(src) + first, n - first);
+                }
+
+                void get(size_t pos, void *dst, size_t n) const {
+                    size_t off = pos & RING_MASK;
+                    size_t first = std::min(n, LogConfig::RING_SIZE - off);
+                    std::memcpy(dst, data + off, first);
+                    std::memcpy(static_cast<char *>(dst) + first, data, n - first);
+                }
+
+                RecordHeader header(size_t pos) const {
+                    RecordHeader h;
+                    get(pos, &h, sizeof(h));
+                    return h;
+                }
+            };
+
+            FILE *file_of(uint32_t stream) {
+                return stream == static_cast<uint32_t>(Stream::ERR) ? stderr : stdout;
+            }
+
+            int64_t now_ms() {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+            }
+
+            class Logger {
+            public:
+                static Logger &instance() {
+                    static Logger logger;
+                    return logger;
+                }
+
+                ~Logger() {
+                    stop();
+                    report_suppressed();
+                    std::fflush(stdout);
+                }
+
+                void start();
+                void stop();
+                void flush();
+                void write(Stream stream, std::string_view text);
+                void write_now(Stream stream, std::string_view text);
+                bool allow_warning(std::string_view site, std::string_view text);
+
+                // Async-signal context: write whatever is still buffered, no locks taken
+                void emergency_drain();
+
+            private:
+                struct WarnState {
+                    int64_t window_start = 0;
+                    size_t emitted = 0;
+                    size_t suppressed = 0;
+                    std::string sample; // First warning of the window
+                };
+
+                std::array<std::atomic<Ring *>, LogConfig::MAX_RINGS> _rings{};
+                std::atomic<size_t> _n_rings{0};
+                std::mutex _rings_mtx; // Serializes ring registration
+
+                std::atomic<bool> _active{false};
+                std::atomic<size_t> _inflight{0}; // Producers currently on the async path
+                std::atomic<uint64_t> _next_seq{0};
+                std::atomic<uint64_t> _written_seq{0};
+
+                std::mutex _out_mtx; // Held while writing to stdout/stderr
+                std::string _batch;
+                uint32_t _batch_stream = 0;
+
+                std::thread _flusher;
+                std::mutex _wake_mtx;
+                std::condition_variable _wake_cv;
+                std::condition_variable _flushed_cv;
+                bool _wake = false;
+                bool _stopping = false;
+
+                std::mutex _warn_mtx;
+                std::unordered_map<std::string, WarnState> _warn_states;
+
+                Ring *local_ring();
+                void wake();
+                void run();
+                void drain();
+                void write_batch();
+                void sync_write(Stream stream, std::string_view text);
+                void report_suppressed();
+            };
+
+            // Releases the calling thread's ring for reuse when the thread exits
+            struct RingHandle {
+                Ring *ring = nullptr;
+                ~RingHandle() {
+                    if (ring) {
+                        ring->owned.store(false, std::memory_order_release);
+                    }
+                }
+            };
+
+            void on_fatal_signal(int sig) {
+                Logger::instance().emergency_drain();
+                std::signal(sig, SIG_DFL);
+                std::raise(sig);
+            }
+
+            constexpr int FATAL_SIGNALS[] = {
+                SIGSEGV, SIGABRT, SIGFPE, SIGILL,
+#ifdef SIGBUS
+                SIGBUS,
+#endif
+            };
+
+            Ring *Logger::local_ring() {
+                thread_local RingHandle handle;
+                if (handle.ring) {
+                    return handle.ring;
+                }
+
+                // Reuse a drained ring left behind by an exited thread
+                size_t n = _n_rings.load(std::memory_order_acquire);
+                for (size_t i = 0; i < n; ++i) {
+                    Ring *ring = _rings[i].load(std::memory_order_acquire);
+                    bool expected = false;
+                    if (ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_acquire) &&
+                        ring->owned.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                        handle.ring = ring;
+                        return ring;
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(_rings_mtx);
+                n = _n_rings.load(std::memory_order_relaxed);
+                if (n == LogConfig::MAX_RINGS) {
+                    return nullptr;
+                }
+                Ring *ring = new Ring;
+                ring->owned.store(true, std::memory_order_relaxed);
+                _rings[n].store(ring, std::memory_order_release);
+                _n_rings.store(n + 1, std::memory_order_release);
+                handle.ring = ring;
+                return ring;
+            }
+
+            void Logger::start() {
+                std::lock_guard<std::mutex> lock(_out_mtx);
+                if (_active.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                _written_seq.store(_next_seq.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                _stopping = false;
+                _flusher = std::thread(&Logger::run, this);
+                for (int sig : FATAL_SIGNALS) {
+                    std::signal(sig, on_fatal_signal);
+                }
+                _active.store(true, std::memory_order_release);
+            }
+
+            void Logger::stop() {
+                if (!_active.exchange(false, std::memory_order_acq_rel)) {
+                    return;
+                }
+                // Records being appended right now still go to the rings
+                while (_inflight.load(std::memory_order_acquire) != 0) {
+                    std::this_thread::yield();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(_wake_mtx);
+                    _stopping = true;
+                }
+                _wake_cv.notify_one();
+                _flusher.join();
+                for (int sig : FATAL_SIGNALS) {
+                    std::signal(sig, SIG_DFL);
+                }
+                report_suppressed();
+            }
+
+            void Logger::flush() {
+                if (!_active.load(std::memory_order_acquire)) {
+                    std::lock_guard<std::mutex> lock(_out_mtx);
+                    std::fflush(stdout);
+                    return;
+                }
+                const uint64_t target = _next_seq.load(std::memory_order_acquire);
+                std::unique_lock<std::mutex> lock(_wake_mtx);
+                _wake = true;
+                _wake_cv.notify_one();
+                _flushed_cv.wait(lock, [&]() {
+                    return _stopping || _written_seq.load(std::memory_order_acquire) >= target;
+                });
+            }
+
+            void Logger::write(Stream stream, std::string_view text) {
+                if (!_active.load(std::memory_order_acquire)) {
+                    sync_write(stream, text);
+                    return;
+                }
+                _inflight.fetch_add(1, std::memory_order_acq_rel);
+                Ring *ring = _active.load(std::memory_order_acquire) ? local_ring() : nullptr;
+                const size_t need = sizeof(RecordHeader) + text.size();
+                if (ring == nullptr || need > LogConfig::RING_SIZE) {
+                    // Stopping, out of rings or too long for a ring: keep the order and write directly
+                    _inflight.fetch_sub(1, std::memory_order_acq_rel);
+                    flush();
+                    sync_write(stream, text);
+                    return;
+                }
+
+                // Only this thread appends to the ring, so the free space can only grow while waiting
+                const size_t tail = ring->tail.load(std::memory_order_relaxed);
+                while (LogConfig::RING_SIZE - (tail - ring->head.load(std::memory_order_acquire)) < need) {
+                    wake();
+                    std::this_thread::yield();
+                }
+
+                RecordHeader header{_next_seq.fetch_add(1, std::memory_order_acq_rel),
+                                    static_cast<uint32_t>(text.size()), static_cast<uint32_t>(stream)};
+                ring->put(tail, &header, sizeof(header));
+                ring->put(tail + sizeof(header), text.data(), text.size());
+                ring->tail.store(tail + need, std::memory_order_release);
+
+                if (tail + need - ring->head.load(std::memory_order_relaxed) > LogConfig::RING_SIZE / 2) {
+                    wake();
+                }
+                _inflight.fetch_sub(1, std::memory_order_acq_rel);
+            }
+
+            void Logger::write_now(Stream stream, std::string_view text) {
+                flush();
+                sync_write(stream, text);
+            }
+
+            void Logger::wake() {
+                {
+                    std::lock_guard<std::mutex> lock(_wake_mtx);
+                    _wake = true;
+                }
+                _wake_cv.notify_one();
+            }
+
+            void Logger::run() {
+                while (true) {
+                    bool stopping;
+                    {
+                        std::unique_lock<std::mutex> lock(_wake_mtx);
+                        _wake_cv.wait_for(lock, std::chrono::milliseconds(LogConfig::FLUSH_INTERVAL_MS),
+                                          [&]() { return _wake || _stopping; });
+                        _wake = false;
+                        stopping = _stopping;
+                    }
+
+                    drain();
+                    {
+                        std::lock_guard<std::mutex> lock(_wake_mtx);
+                        _flushed_cv.notify_all();
+                    }
+                    if (stopping) {
+                        break;
+                    }
+                }
+            }
+
+            /// Merge the rings by sequence number and write the records in batches
+            ///
+            /// A sequence number is taken right before its record is copied in, so a gap
+            /// (a record still being copied) closes almost immediately; the pass stops at
+            /// the gap and the next pass continues from there. Ring heads only move after
+            /// the bytes were written, so a crash never loses a record taken out of a ring.
+            void Logger::drain() {
+                std::lock_guard<std::mutex> lock(_out_mtx);
+                const size_t n = _n_rings.load(std::memory_order_acquire);
+
+                std::array<size_t, LogConfig::MAX_RINGS> cursor;
+                std::array<size_t, LogConfig::MAX_RINGS> end;
+                std::array<uint64_t, LogConfig::MAX_RINGS> next_seq;
+                for (size_t i = 0; i < n; ++i) {
+                    Ring *ring = _rings[i].load(std::memory_order_acquire);
+                    cursor[i] = ring->head.load(std::memory_order_relaxed);
+                    end[i] = ring->tail.load(std::memory_order_acquire);
+                    next_seq[i] = cursor[i] < end[i] ? ring->header(cursor[i]).seq : UINT64_MAX;
+                }
+
+                uint64_t seq = _written_seq.load(std::memory_order_relaxed);
+                while (true) {
+                    size_t pick = n;
+                    for (size_t i = 0; i < n; ++i) {
+                        if (next_seq[i] == seq) {
+                            pick = i;
+                            break;
+                        }
+                    }
+                    if (pick == n) {
+                        break;
+                    }
+
+                    Ring *ring = _rings[pick].load(std::memory_order_relaxed);
+                    RecordHeader header = ring->header(cursor[pick]);
+                    if (header.stream != _batch_stream || _batch.size() > MAX_BATCH) {
+                        write_batch();
+                        _batch_stream = header.stream;
+                    }
+                    size_t old_size = _batch.size();
+                    _batch.resize(old_size + header.len);
+                    ring->get(cursor[pick] + sizeof(header), _batch.data() + old_size, header.len);
+
+                    cursor[pick] += sizeof(header) + header.len;
+                    next_seq[pick] = cursor[pick] < end[pick] ? ring->header(cursor[pick]).seq : UINT64_MAX;
+                    ++seq;
+                }
+                write_batch();
+
+                for (size_t i = 0; i < n; ++i) {
+                    _rings[i].load(std::memory_order_relaxed)->head.store(cursor[i], std::memory_order_release);
+                }
+                _written_seq.store(seq, std::memory_order_release);
+            }
+
+            void Logger::write_batch() {
+                if (_batch.empty()) {
+                    return;
+                }
+                FILE *file = file_of(_batch_stream);
+                std::fwrite(_batch.data(), 1, _batch.size(), file);
+                std::fflush(file);
+                _batch.clear();
+            }
+
+            void Logger::sync_write(Stream stream, std::string_view text) {
+                // Flushed like a batch, `flush()` only waits for the rings and would miss a stdio tail
+                std::lock_guard<std::mutex> lock(_out_mtx);
+                FILE *file = file_of(static_cast<uint32_t>(stream));
+                std::fwrite(text.data(), 1, text.size(), file);
+                std::fflush(file);
+            }
+
+            void Logger::emergency_drain() {
+                const size_t n = _n_rings.load(std::memory_order_acquire);
+                for (size_t i = 0; i < n; ++i) {
+                    Ring *ring = _rings[i].load(std::memory_order_acquire);
+                    size_t pos = ring->head.load(std::memory_order_acquire);
+                    const size_t end = ring->tail.load(std::memory_order_acquire);
+                    while (pos < end) {
+                        RecordHeader header = ring->header(pos);
+                        pos += sizeof(header);
+                        int fd = header.stream == static_cast<uint32_t>(Stream::ERR) ? 2 : 1;
+                        size_t off = pos & RING_MASK;
+                        size_t first = std::min<size_t>(header.len, LogConfig::RING_SIZE - off);
+                        [[maybe_unused]] auto r1 = PUNP_WRITE(fd, ring->data + off, first);
+                        [[maybe_unused]] auto r2 = PUNP_WRITE(fd, ring->data, header.len - first);
+                        pos += header.len;
+                    }
+                    ring->head.store(end, std::memory_order_release);
+                }
+            }
+
+            bool Logger::allow_warning(std::string_view site, std::string_view text) {
+                const int64_t now = now_ms();
+                size_t suppressed = 0;
+                std::string sample;
+                bool allowed;
+                {
+                    std::lock_guard<std::mutex> lock(_warn_mtx);
+                    WarnState &state = _warn_states[std::string(site)];
+                    if (now - state.window_start >= LogConfig::WARN_WINDOW_MS) {
+                        suppressed = state.suppressed;
+                        sample = std::move(state.sample);
+                        state = WarnState{now, 0, 0, std::string(text)};
+                    }
+                    allowed = state.emitted < LogConfig::WARN_BURST;
+                    allowed ? ++state.emitted : ++state.suppressed;
+                }
+                if (suppressed > 0) {
+                    colored_println_err(Colors::YELLOW, "Warn: ", suppressed, " more warnings like \"", sample, "\" suppressed");
+                }
+                return allowed;
+            }
+
+            void Logger::report_suppressed() {
+                std::vector<std::pair<std::string, size_t>> pending;
+                {
+                    std::lock_guard<std::mutex> lock(_warn_mtx);
+                    for (auto &[key, state] : _warn_states) {
+                        if (state.suppressed > 0) {
+                            pending.emplace_back(state.sample, state.suppressed);
+                            state.suppressed = 0;
+                        }
+                    }
+                }
+                for (const auto &[sample, count] : pending) {
+                    colored_println_err(Colors::YELLOW, "Warn: ", count, " more warnings like \"", sample, "\" suppressed");
+                }
+            }
+        } // namespace
+
+        void start() {
+            Logger::instance().start();
+        }
+
+        void stop() {
+            Logger::instance().stop();
+        }
+
+        void flush() {
+            Logger::instance().flush();
+        }
+
+        void write(Stream stream, std::string_view text) {
+            Logger::instance().write(stream, text);
+        }
+
+        void write_now(Stream stream, std::string_view text) {
+            Logger::instance().write_now(stream, text);
+        }
+
+        bool allow_warning(std::string_view site, std::string_view text) {
+            return Logger::instance().allow_warning(site, text);
+        }
+
+    } // namespace logging
+} // namespace punp
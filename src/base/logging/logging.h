@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string_view>
+
+namespace punp {
+    namespace logging {
+
+        enum class Stream : unsigned char {
+            OUT,
+            ERR,
+        };
+
+        /// Output sink behind the `color_print.h` helpers.
+        ///
+        /// Synchronous by default. Between `start()` and `stop()` every thread appends
+        /// finished lines to its own ring buffer and a single flusher thread writes them
+        /// out in batches, in the global order they were logged. A thread whose ring is
+        /// full waits for the flusher. `stop()`, process exit and fatal signals drain what
+        /// is left and fall back to synchronous writes.
+
+        void start();
+        void stop();
+        // Block until everything logged so far has been written
+        void flush();
+
+        void write(Stream stream, std::string_view text);
+        // Write `text` after everything logged so far and flush it before returning,
+        // for output another process waits on, e.g. protocol frames
+        void write_now(Stream stream, std::string_view text);
+
+        // Rate limit for warnings from the same call site `site`, at most
+        // `LogConfig::WARN_BURST` per `LogConfig::WARN_WINDOW_MS`, the rest are counted
+        // and summarized, quoting the first `text` of the window, once the window ends
+        // or output stops
+        bool allow_warning(std::string_view site, std::string_view text);
+
+        // RAII helper for `start()`/`stop()`
+        class AsyncScope {
+        public:
+            AsyncScope() { start(); }
+            ~AsyncScope() { stop(); }
+            AsyncScope(const AsyncScope &) = delete;
+            AsyncScope &operator=(const AsyncScope &) = delete;
+        };
+
+    } // namespace logging
+} // namespace punp
@@ -0,0 +1,53 @@
+#include "base/telemetry/telemetry.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace punp {
+    namespace telemetry {
+
+        namespace {
+            // Written by its thread only, read by `snapshot()` from any thread
+            struct Block {
+                std::array<std::atomic<uint64_t>, COUNTER_COUNT> values{};
+            };
+
+            std::mutex blocks_mtx;
+            std::vector<std::unique_ptr<Block>> blocks; // Kept after their threads exit
+
+            Block &local_block() {
+                thread_local Block *block = []() {
+                    std::lock_guard<std::mutex> lock(blocks_mtx);
+                    blocks.push_back(std::make_unique<Block>());
+                    return blocks.back().get();
+                }();
+                return *block;
+            }
+        } // namespace
+
+        void add(const Snapshot &values) {
+            Block &block = local_block();
+            for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+                if (values[i]) {
+                    // Single writer, no read-modify-write needed
+                    block.values[i].store(block.values[i].load(std::memory_order_relaxed) + values[i],
+                                          std::memory_order_relaxed);
+                }
+            }
+        }
+
+        Snapshot snapshot() {
+            Snapshot total{};
+            std::lock_guard<std::mutex> lock(blocks_mtx);
+            for (const auto &block : blocks) {
+                for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+                    total[i] += block->values[i].load(std::memory_order_relaxed);
+                }
+            }
+            return total;
+        }
+
+    } // namespace telemetry
+} // namespace punp
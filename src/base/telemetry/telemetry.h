@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace punp {
+    namespace telemetry {
+
+        /// Matching engine counters, compiled in with `-DPUNP_TELEMETRY=ON`.
+        ///
+        /// Hot loops count into a `Tally` on their stack, which adds its totals to the
+        /// calling thread's block once it goes out of scope; `snapshot()` sums the blocks
+        /// of all threads. Without `PUNP_TELEMETRY` a `Tally` is empty and every call on
+        /// it compiles to nothing.
+#ifdef PUNP_TELEMETRY
+        inline constexpr bool ENABLED = true;
+#else
+        inline constexpr bool ENABLED = false;
+#endif
+
+        enum class Counter : unsigned char {
+            SCANS,            // Calls of the matcher
+            CHARS_SCANNED,    // Chars the matcher moved past, skipped ones included
+            CHARS_SKIPPED,    // Chars jumped over by the prefilter
+            TRANSITIONS,      // Automaton steps
+            FAILED_PARTIALS,  // Steps that fell back to a shallower state
+            MATCHES,          // Replacements made, or counted
+            CHARS_REPLACED,   // Input chars covered by matches
+            CHARS_EMITTED,    // Replacement chars written
+            CHARS_COPIED,     // Input chars copied unchanged into rewritten text
+            PROTECTED_SCANS,  // Protected interval searches
+            PROTECTED_CHARS,  // Chars searched for protected regions
+            PROTECTED_FOUND,  // Protected intervals found
+            PROTECTED_COVERED // Chars inside protected intervals
+        };
+        inline constexpr size_t COUNTER_COUNT = static_cast<size_t>(Counter::PROTECTED_COVERED) + 1;
+
+        using Snapshot = std::array<uint64_t, COUNTER_COUNT>;
+
+        // Add `values` to the calling thread's block
+        void add(const Snapshot &values);
+        // Sum over all threads, those that exited included
+        Snapshot snapshot();
+
+        class Tally {
+        public:
+            Tally() = default;
+            ~Tally() {
+#ifdef PUNP_TELEMETRY
+                telemetry::add(_values);
+#endif
+            }
+            Tally(const Tally &) = delete;
+            Tally &operator=(const Tally &) = delete;
+
+            void add(Counter counter, uint64_t n = 1) {
+#ifdef PUNP_TELEMETRY
+                _values[static_cast<size_t>(counter)] += n;
+#else
+                (void)counter;
+                (void)n;
+#endif
+            }
+
+        private:
+#ifdef PUNP_TELEMETRY
+            Snapshot _values{};
+#endif
+        };
+
+        inline uint64_t get(const Snapshot &values, Counter counter) {
+            return values[static_cast<size_t>(counter)];
+        }
+
+    } // namespace telemetry
+} // namespace punp
@@ -1,6 +1,7 @@
 #include "base/thread_pool/thread_pool.h"
 
 #include <algorithm>
+#include <stdexcept>
 
 namespace punp {
 
@@ -31,6 +32,18 @@ namespace punp {
         }
     }
 
+    void ThreadPool::post(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(_queue_mtx);
+            if (_stop) {
+                throw std::runtime_error("Cannot submit task to stopped thread pool");
+            }
+            _tasks.emplace(std::move(job));
+        }
+
+        _condition.notify_one();
+    }
+
     void ThreadPool::shutdown() {
         {
             std::lock_guard<std::mutex> lock(_queue_mtx);
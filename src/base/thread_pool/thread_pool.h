@@ -2,6 +2,7 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <coroutine>
 #include <cstddef>
 #include <functional>
 #include <future>
@@ -37,6 +38,20 @@ namespace punp {
         template <typename F, typename Callback, typename... Args>
         void submit_with_callback(F &&f, Callback &&cb, Args &&...args);
 
+        // Enqueue a fire-and-forget job
+        void post(std::function<void()> job);
+
+        // `co_await pool.schedule()` continues the coroutine on a worker thread
+        auto schedule() noexcept {
+            struct Awaiter {
+                ThreadPool &pool;
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<> h) { pool.post([h]() { h.resume(); }); }
+                void await_resume() const noexcept {}
+            };
+            return Awaiter{*this};
+        }
+
         size_t thread_cnt() const noexcept { return _workers.size(); }
 
         size_t idle_threads() const noexcept { return _workers.size() - _active_threads.load(); }
@@ -1,8 +1,7 @@
 #pragma once
 
-#include <atomic>
-#include <codecvt>
-#include <locale>
+#include <array>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <string_view>
@@ -12,8 +11,6 @@
 namespace punp {
 
     using text_t = std::wstring;
-    using char_convert_t = std::codecvt_utf8<wchar_t>;
-    using convert_t = std::wstring_convert<char_convert_t>;
     using view_t = std::wstring_view;
 
     // Type definitions
@@ -24,6 +21,16 @@ namespace punp {
     using ProtectedRegion = std::pair<text_t, text_t>;
     using ProtectedRegions = std::vector<ProtectedRegion>;
 
+    // REPLACE_RANGE: each char `c` in [from_start, from_end] becomes `to_start + (c - from_start)`
+    struct RangeRule {
+        wchar_t from_start;
+        wchar_t from_end;
+        wchar_t to_start;
+
+        bool operator==(const RangeRule &) const = default;
+    };
+    using RangeRules = std::vector<RangeRule>; // Kept disjoint, later rules override earlier ones
+
     // Protected region interval in text
     struct ProtectedInterval {
         size_t start_first;      // Position of the first char of start marker
@@ -51,14 +58,31 @@ namespace punp {
         bool recursive = false;
         bool process_hidden = false;
         bool enable_latex_jumping = false;
+        bool traversal_cache = false;           // Reuse directory listings whose mtime is unchanged
         std::vector<std::string> patterns;      // File patterns to search
         std::vector<std::string> extensions;    // File extensions to filter
         std::vector<std::string> exclude_paths; // Files/dirs to exclude
     };
 
+    // Raw file bytes already read during discovery, keyed by normalized absolute path
+    using FileCache = std::unordered_map<std::string, std::string>;
+
     struct FileProcessorConfig {
         std::vector<std::string> file_paths;
-        size_t max_threads = 0; // 0 means auto-detect
+        std::shared_ptr<FileCache> file_cache; // Consumed (moved out) by the processor, may be null
+        size_t max_threads = 0;      // 0 means auto-detect
+        size_t auto_threads = 0;     // Upper bound of the auto-detected thread count, 0 means default
+        size_t io_threads = 0;       // Size of the I/O pool, 0 means auto
+        size_t page_size = 0;        // Chars per page, 0 means default
+        uint64_t memory_budget = 0;  // Bytes the files in flight may take together, 0 means from the usable memory
+        size_t stream_threshold = 0; // Files larger than this (bytes) are streamed, 0 means default
+        bool minimize_automaton = false; // Merge equivalent automaton states, trading match speed for memory
+        bool count_only = false;         // Count replacements without writing any file
+        size_t slow_file_ms = 0;         // Files running longer than this are reported, 0 means default
+        bool show_progress = false;      // Progress line on stdout, only if it is a terminal
+        std::string output_dir;          // Mirror results under this directory, empty means in place
+        std::string output_base;         // Inputs are mirrored relative to this directory, empty means the current one
+        bool mirror_unchanged = true;    // Link files without replacements into the mirror as well
     };
 
     struct ProcessingConfig {
@@ -74,25 +98,40 @@ namespace punp {
         NIGHTLY,
     };
 
+    // Stages of processing a file, timed separately
+    enum class FileStage : unsigned char {
+        LOAD,   // Read from disk, or taken from the discovery cache
+        DECODE, // Validate, decode, find protected regions and split into pages
+        MATCH,  // Replace on every page
+        WRITE,  // Encode and write back
+    };
+    constexpr size_t FILE_STAGE_COUNT = 4;
+
+    constexpr const char *stage_name(FileStage stage) noexcept {
+        constexpr const char *NAMES[FILE_STAGE_COUNT] = {"load", "decode", "match", "write"};
+        return NAMES[static_cast<size_t>(stage)];
+    }
+
     // File processing result
     struct ProcessingResult {
         std::string file_path;
-        bool ok;
+        bool ok = false;
         std::string err_msg;
         size_t n_rep = 0;
+        size_t bytes = 0;                                // Size of the input file
+        uint64_t total_us = 0;                           // Wall time from start to finish
+        std::array<uint64_t, FILE_STAGE_COUNT> stage_us{}; // Wall time per `FileStage`
     };
 
     // File content structure
     struct FileContent {
         std::string filename;
         text_t content;
-        std::atomic<int> ref_cnt{0};
         std::vector<text_t> processed_pages;
-        std::atomic<size_t> total_replacements{0};
         ProtectedIntervals protected_interval;
 
-        FileContent(const std::string &name, const text_t &data)
-            : filename(name), content(data) {}
+        FileContent(const std::string &name, text_t data)
+            : filename(name), content(std::move(data)) {}
     };
 
     // Page data structure
@@ -108,23 +147,13 @@ namespace punp {
             : f_ptr(file_ptr), pid(page_id), start_pos(start), end_pos(end) {}
     };
 
-    // Page processing result
+    // Page processing result, the processed text goes to `FileContent::processed_pages`
     struct PageResult {
         std::string file_path;
-        size_t page_id;
-        text_t processed_content;
+        size_t page_id = 0;
         size_t n_rep = 0;
         bool ok = true;
         std::string err_msg;
     };
 
-    // Writeback notification
-    struct WritebackNotification {
-        std::shared_ptr<FileContent> file_content;
-        size_t total_replacements;
-
-        WritebackNotification(std::shared_ptr<FileContent> fc, size_t reps)
-            : file_content(fc), total_replacements(reps) {}
-    };
-
 } // namespace punp
\ No newline at end of file
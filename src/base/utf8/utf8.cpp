@@ -0,0 +1,435 @@
+#include "base/utf8/utf8.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#define PUNP_UTF8_SIMD 1
+#endif
+
+namespace punp {
+    namespace utf8 {
+
+        namespace {
+            // Offset of the first malformed sequence, `n` if `p[0, n)` is valid
+            size_t first_invalid_scalar(const unsigned char *p, size_t n) {
+                size_t i = 0;
+                while (i < n) {
+                    const unsigned char c = p[i];
+                    if (c < 0x80) {
+                        ++i;
+                        continue;
+                    }
+
+                    size_t len = 0;
+                    unsigned char lo = 0x80, hi = 0xBF; // Valid range of the second byte
+                    if (c >= 0xC2 && c <= 0xDF) {
+                        len = 2;
+                    } else if (c >= 0xE0 && c <= 0xEF) {
+                        len = 3;
+                        if (c == 0xE0) {
+                            lo = 0xA0; // Overlong
+                        }
+                    } else if (c >= 0xF0 && c <= 0xF4) {
+                        len = 4;
+                        if (c == 0xF0) {
+                            lo = 0x90; // Overlong
+                        } else if (c == 0xF4) {
+                            hi = 0x8F; // Above U+10FFFF
+                        }
+                    } else {
+                        return i;
+                    }
+
+                    if (n - i < len || p[i + 1] < lo || p[i + 1] > hi) {
+                        return i;
+                    }
+                    for (size_t k = 2; k < len; ++k) {
+                        if ((p[i + k] & 0xC0) != 0x80) {
+                            return i;
+                        }
+                    }
+                    i += len;
+                }
+                return n;
+            }
+
+#ifdef PUNP_UTF8_SIMD
+            // NOTE: vectorized validation after Keiser & Lemire, "Validating UTF-8 In Less
+            // Than One Instruction Per Byte". Three nibble lookups classify every pair of
+            // adjacent bytes, a fourth check covers the continuations of 3/4-byte leads.
+            // The surrogate check is left out, `codecvt_utf8` decodes encoded surrogates.
+            constexpr uint8_t TOO_SHORT = 1 << 0;  // Lead followed by a non-continuation
+            constexpr uint8_t TOO_LONG = 1 << 1;   // ASCII followed by a continuation
+            constexpr uint8_t OVERLONG_3 = 1 << 2; // 11100000 100_____
+            constexpr uint8_t TOO_LARGE = 1 << 3;  // Above U+10FFFF
+            constexpr uint8_t OVERLONG_2 = 1 << 5; // 1100000_ 10______
+            constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+            constexpr uint8_t OVERLONG_4 = 1 << 6; // 11110000 1000____
+            constexpr uint8_t TWO_CONTS = 1 << 7;  // Continuation after continuation
+            constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+            constexpr uint8_t BYTE_1_HIGH[16] = {
+                TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+                TOO_SHORT | OVERLONG_2,
+                TOO_SHORT,
+                TOO_SHORT | OVERLONG_3,
+                TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4};
+            constexpr uint8_t BYTE_1_LOW[16] = {
+                CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                CARRY | OVERLONG_2,
+                CARRY,
+                CARRY,
+                CARRY | TOO_LARGE,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000};
+            constexpr uint8_t BYTE_2_HIGH[16] = {
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | TOO_LARGE,
+                TOO_LONG | OVERLONG_2 | TWO_CONTS | TOO_LARGE,
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT};
+
+#if defined(__AVX2__)
+            constexpr size_t BLOCK = 32;
+            using vec_t = __m256i;
+
+            inline vec_t load(const unsigned char *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+            inline vec_t splat(uint8_t v) { return _mm256_set1_epi8(static_cast<char>(v)); }
+            inline vec_t v_or(vec_t a, vec_t b) { return _mm256_or_si256(a, b); }
+            inline vec_t v_and(vec_t a, vec_t b) { return _mm256_and_si256(a, b); }
+            inline vec_t v_xor(vec_t a, vec_t b) { return _mm256_xor_si256(a, b); }
+            inline vec_t subs(vec_t a, vec_t b) { return _mm256_subs_epu8(a, b); }
+            inline vec_t high_nibble(vec_t a) { return _mm256_and_si256(_mm256_srli_epi16(a, 4), splat(0x0F)); }
+            inline vec_t lookup(const uint8_t *table, vec_t idx) {
+                vec_t t = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(table)));
+                return _mm256_shuffle_epi8(t, idx);
+            }
+            // `input` shifted right by N bytes, the gap filled with the end of `prev`
+            template <int N>
+            inline vec_t prev(vec_t input, vec_t prev) {
+                return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+            }
+            inline vec_t eq_zero(vec_t a) { return _mm256_cmpeq_epi8(a, _mm256_setzero_si256()); }
+            inline bool any_high_bit(vec_t a) { return _mm256_movemask_epi8(a) != 0; }
+            inline bool any_set(vec_t a) { return !_mm256_testz_si256(a, a); }
+            inline vec_t incomplete_limits() {
+                return _mm256_setr_epi8(
+                    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                    static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+            }
+#else
+            constexpr size_t BLOCK = 16;
+            using vec_t = __m128i;
+
+            inline vec_t load(const unsigned char *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+            inline vec_t splat(uint8_t v) { return _mm_set1_epi8(static_cast<char>(v)); }
+            inline vec_t v_or(vec_t a, vec_t b) { return _mm_or_si128(a, b); }
+            inline vec_t v_and(vec_t a, vec_t b) { return _mm_and_si128(a, b); }
+            inline vec_t v_xor(vec_t a, vec_t b) { return _mm_xor_si128(a, b); }
+            inline vec_t subs(vec_t a, vec_t b) { return _mm_subs_epu8(a, b); }
+            inline vec_t high_nibble(vec_t a) { return _mm_and_si128(_mm_srli_epi16(a, 4), splat(0x0F)); }
+            inline vec_t lookup(const uint8_t *table, vec_t idx) {
+                return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(table)), idx);
+            }
+            template <int N>
+            inline vec_t prev(vec_t input, vec_t prev) { return _mm_alignr_epi8(input, prev, 16 - N); }
+            inline vec_t eq_zero(vec_t a) { return _mm_cmpeq_epi8(a, _mm_setzero_si128()); }
+            inline bool any_high_bit(vec_t a) { return _mm_movemask_epi8(a) != 0; }
+            inline bool any_set(vec_t a) { return !_mm_testz_si128(a, a); }
+            inline vec_t incomplete_limits() {
+                return _mm_setr_epi8(
+                    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                    static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+            }
+#endif
+
+            inline vec_t check_block(vec_t input, vec_t prev_input) {
+                vec_t prev1 = prev<1>(input, prev_input);
+                vec_t special = v_and(v_and(lookup(BYTE_1_HIGH, high_nibble(prev1)),
+                                            lookup(BYTE_1_LOW, v_and(prev1, splat(0x0F)))),
+                                      lookup(BYTE_2_HIGH, high_nibble(input)));
+
+                // The 2nd continuation of a 3-byte lead and the 3rd of a 4-byte lead,
+                // the only positions where TWO_CONTS is expected
+                vec_t is_third = subs(prev<2>(input, prev_input), splat(0xE0 - 0x80));
+                vec_t is_fourth = subs(prev<3>(input, prev_input), splat(0xF0 - 0x80));
+                vec_t must23 = v_and(v_or(is_third, is_fourth), splat(0x80));
+                return v_xor(must23, special);
+            }
+
+            // Validates `p[0, n)`; `ascii` tells whether every byte was below 0x80,
+            // `nul` whether any was zero
+            bool simd_valid(const unsigned char *p, size_t n, bool &ascii, bool &nul) {
+                vec_t error = splat(0);
+                vec_t zeros = splat(0);
+                vec_t prev_input = splat(0);
+                vec_t prev_incomplete = splat(0);
+                const vec_t limits = incomplete_limits();
+                bool seen_non_ascii = false;
+
+                auto step = [&](vec_t input) {
+                    zeros = v_or(zeros, eq_zero(input));
+                    if (!any_high_bit(input)) {
+                        // ASCII block, only a sequence cut off by the previous block can fail
+                        error = v_or(error, prev_incomplete);
+                        prev_incomplete = splat(0);
+                    } else {
+                        seen_non_ascii = true;
+                        error = v_or(error, check_block(input, prev_input));
+                        prev_incomplete = subs(input, limits);
+                    }
+                    prev_input = input;
+                };
+
+                size_t i = 0;
+                for (; i + BLOCK <= n; i += BLOCK) {
+                    step(load(p + i));
+                }
+                if (i < n) {
+                    // Padding is ASCII (and not NUL), so a truncated trailing sequence is caught
+                    alignas(BLOCK) unsigned char tail[BLOCK];
+                    std::memset(tail, ' ', BLOCK);
+                    std::memcpy(tail, p + i, n - i);
+                    step(load(tail));
+                }
+                error = v_or(error, prev_incomplete);
+
+                ascii = !seen_non_ascii;
+                nul = any_set(zeros);
+                return !any_set(error);
+            }
+
+            static_assert(sizeof(wchar_t) == 4, "UTF-32 transcoding expects 32-bit wchar_t");
+
+            // Widen one block of ASCII bytes into `BLOCK` wide chars
+            inline void widen_block(vec_t bytes, wchar_t *dst) {
+#if defined(__AVX2__)
+                __m128i lo = _mm256_castsi256_si128(bytes);
+                __m128i hi = _mm256_extracti128_si256(bytes, 1);
+                auto *out = reinterpret_cast<__m256i *>(dst);
+                _mm256_storeu_si256(out + 0, _mm256_cvtepu8_epi32(lo));
+                _mm256_storeu_si256(out + 1, _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+                _mm256_storeu_si256(out + 2, _mm256_cvtepu8_epi32(hi));
+                _mm256_storeu_si256(out + 3, _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+#else
+                auto *out = reinterpret_cast<__m128i *>(dst);
+                _mm_storeu_si128(out + 0, _mm_cvtepu8_epi32(bytes));
+                _mm_storeu_si128(out + 1, _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4)));
+                _mm_storeu_si128(out + 2, _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+                _mm_storeu_si128(out + 3, _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 12)));
+#endif
+            }
+
+            // Narrow 16 wide chars to bytes if all of them are ASCII
+            inline bool narrow_16(const wchar_t *src, char *dst) {
+#if defined(__AVX2__)
+                const auto *in = reinterpret_cast<const __m256i *>(src);
+                __m256i a = _mm256_loadu_si256(in + 0);
+                __m256i b = _mm256_loadu_si256(in + 1);
+                if (!_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_set1_epi32(~0x7F))) {
+                    return false;
+                }
+                // Packs work per 128-bit lane, restore the order before the final pack
+                __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8);
+                __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+#else
+                const auto *in = reinterpret_cast<const __m128i *>(src);
+                __m128i a = _mm_loadu_si128(in + 0);
+                __m128i b = _mm_loadu_si128(in + 1);
+                __m128i c = _mm_loadu_si128(in + 2);
+                __m128i d = _mm_loadu_si128(in + 3);
+                __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+                if (!_mm_testz_si128(any, _mm_set1_epi32(~0x7F))) {
+                    return false;
+                }
+                __m128i bytes = _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d));
+#endif
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), bytes);
+                return true;
+            }
+#endif
+
+            // Decode one sequence at `p`, input is known to be valid
+            inline const unsigned char *decode_one(const unsigned char *p, wchar_t *&dst) {
+                const uint32_t c = p[0];
+                if (c < 0x80) {
+                    *dst++ = static_cast<wchar_t>(c);
+                    return p + 1;
+                }
+                if (c < 0xE0) {
+                    *dst++ = static_cast<wchar_t>(((c & 0x1F) << 6) | (p[1] & 0x3F));
+                    return p + 2;
+                }
+                if (c < 0xF0) {
+                    *dst++ = static_cast<wchar_t>(((c & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F));
+                    return p + 3;
+                }
+                *dst++ = static_cast<wchar_t>(((c & 0x07) << 18) | ((p[1] & 0x3F) << 12) |
+                                              ((p[2] & 0x3F) << 6) | (p[3] & 0x3F));
+                return p + 4;
+            }
+
+            inline char *encode_one(uint32_t c, char *dst) {
+                if (c < 0x80) {
+                    *dst++ = static_cast<char>(c);
+                } else if (c < 0x800) {
+                    *dst++ = static_cast<char>(0xC0 | (c >> 6));
+                    *dst++ = static_cast<char>(0x80 | (c & 0x3F));
+                } else if (c < 0x10000) {
+                    *dst++ = static_cast<char>(0xE0 | (c >> 12));
+                    *dst++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+                    *dst++ = static_cast<char>(0x80 | (c & 0x3F));
+                } else {
+                    *dst++ = static_cast<char>(0xF0 | (c >> 18));
+                    *dst++ = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+                    *dst++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+                    *dst++ = static_cast<char>(0x80 | (c & 0x3F));
+                }
+                return dst;
+            }
+        } // namespace
+
+        namespace {
+            ScanResult classify(std::string_view data, bool detect_binary) {
+                ScanResult res;
+                const auto *p = reinterpret_cast<const unsigned char *>(data.data());
+                const size_t n = data.size();
+#ifdef PUNP_UTF8_SIMD
+                bool ascii = false;
+                bool nul = false;
+                const bool valid = simd_valid(p, n, ascii, nul);
+                if (detect_binary && nul) {
+                    res.kind = TextKind::BINARY; // Binary files are rarely valid UTF-8 either
+                    return res;
+                }
+                if (valid) {
+                    res.kind = ascii ? TextKind::ASCII : TextKind::UTF8;
+                    return res;
+                }
+                // Malformed input is rare, locate the exact offset with the scalar check
+                res.kind = TextKind::INVALID;
+                res.error_offset = first_invalid_scalar(p, n);
+                return res;
+#else
+                if (detect_binary && n > 0 && std::memchr(p, 0, n) != nullptr) {
+                    res.kind = TextKind::BINARY;
+                    return res;
+                }
+                size_t bad = first_invalid_scalar(p, n);
+                if (bad < n) {
+                    res.kind = TextKind::INVALID;
+                    res.error_offset = bad;
+                    return res;
+                }
+                bool ascii = std::none_of(p, p + n, [](unsigned char c) { return c >= 0x80; });
+                res.kind = ascii ? TextKind::ASCII : TextKind::UTF8;
+                return res;
+#endif
+            }
+        } // namespace
+
+        ScanResult scan(std::string_view data) {
+            return classify(data, true);
+        }
+
+        ScanResult validate(std::string_view data) {
+            return classify(data, false);
+        }
+
+        void decode(std::string_view bytes, text_t &out) {
+            // Never more code points than bytes, shrink once at the end
+            const size_t old_len = out.length();
+            out.resize(old_len + bytes.size());
+            wchar_t *end = decode(bytes, out.data() + old_len);
+            out.resize(static_cast<size_t>(end - out.data()));
+        }
+
+        wchar_t *decode(std::string_view bytes, wchar_t *dst) {
+            const auto *p = reinterpret_cast<const unsigned char *>(bytes.data());
+            const auto *end = p + bytes.size();
+#ifdef PUNP_UTF8_SIMD
+            while (end - p >= static_cast<std::ptrdiff_t>(BLOCK)) {
+                vec_t block = load(p);
+                if (!any_high_bit(block)) {
+                    widen_block(block, dst);
+                    p += BLOCK;
+                    dst += BLOCK;
+                    continue;
+                }
+                // Finish the block scalar, the last sequence may run past it
+                const unsigned char *block_end = p + BLOCK;
+                while (p < block_end) {
+                    p = decode_one(p, dst);
+                }
+            }
+#endif
+            while (p < end) {
+                p = decode_one(p, dst);
+            }
+            return dst;
+        }
+
+        void encode(view_t text, std::string &out) {
+            // Exact output size first
+            const size_t n_bytes = encoded_length(text);
+
+            const size_t old_len = out.length();
+            out.resize(old_len + n_bytes);
+            char *dst = out.data() + old_len;
+
+            const wchar_t *src = text.data();
+            const wchar_t *end = src + text.length();
+#ifdef PUNP_UTF8_SIMD
+            while (end - src >= 16) {
+                if (narrow_16(src, dst)) {
+                    src += 16;
+                    dst += 16;
+                    continue;
+                }
+                for (const wchar_t *block_end = src + 16; src < block_end; ++src) {
+                    dst = encode_one(static_cast<uint32_t>(*src), dst);
+                }
+            }
+#endif
+            for (; src < end; ++src) {
+                dst = encode_one(static_cast<uint32_t>(*src), dst);
+            }
+        }
+
+        size_t length(std::string_view bytes) {
+            // One lead byte per code point, this loop vectorizes well
+            size_t n = 0;
+            for (char b : bytes) {
+                n += (static_cast<unsigned char>(b) & 0xC0) != 0x80;
+            }
+            return n;
+        }
+
+        size_t encoded_length(view_t text) {
+            // This loop vectorizes well
+            size_t n_bytes = 0;
+            for (wchar_t ch : text) {
+                const uint32_t c = static_cast<uint32_t>(ch);
+                n_bytes += 1 + (c >= 0x80) + (c >= 0x800) + (c >= 0x10000);
+            }
+            return n_bytes;
+        }
+
+    } // namespace utf8
+} // namespace punp
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "base/types.h"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace punp {
+    namespace utf8 {
+
+        enum class TextKind {
+            ASCII,   // Valid, every byte < 0x80
+            UTF8,    // Valid UTF-8 with multi-byte sequences
+            BINARY,  // Contains a NUL byte, not a text file
+            INVALID, // Malformed UTF-8 at `error_offset`
+        };
+
+        struct ScanResult {
+            TextKind kind = TextKind::ASCII;
+            size_t error_offset = 0; // Byte offset of the first malformed sequence
+        };
+
+        /// Classify a whole buffer in a single vectorized pass: binary detection (any NUL
+        /// byte), UTF-8 validation (no overlongs, truncated sequences or code points above
+        /// U+10FFFF) and ASCII detection. Accepts exactly what `std::codecvt_utf8<wchar_t>`
+        /// decodes. Chunks of a larger input can be scanned one by one, if split between
+        /// sequences.
+        ScanResult scan(std::string_view data);
+
+        // Same as `scan` with NUL taken as text, for inputs that are not files
+        ScanResult validate(std::string_view data);
+
+        /// Transcoders with an ASCII fast path (AVX2/SSE4.1), multi-byte sequences are
+        /// handled by a table-free scalar loop. Output is byte-identical to
+        /// `std::wstring_convert<std::codecvt_utf8<wchar_t>>` for valid input.
+
+        // Append the code points of `bytes` to `out`, `bytes` must pass `validate`
+        void decode(std::string_view bytes, text_t &out);
+        // Same into `dst`, which has room for `length(bytes)` code points; returns the end of the output
+        wchar_t *decode(std::string_view bytes, wchar_t *dst);
+        // Append `text` encoded as UTF-8 to `out`
+        void encode(view_t text, std::string &out);
+
+        // Code points in `bytes`, which must pass `validate`
+        size_t length(std::string_view bytes);
+        // Bytes `encode` appends for `text`
+        size_t encoded_length(view_t text);
+
+    } // namespace utf8
+} // namespace punp
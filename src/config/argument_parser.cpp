@@ -4,8 +4,44 @@
 #include "base/common.h"
 #include "version.h"
 
+#include <cctype>
+#include <filesystem>
+#include <limits>
+
 namespace punp {
 
+    namespace {
+        // A positive whole number of `unit`s, as bytes or milliseconds; errors name `option`
+        bool parse_positive(const char *option, const std::string &text, uint64_t unit, uint64_t &out) {
+            uint64_t value = 0;
+            size_t used = 0;
+            // `stoull` would take "-1" and wrap it around
+            bool ok = !text.empty() && std::isdigit(static_cast<unsigned char>(text.front()));
+            if (ok) {
+                try {
+                    value = std::stoull(text, &used);
+                } catch (const std::exception &) {
+                    ok = false;
+                }
+            }
+            if (!ok || used != text.size()) {
+                error(option, ": '", text, "' is not a valid number");
+                return false;
+            }
+            if (value == 0) {
+                error(option, " must be greater than 0");
+                return false;
+            }
+            if (value > std::numeric_limits<uint64_t>::max() / unit ||
+                value * unit > std::numeric_limits<size_t>::max()) {
+                error(option, ": '", text, "' is too large");
+                return false;
+            }
+            out = value * unit;
+            return true;
+        }
+    } // namespace
+
     bool ArgumentParser::parse(int argc, char *argv[]) {
         for (int i = 1; i < argc; ++i) {
             std::string arg = argv[i];
@@ -20,6 +56,11 @@ namespace punp {
                _show_version ||
                _show_help ||
                _show_example ||
+               _emit_cpp ||
+               _lsp ||
+               _explain_rules ||
+               !_calibrate_dir.empty() ||
+               !_jobs_file.empty() ||
                update();
     }
 
@@ -90,6 +131,21 @@ namespace punp {
             {"-c, --console <rules>", "Specify rules directly from command line (highest priority)"},
             {"--ignore-global-rule-file", "Do not load global rule file"},
             {"--enable-latex-jumping", "Enable LaTeX file jumping (follow \\input and \\include)"},
+            {"--stream-threshold <MiB>", "Stream files larger than this in bounded memory (default: 256)"},
+            {"--memory-budget <MiB>", "Memory the files in flight may take together, files too large for it are streamed (default: half the usable memory)"},
+            {"--traversal-cache", "Reuse cached listings of directories that did not change since the last run"},
+            {"--minimize-automaton", "Merge equivalent matcher states to save memory with large rule sets"},
+            {"--count", "Only count the replacements that would be made, without modifying any file"},
+            {"--emit-cpp", "Print C++ source of a matcher specialized to the loaded rules (see PUNP_COMPILED_RULES)"},
+            {"-o, --output-dir <dir>", "Write results to a mirror of the input tree under <dir>, sources stay untouched"},
+            {"--lsp", "Run as a language server on stdio, reporting matches as diagnostics with quick fixes"},
+            {"--explain-rules", "Print automaton statistics, shadowed rules, marker clashes and matcher advice, then exit"},
+            {"--calibrate <dir>", "Benchmark thread count, page size and I/O threads on the files in <dir> and save the fastest"},
+            {"--ignore-profile", "Do not apply the settings saved by --calibrate"},
+            {"--jobs <manifest.json>", "Run the jobs (rule sources, patterns, options) of a manifest in one process"},
+            {"--stats", "Report matcher counters (chars scanned, prefilter skips, transitions...), needs -DPUNP_TELEMETRY=ON"},
+            {"--slow-threshold <ms>", "Report files still processing after this long, and list the slowest (default: 10000)"},
+            {"--progress", "Show files done, throughput and ETA while processing (terminal only); SIGUSR1 prints them to stderr"},
             {"--show-example", "Show usage examples"},
         };
         print_aligned_kv_pairs(options);
@@ -291,4 +347,125 @@ namespace punp {
         _config.rule_config.ignore_global_rule_file = true;
         return 1;
     }
+
+    int ArgumentParser::stream_threshold_handler(const char *next_arg) {
+        if (next_arg) {
+            uint64_t bytes = 0;
+            if (parse_positive("--stream-threshold", next_arg, 1024 * 1024, bytes)) {
+                _config.processor_config.stream_threshold = static_cast<size_t>(bytes);
+            } else {
+                _args_ok = false;
+            }
+            return 2;
+        } else {
+            error("--stream-threshold requires a size in MiB");
+            return 1;
+        }
+    }
+
+    int ArgumentParser::memory_budget_handler(const char *next_arg) {
+        if (next_arg) {
+            if (!parse_positive("--memory-budget", next_arg, 1024 * 1024, _config.processor_config.memory_budget)) {
+                _args_ok = false;
+            }
+            return 2;
+        } else {
+            error("--memory-budget requires a size in MiB");
+            return 1;
+        }
+    }
+
+    int ArgumentParser::traversal_cache_handler(const char *) {
+        _config.finder_config.traversal_cache = true;
+        return 1;
+    }
+
+    int ArgumentParser::minimize_automaton_handler(const char *) {
+        _config.processor_config.minimize_automaton = true;
+        return 1;
+    }
+
+    int ArgumentParser::count_handler(const char *) {
+        _config.processor_config.count_only = true;
+        return 1;
+    }
+
+    int ArgumentParser::emit_cpp_handler(const char *) {
+        _emit_cpp = true;
+        return 1;
+    }
+
+    int ArgumentParser::slow_threshold_handler(const char *next_arg) {
+        if (next_arg) {
+            uint64_t ms = 0;
+            if (parse_positive("--slow-threshold", next_arg, 1, ms)) {
+                _config.processor_config.slow_file_ms = static_cast<size_t>(ms);
+            } else {
+                _args_ok = false;
+            }
+            return 2;
+        } else {
+            error("--slow-threshold requires a time in milliseconds");
+            return 1;
+        }
+    }
+
+    int ArgumentParser::output_dir_handler(const char *next_arg) {
+        if (next_arg) {
+            _config.processor_config.output_dir = next_arg;
+            // Keep a mirror inside the input tree out of later runs
+            _config.finder_config.exclude_paths.emplace_back(
+                std::filesystem::absolute(next_arg).lexically_normal().string());
+            return 2;
+        } else {
+            error("--output-dir requires a directory path");
+            return 1;
+        }
+    }
+
+    int ArgumentParser::lsp_handler(const char *) {
+        _lsp = true;
+        return 1;
+    }
+
+    int ArgumentParser::explain_rules_handler(const char *) {
+        _explain_rules = true;
+        return 1;
+    }
+
+    int ArgumentParser::calibrate_handler(const char *next_arg) {
+        if (next_arg) {
+            _calibrate_dir = next_arg;
+            return 2;
+        } else {
+            error("--calibrate requires a directory path");
+            return 1;
+        }
+    }
+
+    int ArgumentParser::ignore_profile_handler(const char *) {
+        _ignore_profile = true;
+        return 1;
+    }
+
+    int ArgumentParser::jobs_handler(const char *next_arg) {
+        if (next_arg) {
+            _jobs_file = next_arg;
+            return 2;
+        } else {
+            error("--jobs requires a manifest file path");
+            return 1;
+        }
+    }
+
+    int ArgumentParser::progress_handler(const char *) {
+        _config.processor_config.show_progress = true;
+        return 1;
+    }
+
+    int ArgumentParser::stats_handler(const char *) {
+        _stats = true;
+        return 1;
+    }
+
 } // namespace punp
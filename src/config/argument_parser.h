@@ -20,6 +20,15 @@ namespace punp {
         bool show_example() const noexcept { return _show_example; }
         bool verbose() const noexcept { return _verbose; }
         bool dry_run() const noexcept { return _dry_run; }
+        bool emit_cpp() const noexcept { return _emit_cpp; }
+        bool lsp() const noexcept { return _lsp; }
+        bool explain_rules() const noexcept { return _explain_rules; }
+        const std::string &calibrate_dir() const noexcept { return _calibrate_dir; }
+        bool ignore_profile() const noexcept { return _ignore_profile; }
+        const std::string &jobs_file() const noexcept { return _jobs_file; }
+        bool stats() const noexcept { return _stats; }
+        // False if an option was given an invalid value, already reported
+        bool args_ok() const noexcept { return _args_ok; }
 
         bool update() const noexcept { return _update_type != UpdateType::NONE; }
         UpdateType update_type() const noexcept { return _update_type; }
@@ -41,6 +50,14 @@ namespace punp {
         bool _show_example = false;
         bool _verbose = false;
         bool _dry_run = false;
+        bool _emit_cpp = false;
+        bool _lsp = false;
+        bool _explain_rules = false;
+        std::string _calibrate_dir;
+        bool _ignore_profile = false;
+        std::string _jobs_file;
+        bool _stats = false;
+        bool _args_ok = true;
         UpdateType _update_type = UpdateType::NONE;
 
     private:
@@ -69,6 +86,21 @@ namespace punp {
             PUNP_ADD_ARG_HANDLER("--show-example", "--show-example", show_example_handler),
             PUNP_ADD_ARG_HANDLER("--enable-latex-jumping", "--enable-latex-jumping", enable_latex_jumping_handler),
             PUNP_ADD_ARG_HANDLER("--ignore-global-rule-file", "--ignore-global-rule-file", ignore_global_rule_file_handler),
+            PUNP_ADD_ARG_HANDLER("--stream-threshold", "--stream-threshold", stream_threshold_handler),
+            PUNP_ADD_ARG_HANDLER("--memory-budget", "--memory-budget", memory_budget_handler),
+            PUNP_ADD_ARG_HANDLER("--traversal-cache", "--traversal-cache", traversal_cache_handler),
+            PUNP_ADD_ARG_HANDLER("--minimize-automaton", "--minimize-automaton", minimize_automaton_handler),
+            PUNP_ADD_ARG_HANDLER("--count", "--count", count_handler),
+            PUNP_ADD_ARG_HANDLER("--emit-cpp", "--emit-cpp", emit_cpp_handler),
+            PUNP_ADD_ARG_HANDLER("--slow-threshold", "--slow-threshold", slow_threshold_handler),
+            PUNP_ADD_ARG_HANDLER("--progress", "--progress", progress_handler),
+            PUNP_ADD_ARG_HANDLER("-o", "--output-dir", output_dir_handler),
+            PUNP_ADD_ARG_HANDLER("--lsp", "--lsp", lsp_handler),
+            PUNP_ADD_ARG_HANDLER("--explain-rules", "--explain-rules", explain_rules_handler),
+            PUNP_ADD_ARG_HANDLER("--calibrate", "--calibrate", calibrate_handler),
+            PUNP_ADD_ARG_HANDLER("--ignore-profile", "--ignore-profile", ignore_profile_handler),
+            PUNP_ADD_ARG_HANDLER("--jobs", "--jobs", jobs_handler),
+            PUNP_ADD_ARG_HANDLER("--stats", "--stats", stats_handler),
         };
 #undef PUNP_ADD_ARG_HANDLER
 
@@ -88,6 +120,21 @@ namespace punp {
         int rule_file_path_handler(const char *);
         int console_rule_handler(const char *);
         int ignore_global_rule_file_handler(const char *);
+        int stream_threshold_handler(const char *);
+        int memory_budget_handler(const char *);
+        int traversal_cache_handler(const char *);
+        int minimize_automaton_handler(const char *);
+        int count_handler(const char *);
+        int emit_cpp_handler(const char *);
+        int slow_threshold_handler(const char *);
+        int progress_handler(const char *);
+        int output_dir_handler(const char *);
+        int lsp_handler(const char *);
+        int explain_rules_handler(const char *);
+        int calibrate_handler(const char *);
+        int ignore_profile_handler(const char *);
+        int jobs_handler(const char *);
+        int stats_handler(const char *);
         /*****  Handler methods *****/
     };
 
@@ -48,6 +48,12 @@ namespace punp {
 
         if (verbose && ok) {
             println("Total replacement rules loaded: ", _rep_map_ptr->size());
+            if (!_fold_map_ptr->empty()) {
+                println("Total FOLD replacement rules loaded: ", _fold_map_ptr->size());
+            }
+            if (!_range_rules_ptr->empty()) {
+                println("Total range rules loaded: ", _range_rules_ptr->size());
+            }
             println("Total protected rules loaded: ", _protected_regions_ptr->size());
         }
 
@@ -71,12 +77,17 @@ namespace punp {
     }
 
     bool ConfigManager::parse(const std::string &file_name, const std::string &contents) {
-        size_t rules_count_before = _rep_map_ptr->size() + _protected_regions_ptr->size();
-
-        config_parser::Parser parser(file_name, contents, _rep_map_ptr, _protected_regions_ptr);
+        auto rules_count = [this]() {
+            return _rep_map_ptr->size() + _protected_regions_ptr->size() + _range_rules_ptr->size() +
+                   _fold_map_ptr->size();
+        };
+        size_t rules_count_before = rules_count();
+
+        config_parser::Parser parser(file_name, contents, _rep_map_ptr, _protected_regions_ptr, _range_rules_ptr,
+                                     _fold_map_ptr);
         parser.parse();
 
-        return (_rep_map_ptr->size() + _protected_regions_ptr->size()) > rules_count_before || rules_count_before > 0;
+        return rules_count() > rules_count_before || rules_count_before > 0;
     }
 
     bool ConfigManager::parse_file(const std::string &file_path) {
@@ -12,21 +12,28 @@ namespace punp {
     public:
         explicit ConfigManager()
             : _rep_map_ptr(std::make_shared<ReplacementMap>()),
-              _protected_regions_ptr(std::make_shared<ProtectedRegions>()) {}
+              _protected_regions_ptr(std::make_shared<ProtectedRegions>()),
+              _range_rules_ptr(std::make_shared<RangeRules>()),
+              _fold_map_ptr(std::make_shared<ReplacementMap>()) {}
         ~ConfigManager() = default;
 
         bool load(const RuleConfig &rule_config, bool verbose = false);
 
         const std::shared_ptr<ReplacementMap> replacement_map() const noexcept { return _rep_map_ptr; }
         const std::shared_ptr<ProtectedRegions> protected_regions() const noexcept { return _protected_regions_ptr; }
-        bool empty() const noexcept { return _rep_map_ptr->empty(); }
+        const std::shared_ptr<RangeRules> range_rules() const noexcept { return _range_rules_ptr; }
+        const std::shared_ptr<ReplacementMap> fold_map() const noexcept { return _fold_map_ptr; }
+        bool empty() const noexcept { return _rep_map_ptr->empty() && _range_rules_ptr->empty() && _fold_map_ptr->empty(); }
         size_t size() const noexcept { return _rep_map_ptr->size(); }
 
+        // Rule files `load` reads, in order
+        std::vector<std::string> find_files(const RuleConfig &rule_config) const;
+
     private:
         std::shared_ptr<ReplacementMap> _rep_map_ptr;
         std::shared_ptr<ProtectedRegions> _protected_regions_ptr;
-
-        std::vector<std::string> find_files(const RuleConfig &rule_config) const;
+        std::shared_ptr<RangeRules> _range_rules_ptr;
+        std::shared_ptr<ReplacementMap> _fold_map_ptr; // `FOLD` rules, keyed by the folded pattern
 
         bool parse_file(const std::string &file_path);
         bool parse_console_rule(const std::string &console_rule);
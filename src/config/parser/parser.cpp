@@ -1,10 +1,13 @@
 #include "config/parser/parser.h"
 
 #include "base/color_print.h"
+#include "base/fold/fold.h"
 #include "base/types.h"
+#include "base/utf8/utf8.h"
 #include "config/parser/token.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 
@@ -248,18 +251,40 @@ namespace punp {
         }
 
         text_t Parser::to_tstr(const std::string &str) const {
-            convert_t converter;
-            try {
-                return converter.from_bytes(str);
-            } catch (const std::exception &) {
-                // Fallback for invalid UTF-8
-                text_t result;
-                result.reserve(str.length());
-                for (char c : str) {
-                    result.push_back(static_cast<wchar_t>(static_cast<unsigned char>(c)));
-                }
+            text_t result;
+            if (utf8::validate(str).kind != utf8::TextKind::INVALID) {
+                utf8::decode(str, result);
                 return result;
             }
+            // Fallback for invalid UTF-8
+            result.reserve(str.length());
+            for (char c : str) {
+                result.push_back(static_cast<wchar_t>(static_cast<unsigned char>(c)));
+            }
+            return result;
+        }
+
+        bool Parser::erase_range(wchar_t first, wchar_t last) {
+            bool erased = false;
+            RangeRules kept;
+            kept.reserve(_range_rules_ptr->size() + 1);
+            for (const auto &rule : *_range_rules_ptr) {
+                if (rule.from_end < first || rule.from_start > last) {
+                    kept.emplace_back(rule);
+                    continue;
+                }
+                erased = true;
+                if (rule.from_start < first) {
+                    kept.emplace_back(RangeRule{rule.from_start, static_cast<wchar_t>(first - 1), rule.to_start});
+                }
+                if (rule.from_end > last) {
+                    wchar_t offset = static_cast<wchar_t>(last + 1 - rule.from_start);
+                    kept.emplace_back(RangeRule{static_cast<wchar_t>(last + 1), rule.from_end,
+                                                static_cast<wchar_t>(rule.to_start + offset)});
+                }
+            }
+            _range_rules_ptr->swap(kept);
+            return erased;
         }
 
     } // namespace config_parser
@@ -310,19 +335,72 @@ namespace punp {
         PUNP_EXPECT_SEMICOLON(cmd_name);       \
     } while (0)
 
-        // Replace format: REPLACE(FROM "...", TO "...");
+        // Replace format: REPLACE(FROM "...", TO "..."[, FOLD "TRUE"]);
+        // With `FOLD` the rule matches any ASCII case and full/half width variant of FROM
         bool Parser::parse_replace() {
             size_t current_line = _current_token.line;
             auto kwargs_keys = kwargs_keys_t({"FROM", "TO"});
             bool is_valid = true;
-            auto kwargs = parse_args(kwargs_keys, is_valid);
+            auto kwargs = parse_args(kwargs_keys_t({"FROM", "TO", "FOLD"}), is_valid);
 
             if (!is_valid)
                 return false;
 
             PUNP_FINALIZE_PARSE(kwargs, kwargs_keys, "REPLACE", current_line);
 
-            _rep_map_ptr->insert_or_assign(to_tstr(kwargs["FROM"]), to_tstr(kwargs["TO"]));
+            bool is_folded = false;
+            if (auto it = kwargs.find("FOLD"); it != kwargs.end()) {
+                std::string value = it->second;
+                to_upper(value);
+                if (value != "TRUE" && value != "FALSE") {
+                    error("FOLD expects \"TRUE\" or \"FALSE\" at ", _file_path, ':', current_line);
+                    return true;
+                }
+                is_folded = value == "TRUE";
+            }
+
+            if (is_folded) {
+                _fold_map_ptr->insert_or_assign(fold::fold(to_tstr(kwargs["FROM"])), to_tstr(kwargs["TO"]));
+            } else {
+                _rep_map_ptr->insert_or_assign(to_tstr(kwargs["FROM"]), to_tstr(kwargs["TO"]));
+            }
+            return true;
+        }
+
+        // Replace range format: REPLACE_RANGE(FROM_START "...", FROM_END "...", TO_START "...");
+        // Every argument is a single character, the range is mapped by a constant offset
+        bool Parser::parse_replace_range() {
+            size_t current_line = _current_token.line;
+            auto kwargs_keys = kwargs_keys_t({"FROM_START", "FROM_END", "TO_START"});
+            bool is_valid = true;
+            auto kwargs = parse_args(kwargs_keys, is_valid);
+
+            if (!is_valid)
+                return false;
+
+            PUNP_FINALIZE_PARSE(kwargs, kwargs_keys, "REPLACE_RANGE", current_line);
+
+            text_t from_start = to_tstr(kwargs["FROM_START"]);
+            text_t from_end = to_tstr(kwargs["FROM_END"]);
+            text_t to_start = to_tstr(kwargs["TO_START"]);
+            if (from_start.length() != 1 || from_end.length() != 1 || to_start.length() != 1) {
+                error("REPLACE_RANGE arguments must be single characters at ", _file_path, ':', current_line);
+                return true;
+            }
+
+            RangeRule rule{from_start[0], from_end[0], to_start[0]};
+            if (rule.from_start > rule.from_end) {
+                error("REPLACE_RANGE has FROM_START after FROM_END at ", _file_path, ':', current_line);
+                return true;
+            }
+            if (static_cast<uint32_t>(rule.to_start) + static_cast<uint32_t>(rule.from_end - rule.from_start) > 0x10FFFF) {
+                error("REPLACE_RANGE target runs past U+10FFFF at ", _file_path, ':', current_line);
+                return true;
+            }
+
+            // Later rules override the overlapping part of earlier ones
+            erase_range(rule.from_start, rule.from_end);
+            _range_rules_ptr->emplace_back(rule);
             return true;
         }
 
@@ -338,7 +416,15 @@ namespace punp {
 
             PUNP_FINALIZE_PARSE(kwargs, kwargs_keys, "DEL", current_line);
 
-            if (_rep_map_ptr->erase(to_tstr(kwargs["FROM"])) == 0) {
+            // Also drops the `FOLD` rule matching FROM, and a single char
+            // punches a hole into the range rules covering it
+            text_t from = to_tstr(kwargs["FROM"]);
+            bool erased = _rep_map_ptr->erase(from) > 0;
+            erased = _fold_map_ptr->erase(fold::fold(from)) > 0 || erased;
+            if (from.length() == 1) {
+                erased = erase_range(from[0], from[0]) || erased;
+            }
+            if (!erased) {
                 warn("No rule found to erase for '", kwargs["FROM"],
                      "' at ", _file_path, ':', current_line);
             }
@@ -350,6 +436,8 @@ namespace punp {
             PUNP_FINALIZE_PARSE_NO_CHECK("CLEAR");
 
             _rep_map_ptr->clear();
+            _range_rules_ptr->clear();
+            _fold_map_ptr->clear();
             return true;
         }
 
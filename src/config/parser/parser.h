@@ -16,9 +16,12 @@ namespace punp {
         public:
             explicit Parser(const std::string &file_path, const std::string &input,
                             std::shared_ptr<ReplacementMap> rep_map_ptr,
-                            std::shared_ptr<ProtectedRegions> protected_regions_ptr)
+                            std::shared_ptr<ProtectedRegions> protected_regions_ptr,
+                            std::shared_ptr<RangeRules> range_rules_ptr,
+                            std::shared_ptr<ReplacementMap> fold_map_ptr)
                 : _file_path(file_path), _lexer(input),
-                  _rep_map_ptr(rep_map_ptr), _protected_regions_ptr(protected_regions_ptr) {
+                  _rep_map_ptr(rep_map_ptr), _protected_regions_ptr(protected_regions_ptr),
+                  _range_rules_ptr(range_rules_ptr), _fold_map_ptr(fold_map_ptr) {
                 advance();
                 advance();
             };
@@ -34,11 +37,14 @@ namespace punp {
             Token _peek_token;
             std::shared_ptr<ReplacementMap> _rep_map_ptr;
             std::shared_ptr<ProtectedRegions> _protected_regions_ptr;
+            std::shared_ptr<RangeRules> _range_rules_ptr;
+            std::shared_ptr<ReplacementMap> _fold_map_ptr; // `FOLD` rules, keyed by the folded FROM
 
             /*****  Parsing methods *****/
             void parse_statement();
 
             bool parse_replace();
+            bool parse_replace_range();
             bool parse_del();
             bool parse_clear();
             bool parse_protect();
@@ -50,6 +56,7 @@ namespace punp {
             using parse_func_map_t = std::unordered_map<std::string, parse_func_t>;
             const parse_func_map_t _parse_func_map = {
                 {"REPLACE", &Parser::parse_replace},
+                {"REPLACE_RANGE", &Parser::parse_replace_range},
                 {"DEL", &Parser::parse_del},
                 {"CLEAR", &Parser::parse_clear},
                 {"PROTECT", &Parser::parse_protect},
@@ -62,6 +69,9 @@ namespace punp {
             void to_upper(std::string &str) const;
             text_t to_tstr(const std::string &str) const;
 
+            // Drop `[first, last]` from the range rules, splitting partially covered ones
+            bool erase_range(wchar_t first, wchar_t last);
+
             // helper method to parse args kv pairs
             using kwargs_keys_t = std::vector<std::string>;
             using kwargs_t = std::unordered_map<std::string, std::string>;
@@ -0,0 +1,236 @@
+#include "config/rule_analyzer.h"
+#include "algorithm/ac_automaton.h"
+#include "algorithm/teddy.h"
+#include "base/color_print.h"
+#include "base/common.h"
+#include "base/fold/fold.h"
+#include "base/utf8/utf8.h"
+#include "config/config_manager.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace punp {
+
+    namespace {
+        std::string quoted(view_t text) {
+            std::string s = "\"";
+            utf8::encode(text, s);
+            s += '"';
+            return s;
+        }
+
+        // Some non-empty part coincides: a suffix of one starts the other, or with
+        // `containment` one contains the other
+        bool overlaps(view_t a, view_t b, bool containment) {
+            if (a.empty() || b.empty()) {
+                return false;
+            }
+            if (containment && (a.find(b) != view_t::npos || b.find(a) != view_t::npos)) {
+                return true;
+            }
+            for (size_t n = 1; n < std::min(a.length(), b.length()); ++n) {
+                if (a.substr(a.length() - n) == b.substr(0, n) || b.substr(b.length() - n) == a.substr(0, n)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void print_findings(const char *title, const char *hint, const std::vector<std::string> &findings) {
+            if (findings.empty()) {
+                return;
+            }
+            println_yellow("  ", title, " (", findings.size(), "): ", hint);
+            const size_t n = std::min(findings.size(), ExplainConfig::MAX_LISTED);
+            for (size_t i = 0; i < n; ++i) {
+                println_yellow("    ", findings[i]);
+            }
+            if (findings.size() > n) {
+                println_yellow("    ... and ", findings.size() - n, " more");
+            }
+        }
+
+        // "0: 12, 1: 30, 2: 4, 3-4: 1" with power of two buckets from 3 on
+        std::string fanout_histogram(const std::vector<size_t> &fanout) {
+            std::ostringstream out;
+            size_t lo = 0;
+            while (lo < fanout.size()) {
+                size_t hi = lo < 3 ? lo : std::min(fanout.size() - 1, 2 * lo - 2);
+                size_t n = 0;
+                for (size_t k = lo; k <= hi; ++k) {
+                    n += fanout[k];
+                }
+                if (n > 0) {
+                    out << (out.tellp() > 0 ? ", " : "") << lo;
+                    if (hi > lo) {
+                        out << '-' << hi;
+                    }
+                    out << ": " << n;
+                }
+                lo = hi + 1;
+            }
+            return out.str();
+        }
+    } // namespace
+
+    void explain_rules(const ConfigManager &config_manager, bool minimize_automaton) {
+        const ReplacementMap &rep_map = *config_manager.replacement_map();
+        const ReplacementMap &fold_map = *config_manager.fold_map();
+        const RangeRules &range_rules = *config_manager.range_rules();
+        const ProtectedRegions &protected_regions = *config_manager.protected_regions();
+
+        println_green("Rules:");
+        println_blue("  REPLACE: ", rep_map.size(), ", FOLD: ", fold_map.size(), ", REPLACE_RANGE: ", range_rules.size(),
+                     ", PROTECT: ", protected_regions.size());
+
+        // Same build as `FileProcessor`
+        ACAutomaton automaton;
+        automaton.build_from_map(rep_map, range_rules, fold_map, minimize_automaton);
+        const ACAutomaton::Stats stats = automaton.stats();
+
+        println_green("Automaton:");
+        if (stats.minimized) {
+            println_blue("  States: ", stats.states, " (", stats.trie_states, " before minimization)");
+        } else {
+            println_blue("  States: ", stats.states);
+        }
+        println_blue("  Max depth: ", stats.max_depth);
+        println_blue("  Alphabet classes: ", stats.classes);
+        println_blue("  Transitions: ", stats.dense ? "dense table" : "sparse edge lists with failure links");
+        println_blue("  Memory: ", stats.memory_bytes / 1024, " KiB");
+        println_blue("  Fan-out (children: trie states): ", fanout_histogram(stats.fanout));
+
+        // Leftmost-shortest matching: where a rule's prefix is a rule too, the prefix always wins
+        std::unordered_set<view_t> exact;
+        std::unordered_set<view_t> folded;
+        for (const auto &pair : rep_map) {
+            exact.emplace(pair.first);
+        }
+        for (const auto &pair : fold_map) {
+            folded.emplace(pair.first);
+        }
+        auto in_range = [&range_rules](wchar_t ch) {
+            return std::any_of(range_rules.begin(), range_rules.end(),
+                               [ch](const RangeRule &rule) { return rule.from_start <= ch && ch <= rule.from_end; });
+        };
+
+        std::vector<std::string> shadowed;
+        for (const auto &pair : rep_map) {
+            const view_t from = pair.first;
+            const text_t from_folded = fold::fold(from);
+            for (size_t n = 1; n < from.length(); ++n) {
+                if (exact.count(from.substr(0, n))) {
+                    shadowed.emplace_back(quoted(from) + " by REPLACE " + quoted(from.substr(0, n)));
+                    break;
+                }
+                if (folded.count(view_t(from_folded).substr(0, n))) {
+                    shadowed.emplace_back(quoted(from) + " by FOLD " + quoted(view_t(from_folded).substr(0, n)));
+                    break;
+                }
+                if (n == 1 && in_range(from[0])) {
+                    shadowed.emplace_back(quoted(from) + " by the REPLACE_RANGE covering " + quoted(from.substr(0, 1)));
+                    break;
+                }
+            }
+        }
+        for (const auto &pair : fold_map) {
+            const view_t from = pair.first;
+            for (size_t n = 1; n < from.length(); ++n) {
+                if (folded.count(from.substr(0, n))) {
+                    shadowed.emplace_back("FOLD " + quoted(from) + " by FOLD " + quoted(from.substr(0, n)));
+                    break;
+                }
+            }
+        }
+        std::sort(shadowed.begin(), shadowed.end());
+
+        // Marker text is matched like any other where a region is not closed, and a
+        // pattern running into a marker is cut off by the protected region. A
+        // `PROTECT_CONTENT` text (no end marker) is meant to contain patterns.
+        std::vector<std::string> clashes;
+        for (const auto &[start_marker, end_marker] : protected_regions) {
+            const bool containment = !end_marker.empty();
+            for (const text_t *marker : {&start_marker, &end_marker}) {
+                if (marker->empty() || (marker == &end_marker && end_marker == start_marker)) {
+                    continue;
+                }
+                const text_t marker_folded = fold::fold(*marker);
+                for (const auto &pair : rep_map) {
+                    if (overlaps(*marker, pair.first, containment)) {
+                        clashes.emplace_back("marker " + quoted(*marker) + " and REPLACE " + quoted(pair.first));
+                    }
+                }
+                for (const auto &pair : fold_map) {
+                    if (overlaps(marker_folded, pair.first, containment)) {
+                        clashes.emplace_back("marker " + quoted(*marker) + " and FOLD " + quoted(pair.first));
+                    }
+                }
+            }
+        }
+        std::sort(clashes.begin(), clashes.end());
+
+        if (!shadowed.empty() || !clashes.empty()) {
+            println_green("Warnings:");
+            print_findings("Rules that never match", "a rule that is a prefix of them always wins", shadowed);
+            print_findings("Protect markers overlapping patterns",
+                           "unclosed markers get rewritten, patterns running into a marker are cut off", clashes);
+        }
+
+        println_green("Matcher:");
+        std::string engine = stats.compiled ? "compiled matcher" : stats.dense ? "dense DFA" : "sparse DFA";
+        if (stats.prefilter) {
+            engine += " + Teddy prefilter";
+        }
+        engine += stats.narrow_alphabet ? ", single-byte class table" : ", paged class table";
+        println_blue("  In use: ", engine);
+
+        std::vector<std::string> advice;
+        if (!stats.dense) {
+            if (!stats.minimized) {
+                ACAutomaton minimized;
+                minimized.build_from_map(rep_map, range_rules, fold_map, true);
+                const ACAutomaton::Stats alt = minimized.stats();
+                if (alt.dense) {
+                    advice.emplace_back("`--minimize-automaton` gets it down to " + std::to_string(alt.states) +
+                                        " states, small enough for the dense table");
+                } else {
+                    advice.emplace_back("Too large for the dense table even with `--minimize-automaton` (" +
+                                        std::to_string(alt.states) + " states), consider splitting the rule set");
+                }
+            } else {
+                advice.emplace_back("Too large for the dense table, consider splitting the rule set");
+            }
+        }
+        if (!stats.prefilter) {
+            const size_t n_patterns = rep_map.size() + fold_map.size() + range_rules.size();
+            if ((!fold_map.empty() || !range_rules.empty()) && n_patterns <= TeddyMatcher::MAX_PATTERNS) {
+                advice.emplace_back("FOLD and REPLACE_RANGE rules keep the Teddy prefilter off, with plain REPLACE "
+                                    "rules only it would skip text that cannot match");
+            } else if (rep_map.size() > TeddyMatcher::MAX_PATTERNS &&
+                       rep_map.size() <= 2 * TeddyMatcher::MAX_PATTERNS) {
+                advice.emplace_back(std::to_string(rep_map.size()) + " REPLACE rules, at most " +
+                                    std::to_string(TeddyMatcher::MAX_PATTERNS) + " enable the Teddy prefilter");
+            }
+        }
+        if (stats.dense && !stats.compiled) {
+            advice.emplace_back("Fits `--emit-cpp`: building with PUNP_COMPILED_RULES gives a matcher specialized "
+                                "to these rules");
+        }
+        if (!fold_map.empty() || !range_rules.empty()) {
+            advice.emplace_back("`--lsp` patches the automaton in place for REPLACE edits, but rebuilds it when FOLD or "
+                                "REPLACE_RANGE rules change or a REPLACE edit overlaps them");
+        }
+
+        if (advice.empty()) {
+            println_green("  On the fast path, nothing to change");
+        }
+        for (const auto &line : advice) {
+            println_yellow("  - ", line);
+        }
+    }
+
+} // namespace punp
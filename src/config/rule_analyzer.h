@@ -0,0 +1,12 @@
+#pragma once
+
+namespace punp {
+
+    class ConfigManager;
+
+    /// `--explain-rules`: build the automaton for the loaded rules and print its shape,
+    /// the rules that can never match or clash with protect markers, and which matcher
+    /// the rule set runs on, with what would move it to a faster one.
+    void explain_rules(const ConfigManager &config_manager, bool minimize_automaton);
+
+} // namespace punp
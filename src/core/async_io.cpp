@@ -0,0 +1,50 @@
+#include "core/async_io.h"
+
+#include "base/color_print.h"
+
+#include <sys/stat.h>
+
+#include <fstream>
+
+namespace punp {
+
+    std::optional<std::string> AsyncIo::read_all(const std::string &path) {
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            return std::nullopt;
+        }
+
+        std::string data;
+        struct stat stat_buf;
+        if (stat(path.c_str(), &stat_buf) == 0 && stat_buf.st_size > 0) {
+            // Known size: read in one go
+            data.resize(static_cast<size_t>(stat_buf.st_size));
+            input.read(data.data(), static_cast<std::streamsize>(data.size()));
+            data.resize(static_cast<size_t>(input.gcount()));
+        } else {
+            // Size unknown (e.g. special files), read until EOF
+            data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        }
+        if (input.bad()) {
+            return std::nullopt;
+        }
+        return data;
+    }
+
+    bool AsyncIo::write_all(const std::string &path, const std::string &data) {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        if (!output) {
+            error("Cannot open file for writing: ", path);
+            return false;
+        }
+
+        output.write(data.data(), static_cast<std::streamsize>(data.size()));
+        output.close();
+        if (!output) {
+            error("Writing file ", path, ": write failed");
+            return false;
+        }
+        return true;
+    }
+
+} // namespace punp
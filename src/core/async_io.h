@@ -0,0 +1,49 @@
+#pragma once
+
+#include "base/coro/task.h"
+#include "base/thread_pool/thread_pool.h"
+
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace punp {
+
+    /// Awaitable file I/O: blocking calls run on a dedicated I/O pool and the awaiting
+    /// coroutine is resumed on the CPU pool, so workers never block on the disk
+    class AsyncIo {
+    public:
+        explicit AsyncIo(ThreadPool &cpu_pool, size_t num_threads = 1)
+            : _io_pool(num_threads), _cpu_pool(cpu_pool) {}
+        ~AsyncIo() = default;
+
+        void scaling(size_t new_size) { _io_pool.scaling(new_size); }
+        size_t thread_cnt() const noexcept { return _io_pool.thread_cnt(); }
+        void shutdown() { _io_pool.shutdown(); }
+
+        // Any other blocking job
+        template <typename F>
+        auto run(F fn) {
+            return coro::run_on(_io_pool, _cpu_pool, std::move(fn));
+        }
+
+        // Whole file as raw bytes, `std::nullopt` if it cannot be read
+        auto read_file(std::string path) {
+            return run([path = std::move(path)]() { return read_all(path); });
+        }
+
+        // Replace the file contents, errors are reported and yield false
+        auto write_file(std::string path, std::string data) {
+            return run([path = std::move(path), data = std::move(data)]() { return write_all(path, data); });
+        }
+
+        // Blocking primitives behind the awaitables, also usable outside a coroutine
+        static std::optional<std::string> read_all(const std::string &path);
+        static bool write_all(const std::string &path, const std::string &data);
+
+    private:
+        ThreadPool _io_pool;
+        ThreadPool &_cpu_pool;
+    };
+
+} // namespace punp
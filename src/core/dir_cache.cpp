@@ -0,0 +1,158 @@
+#include "core/dir_cache.h"
+
+#include "base/color_print.h"
+#include "base/common.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace punp {
+    namespace fs = std::filesystem;
+
+    // NOTE: on-disk format, one record per line:
+    //   punp-dircache <version> <fingerprint>
+    //   D <mtime_ns> <absolute dir>
+    //   F <file name> | S <subdir name>   (entries of the preceding D)
+    DirCache::DirCache(std::string path, uint64_t fingerprint)
+        : _path(std::move(path)), _fingerprint(fingerprint) {}
+
+    void DirCache::load() {
+        if (_path.empty()) {
+            return;
+        }
+        std::ifstream input(_path, std::ios::binary);
+        if (!input) {
+            return; // First run
+        }
+
+        std::string line;
+        if (!std::getline(input, line)) {
+            return;
+        }
+        std::istringstream header(line);
+        std::string magic;
+        uint32_t version = 0;
+        uint64_t fingerprint = 0;
+        header >> magic >> version >> std::hex >> fingerprint;
+        if (magic != TraversalCache::MAGIC || version != TraversalCache::VERSION || fingerprint != _fingerprint) {
+            _dirty = true; // Exclude rules changed, rebuild from scratch
+            return;
+        }
+
+        Listing *cur = nullptr;
+        while (std::getline(input, line)) {
+            if (line.size() < 2 || line[1] != ' ') {
+                _dirs.clear(); // Corrupted, drop everything
+                _dirty = true;
+                return;
+            }
+            std::string value = line.substr(2);
+            switch (line[0]) {
+            case 'D': {
+                size_t sep = value.find(' ');
+                if (sep == std::string::npos) {
+                    cur = nullptr;
+                    continue;
+                }
+                Listing listing;
+                listing.mtime_ns = std::strtoll(value.c_str(), nullptr, 10);
+                cur = &(_dirs[value.substr(sep + 1)] = std::move(listing));
+                break;
+            }
+            case 'F':
+                if (cur) {
+                    cur->files.emplace_back(std::move(value));
+                }
+                break;
+            case 'S':
+                if (cur) {
+                    cur->subdirs.emplace_back(std::move(value));
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    void DirCache::save() {
+        if (!_dirty || _path.empty()) {
+            return;
+        }
+
+        // Other roots share the file, so an entry not seen this run is only dropped once its directory is gone
+        std::error_code ec;
+        for (auto it = _dirs.begin(); it != _dirs.end();) {
+            if (!_visited.count(it->first) && !fs::is_directory(it->first, ec)) {
+                it = _dirs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        _visited.clear();
+
+        fs::create_directories(fs::path(_path).parent_path(), ec);
+
+        // Write a private sibling file and rename it, concurrent runs never see a torn cache
+        const std::string tmp_path = unique_tmp_path(_path);
+        {
+            std::ofstream output(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!output) {
+                warn("Cannot write traversal cache: ", tmp_path);
+                return;
+            }
+            output << TraversalCache::MAGIC << ' ' << TraversalCache::VERSION << ' '
+                   << std::hex << _fingerprint << std::dec << '\n';
+            for (const auto &[dir, listing] : _dirs) {
+                output << "D " << listing.mtime_ns << ' ' << dir << '\n';
+                for (const auto &name : listing.files) {
+                    output << "F " << name << '\n';
+                }
+                for (const auto &name : listing.subdirs) {
+                    output << "S " << name << '\n';
+                }
+            }
+            if (!output.flush()) {
+                warn("Cannot write traversal cache: ", tmp_path);
+                output.close();
+                std::remove(tmp_path.c_str());
+                return;
+            }
+        }
+        if (std::rename(tmp_path.c_str(), _path.c_str()) != 0) {
+            warn("Cannot update traversal cache: ", _path);
+            std::remove(tmp_path.c_str());
+            return;
+        }
+        _dirty = false;
+    }
+
+    const DirCache::Listing *DirCache::lookup(const std::string &dir, int64_t mtime_ns) {
+        _visited.insert(dir);
+        auto it = _dirs.find(dir);
+        if (it == _dirs.end() || it->second.mtime_ns != mtime_ns) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    void DirCache::store(const std::string &dir, Listing listing) {
+        // The format is line based, names with a newline are simply never cached
+        if (dir.find('\n') != std::string::npos) {
+            return;
+        }
+        for (const auto *names : {&listing.files, &listing.subdirs}) {
+            for (const auto &name : *names) {
+                if (name.find('\n') != std::string::npos) {
+                    return;
+                }
+            }
+        }
+        _dirs[dir] = std::move(listing);
+        _dirty = true;
+    }
+
+} // namespace punp
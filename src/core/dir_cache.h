@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace punp {
+
+    /// Persistent per-directory listing cache used by `--traversal-cache`
+    ///
+    /// A directory's mtime changes whenever an entry is added, removed or renamed,
+    /// so a listing recorded under the same mtime can be reused without `readdir`.
+    /// The whole cache is dropped when the exclude rules fingerprint differs, and a
+    /// directory neither looked up nor stored since the last save is dropped once it is gone.
+    /// With an empty path the cache only lives in memory.
+    class DirCache {
+    public:
+        struct Listing {
+            int64_t mtime_ns = 0;
+            std::vector<std::string> files;   // Regular files kept by the exclude rules
+            std::vector<std::string> subdirs; // Subdirectories kept by the exclude rules
+        };
+
+        DirCache(std::string path, uint64_t fingerprint);
+        ~DirCache() = default;
+
+        void load();
+        void save();
+
+        // Cached listing of `dir` (absolute, normalized), null if missing or stale
+        const Listing *lookup(const std::string &dir, int64_t mtime_ns);
+        void store(const std::string &dir, Listing listing);
+
+    private:
+        std::string _path;
+        uint64_t _fingerprint;
+        bool _dirty = false;
+        std::unordered_map<std::string, Listing> _dirs;
+        std::unordered_set<std::string> _visited; // Directories seen since the last save
+    };
+
+} // namespace punp
@@ -2,37 +2,63 @@
 
 #include "base/color_print.h"
 #include "base/common.h"
+#include "base/thread_pool/thread_pool.h"
 #include "config/default_excludes.h"
+#include "core/async_io.h"
+
+#include <sys/stat.h>
 
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
+#include <future>
+#include <memory>
 #include <string_view>
 #include <unordered_set>
 
 namespace punp {
     namespace fs = std::filesystem;
 
-    std::vector<std::string> FileFinder::find_files(const FileFinderConfig &config) const {
+    std::vector<std::string> FileFinder::find_files(const FileFinderConfig &config, FileCache *cache) const {
 
         ExcludeRules rules = parse_excludes(config.process_hidden, config.exclude_paths);
         std::unordered_set<std::string> ext_set(config.extensions.begin(), config.extensions.end());
 
+        std::unique_ptr<DirCache> own_cache;
+        DirCache *dir_cache = nullptr;
+        if (_reuse_listings) {
+            const uint64_t fingerprint = exclude_fingerprint(rules);
+            auto &cache_slot = _listings[fingerprint];
+            if (!cache_slot) {
+                cache_slot = std::make_unique<DirCache>(config.traversal_cache ? TraversalCache::PATH : "", fingerprint);
+                cache_slot->load();
+            }
+            dir_cache = cache_slot.get();
+        } else if (config.traversal_cache) {
+            own_cache = std::make_unique<DirCache>(TraversalCache::PATH, exclude_fingerprint(rules));
+            own_cache->load();
+            dir_cache = own_cache.get();
+        }
+
         // Deduplicate during collection; return value remains sorted.
         std::unordered_set<std::string> unique_files;
         for (const auto &pattern : config.patterns) {
             const auto expanded_pattern = maybe_expand_tilde(pattern);
             for (auto &file :
-                 expand_pattern(expanded_pattern, config.recursive, ext_set, rules)) {
+                 expand_pattern(expanded_pattern, config.recursive, ext_set, rules, dir_cache)) {
                 // Normalize path to canonical form for proper deduplication
                 auto normalized = fs::absolute(fs::path(file)).lexically_normal().string();
                 unique_files.insert(std::move(normalized));
             }
         }
 
+        if (dir_cache) {
+            dir_cache->save();
+        }
+
         // If LaTeX jumping is enabled, recursively collect included files
         if (config.enable_latex_jumping) {
-            std::unordered_set<std::string> visited_files;
             std::unordered_set<std::string> latex_files;
 
             // Collect all .tex files from the initial set as starting points
@@ -42,18 +68,13 @@ namespace punp {
                     initial_tex_files.push_back(file);
                 }
             }
+            std::sort(initial_tex_files.begin(), initial_tex_files.end());
 
-            // Recursively collect all included files from each initial .tex file
-            for (const auto &file : initial_tex_files) {
-                fs::path root_dir = fs::path(file).parent_path();
-                collect_latex_includes(file, root_dir, visited_files, latex_files, rules);
-            }
+            collect_latex_includes(initial_tex_files, latex_files, rules, cache);
 
-            // Add all collected LaTeX files to the unique set
+            // Paths are already absolute and normalized
             for (auto &file : latex_files) {
-                // Normalize path to canonical form for proper deduplication
-                auto normalized = fs::absolute(fs::path(file)).lexically_normal().string();
-                unique_files.insert(std::move(normalized));
+                unique_files.insert(std::move(file));
             }
         }
 
@@ -72,7 +93,8 @@ namespace punp {
         const std::string &pattern,
         bool recursive,
         const std::unordered_set<std::string> &ext_set,
-        const ExcludeRules &rules) const {
+        const ExcludeRules &rules,
+        DirCache *dir_cache) const {
 
         auto should_keep = [&](const std::string &path_str) {
             if (!ext_set.empty() && !has_extension(path_str, ext_set)) {
@@ -82,7 +104,7 @@ namespace punp {
         };
 
         if (is_dir(pattern)) {
-            return find_files_in_dir(pattern, recursive, ext_set, rules);
+            return find_files_in_dir(pattern, recursive, ext_set, rules, dir_cache);
         }
 
         if (contains_wildcard(pattern)) {
@@ -578,7 +600,8 @@ namespace punp {
         const std::string &dir,
         bool recursive,
         const std::unordered_set<std::string> &extensions,
-        const ExcludeRules &rules) const {
+        const ExcludeRules &rules,
+        DirCache *dir_cache) const {
 
         using frd_iter = fs::recursive_directory_iterator;
         using fd_iter = fs::directory_iterator;
@@ -608,6 +631,32 @@ namespace punp {
             return true;
         };
 
+        if (dir_cache) {
+            // Same traversal as below, but listings come from the cache when a directory is unchanged
+            std::vector<fs::path> pending{fs::path(dir)};
+            while (!pending.empty()) {
+                fs::path cur = std::move(pending.back());
+                pending.pop_back();
+
+                DirCache::Listing listing;
+                if (!list_dir(cur, rules, *dir_cache, listing)) {
+                    continue;
+                }
+                for (const auto &name : listing.files) {
+                    fs::path p = cur / name;
+                    if (should_collect(p)) {
+                        files.emplace_back(p.string());
+                    }
+                }
+                if (recursive) {
+                    for (const auto &name : listing.subdirs) {
+                        pending.emplace_back(cur / name);
+                    }
+                }
+            }
+            return files;
+        }
+
         try {
             if (recursive) {
                 std::error_code ec;
@@ -666,6 +715,94 @@ namespace punp {
         return files;
     }
 
+    bool FileFinder::list_dir(
+        const fs::path &dir,
+        const ExcludeRules &rules,
+        DirCache &cache,
+        DirCache::Listing &listing) const {
+
+        struct stat stat_buf;
+        if (stat(dir.c_str(), &stat_buf) != 0 || !S_ISDIR(stat_buf.st_mode)) {
+            return false;
+        }
+        const int64_t mtime_ns = static_cast<int64_t>(stat_buf.st_mtim.tv_sec) * 1'000'000'000 + stat_buf.st_mtim.tv_nsec;
+
+        std::string key;
+        try {
+            key = fs::absolute(dir).lexically_normal().string();
+        } catch (...) {
+            key = dir.string();
+        }
+        if (const auto *cached = cache.lookup(key, mtime_ns)) {
+            listing = *cached;
+            return true;
+        }
+
+        std::error_code ec;
+        fs::directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec);
+        if (ec) {
+            error("Accessing directory '", dir.string(), "': ", ec.message());
+            return false;
+        }
+        listing.mtime_ns = mtime_ns;
+        for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+            const auto &entry = *it;
+            const fs::path p = entry.path();
+            if (is_excluded(p, rules, false)) {
+                continue;
+            }
+
+            // Symlinked directories are not descended into, as with the plain traversal
+            std::error_code ec_type;
+            if (entry.is_directory(ec_type) && !ec_type) {
+                if (!entry.is_symlink(ec_type) && !ec_type) {
+                    listing.subdirs.emplace_back(p.filename().string());
+                }
+            } else if (entry.is_regular_file(ec_type) && !ec_type) {
+                listing.files.emplace_back(p.filename().string());
+            }
+        }
+        if (ec) {
+            error("Accessing directory '", dir.string(), "': ", ec.message());
+            return false;
+        }
+
+        // NOTE: a directory changed within the mtime granularity right after being listed
+        // would keep its old mtime, so only listings that have settled are recorded
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        if (std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() - mtime_ns >= TraversalCache::RACY_WINDOW_NS) {
+            cache.store(key, listing);
+        }
+        return true;
+    }
+
+    uint64_t FileFinder::exclude_fingerprint(const ExcludeRules &rules) const {
+        // FNV-1a over the sorted rule contents, order of insertion does not matter
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        auto mix = [&hash](std::string_view s) {
+            for (unsigned char c : s) {
+                hash = (hash ^ c) * 0x100000001b3ULL;
+            }
+            hash = (hash ^ 0xff) * 0x100000001b3ULL; // Separator
+        };
+        auto mix_all = [&mix](std::vector<std::string> items) {
+            std::sort(items.begin(), items.end());
+            mix(std::to_string(items.size()));
+            for (const auto &item : items) {
+                mix(item);
+            }
+        };
+
+        mix(rules.ignore_hidden ? "hidden:0" : "hidden:1");
+        mix_all({rules.names.begin(), rules.names.end()});
+        mix_all({rules.extensions.begin(), rules.extensions.end()});
+        mix_all(rules.name_globs);
+        mix_all({rules.abs_paths.begin(), rules.abs_paths.end()});
+        mix_all(rules.abs_path_globs);
+        mix_all(rules.suffix_globs);
+        return hash;
+    }
+
     bool FileFinder::is_dir(const std::string &path) const {
         try {
             return std::filesystem::is_directory(path);
@@ -704,155 +841,196 @@ namespace punp {
 
 // NOTE: This namespace block is used to impl latex jumping methods separately.
 namespace punp {
-    std::unordered_set<std::string> FileFinder::extract_latex_includes(const std::string_view &content) const {
-        std::unordered_set<std::string> includes;
-        size_t pos = 0;
-
-        while (pos < content.size()) {
-            // Look for \input{ or \include{
-            size_t input_pos = content.find("\\input{", pos);
-            size_t include_pos = content.find("\\include{", pos);
-
-            size_t found_pos = std::string::npos;
-            size_t cmd_len = 0;
+    namespace {
+        bool is_latex_letter(char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        }
 
-            if (input_pos != std::string::npos && (include_pos == std::string::npos || input_pos < include_pos)) {
-                found_pos = input_pos;
-                cmd_len = 7; // length of "\input{"
-            } else if (include_pos != std::string::npos) {
-                found_pos = include_pos;
-                cmd_len = 9; // length of "\include{"
+        // Parse `{...}` at `pos` (after optional blanks), returns false if there is none
+        bool read_brace_arg(std::string_view content, size_t &pos, std::string_view &arg) {
+            while (pos < content.size() && (content[pos] == ' ' || content[pos] == '\t')) {
+                ++pos;
             }
-
-            if (found_pos == std::string::npos) {
-                break;
+            if (pos >= content.size() || content[pos] != '{') {
+                return false;
             }
+            size_t close = content.find('}', pos + 1);
+            if (close == std::string_view::npos) {
+                return false;
+            }
+            arg = content.substr(pos + 1, close - pos - 1);
+            pos = close + 1;
 
-            // Find the closing brace
-            size_t brace_start = found_pos + cmd_len;
-            size_t brace_end = content.find('}', brace_start);
+            size_t first = arg.find_first_not_of(" \t\n\r");
+            size_t last = arg.find_last_not_of(" \t\n\r");
+            arg = (first == std::string_view::npos) ? std::string_view{} : arg.substr(first, last - first + 1);
+            return true;
+        }
 
-            if (brace_end == std::string::npos) {
-                pos = found_pos + cmd_len;
+        const char *find_byte(std::string_view content, size_t from, char c) {
+            if (from >= content.size()) {
+                return nullptr;
+            }
+            return static_cast<const char *>(std::memchr(content.data() + from, c, content.size() - from));
+        }
+    } // namespace
+
+    /// Single pass over the source: `memchr` jumps between backslashes and `%`, so
+    /// comments are skipped whole and only control sequences are inspected
+    std::vector<std::string> FileFinder::extract_latex_includes(std::string_view content) const {
+        std::vector<std::string> includes;
+        const char *base = content.data();
+        const char *next_cmd = find_byte(content, 0, '\\');
+        const char *next_comment = find_byte(content, 0, '%');
+
+        while (next_cmd || next_comment) {
+            if (next_comment && (!next_cmd || next_comment < next_cmd)) {
+                // Comment runs until the end of the line
+                const char *eol = find_byte(content, static_cast<size_t>(next_comment - base), '\n');
+                if (!eol) {
+                    break;
+                }
+                size_t resume = static_cast<size_t>(eol - base) + 1;
+                if (next_cmd && next_cmd < eol) {
+                    next_cmd = find_byte(content, resume, '\\');
+                }
+                next_comment = find_byte(content, resume, '%');
                 continue;
             }
 
-            // Extract the filename
-            auto filename = content.substr(brace_start, brace_end - brace_start);
+            size_t pos = static_cast<size_t>(next_cmd - base) + 1;
+            if (pos < content.size() && !is_latex_letter(content[pos])) {
+                // Control symbol such as `\%` or `\\`, the next char is not special
+                ++pos;
+            } else {
+                size_t name_end = pos;
+                while (name_end < content.size() && is_latex_letter(content[name_end])) {
+                    ++name_end;
+                }
+                std::string_view name = content.substr(pos, name_end - pos);
+                pos = name_end;
 
-            // Trim whitespace
-            size_t first = filename.find_first_not_of(" \t\n\r");
-            size_t last = filename.find_last_not_of(" \t\n\r");
-            if (first != std::string::npos && last != std::string::npos) {
-                filename = filename.substr(first, last - first + 1);
+                std::string_view arg;
+                if (name == "input" || name == "include" || name == "subfile") {
+                    if (read_brace_arg(content, pos, arg) && !arg.empty()) {
+                        includes.emplace_back(arg);
+                    }
+                } else if (name == "import" || name == "subimport") {
+                    // `\import{dir}{file}`, the file is looked up inside `dir`
+                    std::string_view dir;
+                    if (read_brace_arg(content, pos, dir) && read_brace_arg(content, pos, arg) && !arg.empty()) {
+                        std::string path(dir);
+                        if (!path.empty() && path.back() != '/') {
+                            path += '/';
+                        }
+                        includes.emplace_back(path.append(arg));
+                    }
+                }
             }
 
-            if (!filename.empty()) {
-                includes.insert(std::string(filename));
+            next_cmd = find_byte(content, pos, '\\');
+            if (next_comment && next_comment < base + pos) {
+                next_comment = find_byte(content, pos, '%');
             }
-
-            pos = brace_end + 1;
         }
 
         return includes;
     }
 
-    void FileFinder::collect_latex_includes(
+    std::optional<std::string> FileFinder::resolve_latex_include(
+        std::string include,
+        const fs::path &tex_dir,
+        const fs::path &root_dir) const {
+
+        // Add .tex extension if not present
+        if (include.size() < 4 || include.substr(include.size() - 4) != ".tex") {
+            include += ".tex";
+        }
+
+        // NOTE: LaTeX \input{} paths can be:
+        // 1. Relative to the current file's directory
+        // 2. Relative to the root document's directory
+        // Try both approaches, one `stat` per candidate
+        fs::path include_path(include);
+        if (include_path.is_absolute()) {
+            return include_path.lexically_normal().string();
+        }
+        for (const fs::path *dir : {&tex_dir, &root_dir}) {
+            std::string candidate = (*dir / include_path).lexically_normal().string();
+            if (is_file(candidate)) {
+                return candidate;
+            }
+        }
+        return std::nullopt;
+    }
+
+    FileFinder::LatexScan FileFinder::scan_latex_file(
         const std::string &tex_file,
         const fs::path &root_dir,
-        std::unordered_set<std::string> &visited_files,
-        std::unordered_set<std::string> &result_files,
         const ExcludeRules &rules) const {
 
-        // Avoid processing the same file twice
-        if (visited_files.count(tex_file)) {
-            return;
+        LatexScan scan;
+        scan.content = AsyncIo::read_all(tex_file);
+        if (!scan.content) {
+            return scan;
         }
-        visited_files.insert(tex_file);
-
-        // Add the current file to results
-        result_files.insert(tex_file);
 
-        // Read the file content
-        std::ifstream file(tex_file);
-        if (!file.is_open()) {
-            return;
+        fs::path tex_dir = fs::path(tex_file).parent_path();
+        for (auto &include : extract_latex_includes(*scan.content)) {
+            auto full_path = resolve_latex_include(std::move(include), tex_dir, root_dir);
+            // Check if the file is excluded
+            if (full_path && !is_excluded(fs::path(*full_path), rules, true)) {
+                scan.includes.emplace_back(std::move(*full_path));
+            }
         }
+        return scan;
+    }
 
-        std::string content((std::istreambuf_iterator<char>(file)),
-                            std::istreambuf_iterator<char>());
-        file.close();
-
-        // Extract included files
-        auto includes = extract_latex_includes(content);
-
-        // Get the directory of the current tex file
-        fs::path tex_path(tex_file);
-        fs::path tex_dir = tex_path.parent_path();
+    void FileFinder::collect_latex_includes(
+        const std::vector<std::string> &tex_files,
+        std::unordered_set<std::string> &result_files,
+        const ExcludeRules &rules,
+        FileCache *cache) const {
 
-        // Process each included file
-        for (const auto &include : includes) {
-            std::string include_path = include;
+        struct Node {
+            std::string path;
+            fs::path root_dir; // Directory of the document the node was reached from
+        };
 
-            // Add .tex extension if not present
-            if (include_path.size() < 4 || include_path.substr(include_path.size() - 4) != ".tex") {
-                include_path += ".tex";
+        // Avoid processing the same file twice
+        std::vector<Node> frontier;
+        for (const auto &file : tex_files) {
+            if (result_files.insert(file).second) {
+                frontier.push_back(Node{file, fs::path(file).parent_path()});
             }
+        }
 
-            fs::path full_path;
-            bool found = false;
-
-            // NOTE: LaTeX \input{} paths can be:
-            // 1. Relative to the current file's directory
-            // 2. Relative to the root document's directory
-            // Try both approaches
+        ThreadPool pool(std::min(std::max(frontier.size(), static_cast<size_t>(1)), Hardware::AUTO_NUM_THREADS));
+        while (!frontier.empty()) {
+            pool.scaling(std::min(frontier.size(), Hardware::AUTO_NUM_THREADS));
 
-            if (fs::path(include_path).is_absolute()) {
-                // Absolute path
-                full_path = include_path;
-                found = true;
-            } else {
-                // Try relative to current file's directory first
-                fs::path candidate1 = tex_dir / include_path;
+            std::vector<std::future<LatexScan>> scans;
+            scans.reserve(frontier.size());
+            for (const auto &node : frontier) {
+                scans.emplace_back(pool.submit([this, &node, &rules]() {
+                    return scan_latex_file(node.path, node.root_dir, rules);
+                }));
+            }
 
-                std::error_code ec;
-                fs::path canonical1 = fs::canonical(candidate1, ec);
-                if (!ec && is_file(canonical1.string())) {
-                    full_path = canonical1;
-                    found = true;
-                } else {
-                    // Try relative to root directory
-                    fs::path candidate2 = root_dir / include_path;
-                    fs::path canonical2 = fs::canonical(candidate2, ec);
-                    if (!ec && is_file(canonical2.string())) {
-                        full_path = canonical2;
-                        found = true;
-                    } else {
-                        // If both canonical fail, try lexically_normal
-                        if (is_file(candidate1.lexically_normal().string())) {
-                            full_path = candidate1.lexically_normal();
-                            found = true;
-                        } else if (is_file(candidate2.lexically_normal().string())) {
-                            full_path = candidate2.lexically_normal();
-                            found = true;
-                        }
+            // Merge in submission order, so the traversal stays deterministic
+            std::vector<Node> next;
+            for (size_t i = 0; i < frontier.size(); ++i) {
+                LatexScan scan = scans[i].get();
+                for (auto &include : scan.includes) {
+                    if (result_files.insert(include).second) {
+                        next.push_back(Node{std::move(include), frontier[i].root_dir});
                     }
                 }
+                if (cache && scan.content) {
+                    cache->insert_or_assign(frontier[i].path, std::move(*scan.content));
+                }
             }
-
-            if (!found) {
-                continue;
-            }
-
-            std::string full_path_str = full_path.string();
-
-            // Check if the file is excluded
-            if (is_excluded(full_path, rules, true)) {
-                continue;
-            }
-
-            // Recursively process the included file
-            collect_latex_includes(full_path_str, root_dir, visited_files, result_files, rules);
+            frontier.swap(next);
         }
     }
 
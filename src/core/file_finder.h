@@ -1,21 +1,35 @@
 #pragma once
 
 #include "base/types.h"
+#include "core/dir_cache.h"
 
+#include <cstdint>
 #include <filesystem>
+#include <optional>
 #include <string>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 namespace punp {
     class FileFinder {
     public:
-        FileFinder() = default;
+        /// With `reuse_listings`, directory listings are kept in memory across `find_files`
+        /// calls with the same exclude rules and reused while a directory's mtime is
+        /// unchanged, the same way `traversal_cache` reuses them across runs.
+        explicit FileFinder(bool reuse_listings = false) : _reuse_listings(reuse_listings) {}
         ~FileFinder() = default;
 
-        std::vector<std::string> find_files(const FileFinderConfig &config) const;
+        // Contents of files read while following LaTeX includes are stored in `cache` if given
+        std::vector<std::string> find_files(const FileFinderConfig &config, FileCache *cache = nullptr) const;
 
     private:
+        bool _reuse_listings = false;
+        // Listings kept by `reuse_listings`, per exclude rules fingerprint
+        mutable std::unordered_map<uint64_t, std::unique_ptr<DirCache>> _listings;
+
         struct ExcludeRules {
             std::unordered_set<std::string> names;
             std::unordered_set<std::string> extensions;
@@ -30,7 +44,8 @@ namespace punp {
             const std::string &pattern,
             bool recursive,
             const std::unordered_set<std::string> &ext_set,
-            const ExcludeRules &rules) const;
+            const ExcludeRules &rules,
+            DirCache *dir_cache) const;
 
         /**** glob matching ****/
         bool contains_wildcard(const std::string &s) const;
@@ -62,6 +77,8 @@ namespace punp {
         void generate_default_excludes(
             std::unordered_set<std::string> &names,
             std::unordered_set<std::string> &extensions) const;
+        // Identifies the rule set a traversal cache was built with
+        uint64_t exclude_fingerprint(const ExcludeRules &rules) const;
         /**** file filtering ****/
 
         /**** directory traversal ****/
@@ -69,17 +86,37 @@ namespace punp {
             const std::string &dir,
             bool recursive,
             const std::unordered_set<std::string> &extensions,
-            const ExcludeRules &rules) const;
+            const ExcludeRules &rules,
+            DirCache *dir_cache) const;
+        // Entries of `dir` passing the per-entry exclude rules, served from `cache` if unchanged
+        bool list_dir(
+            const std::filesystem::path &dir,
+            const ExcludeRules &rules,
+            DirCache &cache,
+            DirCache::Listing &listing) const;
         /**** directory traversal ****/
 
         /**** latex jumping ****/
+        struct LatexScan {
+            std::optional<std::string> content; // Raw bytes, empty if the file cannot be read
+            std::vector<std::string> includes;  // Resolved, not excluded include targets
+        };
+
+        // Breadth-first over the include graph, each level is scanned in parallel
         void collect_latex_includes(
+            const std::vector<std::string> &tex_files,
+            std::unordered_set<std::string> &result_files,
+            const ExcludeRules &rules,
+            FileCache *cache) const;
+        LatexScan scan_latex_file(
             const std::string &tex_file,
             const std::filesystem::path &root_dir,
-            std::unordered_set<std::string> &visited_files,
-            std::unordered_set<std::string> &result_files,
             const ExcludeRules &rules) const;
-        std::unordered_set<std::string> extract_latex_includes(const std::string_view &content) const;
+        std::vector<std::string> extract_latex_includes(std::string_view content) const;
+        std::optional<std::string> resolve_latex_include(
+            std::string include,
+            const std::filesystem::path &tex_dir,
+            const std::filesystem::path &root_dir) const;
         /**** latex jumping ****/
 
         /**** utils ****/
@@ -2,42 +2,124 @@
 
 #include "base/color_print.h"
 #include "base/common.h"
+#include "base/telemetry/telemetry.h"
 #include "base/thread_pool/thread_pool.h"
 #include "base/types.h"
+#include "base/utf8/utf8.h"
 #include "config/config_manager.h"
+#include "core/protected_regions.h"
 
 #include <sys/stat.h>
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
 #include <algorithm>
+#include <cerrno>
+#include <condition_variable>
 #include <cstddef>
+#include <filesystem>
 #include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
 
 namespace punp {
+    namespace fs = std::filesystem;
+
+    namespace {
+        // Length of the longest prefix of `bytes` that does not end inside a UTF-8 sequence
+        size_t utf8_complete_prefix(const std::string &bytes) {
+            const size_t n = bytes.size();
+            for (size_t back = 1; back <= 4 && back <= n; ++back) {
+                unsigned char c = static_cast<unsigned char>(bytes[n - back]);
+                if ((c & 0xC0) == 0x80) {
+                    continue; // Continuation byte, keep looking for the lead byte
+                }
+                size_t need = (c < 0x80) ? 1 : ((c >> 5) == 0x6) ? 2 : ((c >> 4) == 0xE) ? 3 : ((c >> 3) == 0x1E) ? 4 : 1;
+                return (back >= need) ? n : n - back;
+            }
+            return n; // Malformed, let the decoder report it
+        }
+
+        // Share the data blocks of `src` with a new file `dst` (copy-on-write filesystems only)
+        bool reflink(const std::string &src, const std::string &dst) {
+#if defined(__linux__) && defined(FICLONE)
+            int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+            if (in < 0) {
+                return false;
+            }
+            struct stat stat_buf;
+            int out = (::fstat(in, &stat_buf) == 0)
+                          ? ::open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, stat_buf.st_mode & 07777)
+                          : -1;
+            bool ok = out >= 0 && ::ioctl(out, FICLONE, in) == 0;
+            if (out >= 0) {
+                ::close(out);
+                if (!ok) {
+                    ::unlink(dst.c_str());
+                }
+            }
+            ::close(in);
+            return ok;
+#else
+            (void)src;
+            (void)dst;
+            return false;
+#endif
+        }
+
+        coro::Task<size_t> count_chunk(std::string_view bytes) {
+            co_return utf8::length(bytes);
+        }
+
+        coro::Task<size_t> decode_chunk(std::string_view bytes, wchar_t *dst) {
+            co_return static_cast<size_t>(utf8::decode(bytes, dst) - dst);
+        }
 
-    FileProcessor::FileProcessor(const ConfigManager &config_manager)
-        : _thread_pool(ThreadPool(1)),
-          _writeback_stop(false) {
+        coro::Task<std::string> encode_chunk(view_t text) {
+            std::string encoded;
+            utf8::encode(text, encoded);
+            co_return encoded;
+        }
+
+        // Encoded size of processed pages [first, last)
+        coro::Task<size_t> encoded_size(const FileContent *file_content, size_t first, size_t last) {
+            size_t n_bytes = 0;
+            for (size_t i = first; i < last; ++i) {
+                n_bytes += utf8::encoded_length(file_content->processed_pages[i]);
+            }
+            co_return n_bytes;
+        }
+    } // namespace
 
+    std::shared_ptr<const FileProcessor::Rules> FileProcessor::build_rules(const ConfigManager &config_manager,
+                                                                         bool minimize_automaton) {
+        auto rules = std::make_shared<Rules>();
         // Initialize the AC automaton with the replacement map
-        _ac_automaton.build_from_map(*config_manager.replacement_map());
+        rules->automaton.build_from_map(*config_manager.replacement_map(), *config_manager.range_rules(),
+                                        *config_manager.fold_map(), minimize_automaton);
         // Save protected regions for building protected intervals during file processing
-        _protected_regions = *config_manager.protected_regions();
-        // Start the writeback thread
-        _writeback_thread = std::thread(&FileProcessor::writeback_worker, this);
+        rules->protected_regions = *config_manager.protected_regions();
+        return rules;
     }
 
-    FileProcessor::~FileProcessor() {
-        // shutdown writeback thread
-        {
-            std::lock_guard<std::mutex> lock(_writeback_mtx);
-            _writeback_stop = true;
-        }
-        _writeback_cv.notify_all();
+    FileProcessor::FileProcessor(const ConfigManager &config_manager, bool minimize_automaton)
+        : FileProcessor(build_rules(config_manager, minimize_automaton)) {}
 
-        if (_writeback_thread.joinable()) {
-            _writeback_thread.join();
-        }
-        // Shutdown the thread pool
+    FileProcessor::FileProcessor(std::shared_ptr<const Rules> rules)
+        : _rules(std::move(rules)),
+          _thread_pool(ThreadPool(1)),
+          _io(_thread_pool, 1) {}
+
+    FileProcessor::~FileProcessor() {
+        // Every coroutine has finished once `process_files` returned
+        _io.shutdown();
         _thread_pool.shutdown();
     }
 
@@ -48,148 +130,586 @@ namespace punp {
         }
         size_t num_files = config.file_paths.size();
 
-        std::vector<std::shared_ptr<FileContent>> file_contents(num_files);
-        std::vector<std::vector<Page>> file_pages(num_files);
-        std::vector<std::vector<PageResult>> page_results(num_files);
+        const size_t num_threads = worker_threads(config, num_files);
+        _thread_pool.scaling(num_threads);
+        _file_cache = config.file_cache;
+        _count_only = config.count_only;
+        _output_dir.clear();
+        if (!config.output_dir.empty()) {
+            _output_dir = fs::absolute(config.output_dir).lexically_normal();
+            _output_base = config.output_base.empty() ? fs::current_path()
+                                                      : fs::absolute(config.output_base).lexically_normal();
+        }
+        _mirror_unchanged = config.mirror_unchanged;
+        _io.scaling(config.io_threads ? config.io_threads : std::min(num_threads, IoConfig::MAX_AUTO_THREADS));
+        _page_size = config.page_size ? config.page_size : PageConfig::SIZE;
+
+        // Files above the threshold bypass paging and are streamed by a single task
+        const size_t threshold = stream_threshold(config);
+
+        // Bound the number of files held in memory at the same time, and the memory they take
+        // together: the threshold alone only keeps a single file within the budget
+        coro::AsyncSemaphore inflight(_thread_pool, num_threads * IoConfig::INFLIGHT_FILES_PER_THREAD);
+        const uint64_t budget = memory_budget(config);
+        _memory_limit = budget ? static_cast<size_t>(budget) : std::numeric_limits<size_t>::max();
+        coro::AsyncSemaphore memory(_thread_pool, _memory_limit);
+
+        // Watchdog: reports files that take too long while they are still running
+        const std::chrono::milliseconds slow_threshold(config.slow_file_ms ? config.slow_file_ms : WatchdogConfig::SLOW_FILE_MS);
+        const auto poll_interval = std::clamp(slow_threshold / 4, std::chrono::milliseconds(1),
+                                              std::chrono::milliseconds(WatchdogConfig::MAX_POLL_MS));
+        std::mutex watchdog_mtx;
+        std::condition_variable watchdog_cv;
+        bool done = false;
+        std::thread watchdog([&]() {
+            std::unique_lock<std::mutex> lock(watchdog_mtx);
+            while (!watchdog_cv.wait_for(lock, poll_interval, [&]() { return done; })) {
+                report_slow_files(slow_threshold);
+            }
+        });
+
+        // Progress line and SIGUSR1 stats, read off the counters by a thread of their own
+        _progress.reset(num_files);
+        ProgressTicker ticker(_progress, config.show_progress);
 
-        size_t num_threads = config.max_threads;
-        if (num_threads == 0) {
-            num_threads = std::min(num_files * 2, Hardware::AUTO_NUM_THREADS);
-            num_threads = std::max(num_threads, static_cast<size_t>(1));
-        } else {
-            num_threads = std::min(num_threads, Hardware::AUTO_NUM_THREADS);
+        std::vector<coro::Task<ProcessingResult>> file_tasks;
+        file_tasks.reserve(num_files);
+        for (const auto &file_path : config.file_paths) {
+            file_tasks.emplace_back(process_file(file_path, threshold, inflight, memory));
         }
-        _thread_pool.scaling(num_threads);
 
-        // Shared state for coordination
-        std::mutex task_mutex;
-        std::condition_variable completion_cv;
-        std::atomic<size_t> pending_tasks{num_files};
-
-        // Submit file loading tasks with optimized callback
-        for (size_t i = 0; i < num_files; ++i) {
-            _thread_pool.submit_with_callback(
-                [this, file_path = config.file_paths[i]]() {
-                    return preprocess_file(file_path);
-                },
-                [this, i, &file_contents, &file_pages, &page_results, &pending_tasks, &completion_cv](
-                    std::pair<std::shared_ptr<FileContent>, std::vector<Page>> result) {
-                    if (!result.first || result.second.empty()) {
-                        // No valid file content or pages, decrement and notify if done
-                        if (pending_tasks.fetch_sub(1) == 1) {
-                            completion_cv.notify_one();
-                        }
-                        return;
-                    }
-                    file_contents[i] = result.first;
-                    file_pages[i] = std::move(result.second);
-
-                    size_t num_pages = file_pages[i].size();
-                    page_results[i].resize(num_pages);
-
-                    // Batch submit all page tasks
-                    pending_tasks.fetch_add(num_pages - 1);
-                    for (size_t j = 0; j < num_pages; ++j) {
-                        _thread_pool.submit(
-                            [this, i, j, page = file_pages[i][j], &page_results, &pending_tasks, &completion_cv]() {
-                                page_results[i][j] = process_page(page);
-                                // Only notify when all tasks complete
-                                if (pending_tasks.fetch_sub(1) == 1) {
-                                    completion_cv.notify_one();
-                                }
-                            });
-                    }
-                });
+        auto results = coro::sync_wait(coro::when_all(_thread_pool, std::move(file_tasks)));
+        _file_cache.reset();
+
+        {
+            std::lock_guard<std::mutex> lock(watchdog_mtx);
+            done = true;
+        }
+        watchdog_cv.notify_one();
+        watchdog.join();
+        return results;
+    }
+
+    size_t FileProcessor::worker_threads(const FileProcessorConfig &config, size_t num_files) {
+        if (config.max_threads == 0) {
+            const size_t auto_threads = config.auto_threads ? config.auto_threads : Hardware::AUTO_NUM_THREADS;
+            return std::max(std::min(num_files * 2, auto_threads), static_cast<size_t>(1));
+        }
+        return std::min(config.max_threads, Hardware::AUTO_NUM_THREADS);
+    }
+
+    uint64_t FileProcessor::memory_budget(const FileProcessorConfig &config) {
+        if (config.memory_budget) {
+            return config.memory_budget;
+        }
+        return static_cast<uint64_t>(hardware::resources().memory * MemoryConfig::BUDGET_FRACTION);
+    }
+
+    size_t FileProcessor::stream_threshold(const FileProcessorConfig &config) {
+        if (config.stream_threshold) {
+            return config.stream_threshold;
         }
+        // A file processed in memory has to fit the budget, larger ones are streamed
+        const uint64_t budget = memory_budget(config);
+        if (budget == 0) {
+            return StreamConfig::THRESHOLD; // Memory size unknown
+        }
+        return std::clamp<uint64_t>(budget / MemoryConfig::BYTES_PER_FILE_BYTE, StreamConfig::CHUNK_SIZE,
+                                    StreamConfig::THRESHOLD);
+    }
+
+    void FileProcessor::report_slow_files(std::chrono::milliseconds threshold) {
+        const auto now = FileClock::clock_type::now();
+        std::lock_guard<std::mutex> lock(_active_mtx);
+        for (FileClock *clock : _active) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - clock->start());
+            if (!clock->reported && elapsed >= threshold) {
+                clock->reported = true;
+                warn("Slow file: ", clock->path(), " still running after ", elapsed.count(), " ms (",
+                     stage_name(clock->stage()), ")");
+            }
+        }
+    }
+
+    void FileProcessor::FileClock::enter(FileStage next) {
+        const auto now = clock_type::now();
+        _stage_us[static_cast<size_t>(stage())] +=
+            std::chrono::duration_cast<std::chrono::microseconds>(now - _stage_start).count();
+        _stage_start = now;
+        _stage.store(next, std::memory_order_relaxed);
+    }
 
-        // Wait for all tasks to complete
+    void FileProcessor::FileClock::finish(ProcessingResult &result) {
+        enter(stage());
+        result.stage_us = _stage_us;
+        result.total_us = std::chrono::duration_cast<std::chrono::microseconds>(_stage_start - _start).count();
+    }
+
+    std::optional<std::string> FileProcessor::take_cached(const std::string &file_path) {
+        // NOTE: every path is processed once and the map is never modified structurally
+        // here, so concurrent lookups and moves of distinct values do not race
+        if (!_file_cache) {
+            return std::nullopt;
+        }
+        auto it = _file_cache->find(file_path);
+        if (it == _file_cache->end()) {
+            return std::nullopt;
+        }
+        return std::move(it->second);
+    }
+
+    coro::Task<ProcessingResult> FileProcessor::process_file(std::string file_path, size_t stream_threshold,
+                                                             coro::AsyncSemaphore &inflight,
+                                                             coro::AsyncSemaphore &memory) {
+        co_await inflight.acquire();
+
+        // Reserve the file's footprint out of the budget: all of it if processed in
+        // memory, the windows in flight if streamed
+        struct stat stat_buf;
+        const uint64_t size = stat(file_path.c_str(), &stat_buf) == 0 ? static_cast<uint64_t>(stat_buf.st_size) : 0;
+        const uint64_t held = size > stream_threshold ? StreamConfig::CHUNK_SIZE * StreamConfig::WINDOWS_IN_FLIGHT : size;
+        const size_t footprint = static_cast<size_t>(std::min<uint64_t>(held * MemoryConfig::BYTES_PER_FILE_BYTE, _memory_limit));
+        auto reserve = memory.acquire(footprint);
+        co_await reserve;
+
+        FileClock clock(file_path);
         {
-            std::unique_lock<std::mutex> lock(task_mutex);
-            completion_cv.wait(lock, [&pending_tasks] {
-                return pending_tasks.load() == 0;
-            });
-        }
-
-        // Collect results from file_contents and page_results
-        std::vector<ProcessingResult> results(num_files);
-        for (size_t i = 0; i < num_files; ++i) {
-            const auto &file_path = config.file_paths[i];
-            const auto &file_content = file_contents[i];
-
-            results[i].file_path = file_path;
-            if (!file_content) {
-                results[i].ok = false;
-                results[i].err_msg = "Failed to load file content";
-                continue;
+            std::lock_guard<std::mutex> lock(_active_mtx);
+            _active.insert(&clock);
+        }
+
+        ProcessingResult result;
+        try {
+            auto pipeline = run_pipeline(file_path, stream_threshold, clock);
+            result = co_await std::move(pipeline);
+        } catch (const std::exception &e) {
+            result.file_path = file_path;
+            result.ok = false;
+            result.err_msg = std::string("Processing exception: ") + e.what();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_active_mtx);
+            _active.erase(&clock);
+        }
+        _progress.bytes_inflight.fetch_sub(clock.bytes, std::memory_order_relaxed);
+        _progress.bytes_done.fetch_add(clock.bytes, std::memory_order_relaxed);
+        _progress.n_rep.fetch_add(result.n_rep, std::memory_order_relaxed);
+        if (!result.ok) {
+            _progress.files_failed.fetch_add(1, std::memory_order_relaxed);
+        }
+        _progress.files_done.fetch_add(1, std::memory_order_relaxed);
+        clock.finish(result);
+        memory.release(footprint);
+        inflight.release();
+        co_return result;
+    }
+
+    coro::Task<ProcessingResult> FileProcessor::run_pipeline(const std::string &file_path, size_t stream_threshold,
+                                                             FileClock &clock) {
+        ProcessingResult result;
+        result.file_path = file_path;
+        result.ok = false;
+
+        struct stat stat_buf;
+        if (stat(file_path.c_str(), &stat_buf) == 0 &&
+            static_cast<size_t>(stat_buf.st_size) > stream_threshold) {
+            // NOTE: awaitables are kept in named locals, GCC 12 may destroy
+            // temporaries inside a `co_await` expression twice
+            clock.bytes = static_cast<uint64_t>(stat_buf.st_size);
+            _progress.bytes_inflight.fetch_add(clock.bytes, std::memory_order_relaxed);
+            auto stream_job = process_large_file(file_path, clock);
+            result = co_await std::move(stream_job);
+            result.bytes = static_cast<size_t>(stat_buf.st_size);
+            co_return result;
+        }
+
+        // Stage 1: load, unless the file was already read during discovery
+        auto data = take_cached(file_path);
+        if (!data) {
+            auto read_job = _io.read_file(file_path);
+            data = co_await read_job;
+        }
+        if (!data) {
+            result.err_msg = "Failed to load file content";
+            co_return result;
+        }
+        result.bytes = data->size();
+        clock.bytes = result.bytes;
+        _progress.bytes_inflight.fetch_add(clock.bytes, std::memory_order_relaxed);
+
+        // Classify the whole buffer first, binary or malformed files are rejected before any decode work
+        clock.enter(FileStage::DECODE);
+        const auto text_scan = utf8::scan(*data);
+        if (text_scan.kind == utf8::TextKind::BINARY) {
+            result.err_msg = "Binary file, skipped";
+            co_return result;
+        }
+        if (text_scan.kind == utf8::TextKind::INVALID) {
+            result.err_msg = "Invalid UTF-8 at byte offset " + std::to_string(text_scan.error_offset);
+            co_return result;
+        }
+
+        const bool ascii = text_scan.kind == utf8::TextKind::ASCII;
+        std::shared_ptr<FileContent> file_content;
+        if (data->size() >= IntraFileConfig::PARALLEL_THRESHOLD) {
+            auto decode_job = decode_parallel(file_path, *data, ascii);
+            file_content = co_await std::move(decode_job);
+        } else {
+            file_content = load_file_content(file_path, *data, ascii);
+        }
+        data.reset();
+        auto pages = preprocess_file(file_content);
+        if (!file_content || pages.empty()) {
+            result.err_msg = "Failed to load file content";
+            co_return result;
+        }
+
+        // Stage 2: process all pages in parallel
+        clock.enter(FileStage::MATCH);
+        std::vector<coro::Task<PageResult>> page_tasks;
+        page_tasks.reserve(pages.size());
+        for (auto &page : pages) {
+            page_tasks.emplace_back(page_task(std::move(page)));
+        }
+        auto pages_job = coro::when_all(_thread_pool, std::move(page_tasks));
+        auto page_results = co_await std::move(pages_job);
+
+        // Check if any page processing failed
+        bool has_error = false;
+        std::string error_messages;
+        size_t total_replacements = 0;
+
+        for (const auto &page_result : page_results) {
+            if (!page_result.ok) {
+                has_error = true;
+                if (!error_messages.empty()) {
+                    error_messages += "; ";
+                }
+                error_messages += "Page " + std::to_string(page_result.page_id) + ": " + page_result.err_msg;
+            } else {
+                total_replacements += page_result.n_rep;
             }
+        }
 
-            // Check if any page processing failed
-            bool has_error = false;
-            std::string error_messages;
-            size_t total_replacements = 0;
+        result.n_rep = total_replacements;
+        if (has_error) {
+            result.err_msg = error_messages;
+            co_return result;
+        }
 
-            for (const auto &page_result : page_results[i]) {
-                if (!page_result.ok) {
-                    has_error = true;
-                    if (!error_messages.empty()) {
-                        error_messages += "; ";
-                    }
-                    error_messages += "Page " + std::to_string(page_result.page_id) + ": " + page_result.err_msg;
-                } else {
-                    total_replacements += page_result.n_rep;
+        // Stage 3: write back, only if something changed. A mirror gets every file unless
+        // told otherwise, unchanged ones are linked to the source instead of written
+        if (!_count_only && (total_replacements > 0 || (!_output_dir.empty() && _mirror_unchanged))) {
+            clock.enter(FileStage::WRITE);
+            std::string target;
+            if (!prepare_target(file_path, target, result.err_msg)) {
+                co_return result;
+            }
+
+            if (total_replacements == 0) {
+                auto link_job = _io.run([this, file_path, target]() {
+                    std::string err;
+                    link_unchanged(file_path, target, err);
+                    return err;
+                });
+                result.err_msg = co_await link_job;
+                if (!result.err_msg.empty()) {
+                    co_return result;
                 }
+                result.ok = true;
+                co_return result;
             }
 
-            if (has_error) {
-                results[i].ok = false;
-                results[i].err_msg = error_messages;
-                results[i].n_rep = total_replacements;
-            } else {
-                results[i].ok = true;
-                results[i].n_rep = total_replacements;
+            if (file_content->content.size() >= IntraFileConfig::PARALLEL_THRESHOLD) {
+                auto write_job = write_parallel(target, std::move(file_content));
+                result.err_msg = co_await std::move(write_job);
+                if (!result.err_msg.empty()) {
+                    co_return result;
+                }
+                if (target != file_path) {
+                    std::error_code ec;
+                    fs::permissions(target, fs::status(file_path, ec).permissions(), ec);
+                }
+                result.ok = true;
+                co_return result;
+            }
+
+            std::string encoded;
+            try {
+                encoded = encode_file_content(*file_content);
+            } catch (const std::exception &e) {
+                result.err_msg = std::string("Encoding failed: ") + e.what();
+                co_return result;
+            }
+            file_content.reset();
+
+            auto write_job = _io.write_file(target, std::move(encoded));
+            if (!co_await write_job) {
+                result.err_msg = "Failed to write file";
+                co_return result;
+            }
+            if (target != file_path) {
+                std::error_code ec;
+                fs::permissions(target, fs::status(file_path, ec).permissions(), ec);
             }
         }
 
-        return results;
+        result.ok = true;
+        co_return result;
     }
 
-    std::shared_ptr<FileContent> FileProcessor::load_file_content(const std::string &file_path) const {
-        try {
-            if (!is_text_file(file_path)) {
-                return nullptr;
-            }
+    bool FileProcessor::prepare_target(const std::string &file_path, std::string &target, std::string &err) const {
+        if (_output_dir.empty()) {
+            target = file_path;
+            return true;
+        }
 
-            // Get file size for pre-allocation hint
-            struct stat stat_buf;
-            size_t file_size = 0;
-            if (stat(file_path.c_str(), &stat_buf) == 0) {
-                file_size = static_cast<size_t>(stat_buf.st_size);
+        fs::path relative = fs::path(file_path).lexically_relative(_output_base);
+        if (relative.empty() || *relative.begin() == "..") {
+            err = "Outside the current directory, cannot mirror into " + _output_dir.string();
+            return false;
+        }
+        fs::path target_path = _output_dir / relative;
+        if (target_path == fs::path(file_path)) {
+            err = "Output path is the input file itself";
+            return false;
+        }
+
+        // Never write through a hardlink left by an earlier run, it would change the source
+        std::error_code ec;
+        fs::create_directories(target_path.parent_path(), ec);
+        fs::remove(target_path, ec);
+        if (ec) {
+            err = "Cannot replace " + target_path.string() + ": " + ec.message();
+            return false;
+        }
+        target = target_path.string();
+        return true;
+    }
+
+    bool FileProcessor::link_unchanged(const std::string &file_path, const std::string &target, std::string &err) const {
+        std::error_code ec;
+        fs::create_hard_link(file_path, target, ec);
+        if (!ec || reflink(file_path, target)) {
+            return true;
+        }
+        fs::copy_file(file_path, target, fs::copy_options::overwrite_existing, ec);
+        if (ec) {
+            err = "Cannot mirror to " + target + ": " + ec.message();
+            return false;
+        }
+        return true;
+    }
+
+    coro::Task<PageResult> FileProcessor::page_task(Page page) const {
+        co_return process_page(page);
+    }
+
+    std::string FileProcessor::encode_file_content(const FileContent &file_content) const {
+        std::string encoded;
+        encoded.reserve(file_content.content.size() + 1);
+        for (const auto &page_content : file_content.processed_pages) {
+            utf8::encode(page_content, encoded);
+        }
+        encoded += '\n';
+        return encoded;
+    }
+
+    coro::Task<std::string> FileProcessor::write_parallel(std::string target,
+                                                          std::shared_ptr<const FileContent> file_content) {
+#ifdef __linux__
+        const auto &pages = file_content->processed_pages;
+
+        // Runs of whole pages, about `IntraFileConfig::CHUNK_SIZE` chars each
+        std::vector<size_t> bounds{0};
+        size_t run_chars = 0;
+        for (size_t i = 0; i + 1 < pages.size(); ++i) {
+            run_chars += pages[i].size();
+            if (run_chars >= IntraFileConfig::CHUNK_SIZE) {
+                bounds.push_back(i + 1);
+                run_chars = 0;
             }
+        }
+        bounds.push_back(pages.size());
+        const size_t n_runs = bounds.size() - 1;
+
+        // Every run's output offset is the prefix sum of the encoded sizes before it
+        std::vector<coro::Task<size_t>> size_tasks;
+        size_tasks.reserve(n_runs);
+        for (size_t i = 0; i < n_runs; ++i) {
+            size_tasks.emplace_back(encoded_size(file_content.get(), bounds[i], bounds[i + 1]));
+        }
+        auto sizes_job = coro::when_all(_thread_pool, std::move(size_tasks));
+        const auto sizes = co_await std::move(sizes_job);
+        std::vector<uint64_t> offsets(n_runs + 1, 0);
+        for (size_t i = 0; i < n_runs; ++i) {
+            offsets[i + 1] = offsets[i] + sizes[i];
+        }
 
-            std::wifstream input_file(file_path);
-            if (!input_file) {
-                return nullptr;
+        // Sized up front (with the final '\n'), so the runs never extend the file concurrently
+        const uint64_t total = offsets[n_runs] + 1;
+        auto open_job = _io.run([target, total]() {
+            int fd = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            if (fd >= 0 && ::ftruncate(fd, static_cast<off_t>(total)) != 0) {
+                const int err = errno;
+                ::close(fd);
+                errno = err;
+                fd = -1;
             }
-            input_file.imbue(std::locale(std::locale(), new char_convert_t));
+            return fd < 0 ? -errno : fd;
+        });
+        const int fd = co_await open_job;
+        if (fd < 0) {
+            co_return "Cannot open file for writing: " + std::generic_category().message(-fd);
+        }
 
-            text_t content;
-            if (file_size > 0) {
-                content.reserve(file_size);
+        std::vector<coro::Task<std::string>> write_tasks;
+        write_tasks.reserve(n_runs);
+        for (size_t i = 0; i < n_runs; ++i) {
+            write_tasks.emplace_back(write_run(fd, file_content.get(), bounds[i], bounds[i + 1], offsets[i]));
+        }
+        std::string err;
+        try {
+            auto writes_job = coro::when_all(_thread_pool, std::move(write_tasks));
+            for (const auto &run_err : co_await std::move(writes_job)) {
+                if (err.empty()) {
+                    err = run_err;
+                }
             }
+        } catch (const std::exception &e) {
+            err = std::string("Encoding failed: ") + e.what();
+        }
+        if (::close(fd) != 0 && err.empty()) {
+            err = "Failed to write file: " + std::generic_category().message(errno);
+        }
+        co_return err;
+#else
+        auto write_job = _io.write_file(std::move(target), encode_file_content(*file_content));
+        co_return co_await write_job ? std::string() : std::string("Failed to write file");
+#endif
+    }
 
-            text_t line;
-            bool first_line = true;
+    coro::Task<std::string> FileProcessor::write_run(int fd, const FileContent *file_content, size_t first,
+                                                     size_t last, uint64_t offset) {
+#ifdef __linux__
+        std::string encoded;
+        for (size_t i = first; i < last; ++i) {
+            utf8::encode(file_content->processed_pages[i], encoded);
+        }
+        if (last == file_content->processed_pages.size()) {
+            encoded += '\n';
+        }
 
-            while (std::getline(input_file, line)) {
-                if (!first_line) {
-                    content += L'\n';
+        auto write_job = _io.run([fd, offset, encoded = std::move(encoded)]() {
+            const char *p = encoded.data();
+            size_t left = encoded.size();
+            auto at = static_cast<off_t>(offset);
+            while (left > 0) {
+                const ssize_t n = ::pwrite(fd, p, left, at);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return "Failed to write file: " + std::generic_category().message(errno);
                 }
-                content += line;
-                first_line = false;
+                p += n;
+                left -= static_cast<size_t>(n);
+                at += n;
+            }
+            return std::string();
+        });
+        co_return co_await write_job;
+#else
+        (void)fd;
+        (void)file_content;
+        (void)first;
+        (void)last;
+        (void)offset;
+        co_return std::string("Positional writes are not supported on this platform");
+#endif
+    }
+
+    coro::Task<std::shared_ptr<FileContent>> FileProcessor::decode_parallel(const std::string &file_path,
+                                                                            const std::string &data, bool ascii) {
+        // Lines are joined by '\n' without the final one, which is re-added on write
+        size_t len = data.size();
+        if (len > 0 && data[len - 1] == '\n') {
+            --len;
+        }
+
+        auto file_content = std::make_shared<FileContent>(file_path, text_t());
+        auto decode_job = decode_append(std::string_view(data.data(), len), ascii, file_content->content);
+        if (!co_await std::move(decode_job)) {
+            co_return nullptr; // Only if `data` was not validated
+        }
+        co_return file_content;
+    }
+
+    coro::Task<bool> FileProcessor::decode_append(std::string_view bytes, bool ascii, text_t &dst) {
+        const size_t len = bytes.size();
+
+        // Chunk boundaries are moved forward to a lead byte, so every chunk decodes on its own
+        std::vector<size_t> bounds{0};
+        for (size_t pos = IntraFileConfig::CHUNK_SIZE; pos < len; pos += IntraFileConfig::CHUNK_SIZE) {
+            while (pos < len && (static_cast<unsigned char>(bytes[pos]) & 0xC0) == 0x80) {
+                ++pos;
+            }
+            if (pos < len) {
+                bounds.push_back(pos);
+            }
+        }
+        bounds.push_back(len);
+        const size_t n_chunks = bounds.size() - 1;
+
+        // Output offsets: prefix sum of the code points per chunk, ASCII has one per byte
+        std::vector<size_t> offsets(bounds);
+        if (!ascii) {
+            std::vector<coro::Task<size_t>> count_tasks;
+            count_tasks.reserve(n_chunks);
+            for (size_t i = 0; i < n_chunks; ++i) {
+                count_tasks.emplace_back(count_chunk(bytes.substr(bounds[i], bounds[i + 1] - bounds[i])));
+            }
+            auto count_job = coro::when_all(_thread_pool, std::move(count_tasks));
+            const auto counts = co_await std::move(count_job);
+            for (size_t i = 0; i < n_chunks; ++i) {
+                offsets[i + 1] = offsets[i] + counts[i];
+            }
+        }
+
+        const size_t base = dst.size();
+        dst.resize(base + offsets[n_chunks]);
+        wchar_t *out = dst.data() + base;
+        std::vector<coro::Task<size_t>> decode_tasks;
+        decode_tasks.reserve(n_chunks);
+        for (size_t i = 0; i < n_chunks; ++i) {
+            decode_tasks.emplace_back(decode_chunk(bytes.substr(bounds[i], bounds[i + 1] - bounds[i]), out + offsets[i]));
+        }
+        auto decode_job = coro::when_all(_thread_pool, std::move(decode_tasks));
+        const auto decoded = co_await std::move(decode_job);
+        for (size_t i = 0; i < n_chunks; ++i) {
+            if (decoded[i] != offsets[i + 1] - offsets[i]) {
+                co_return false;
+            }
+        }
+        co_return true;
+    }
+
+    std::shared_ptr<FileContent> FileProcessor::load_file_content(const std::string &file_path, const std::string &data, bool ascii) const {
+        try {
+            // Lines are joined by '\n' without the final one, which is re-added on write
+            size_t len = data.size();
+            if (len > 0 && data[len - 1] == '\n') {
+                --len;
             }
-            input_file.close();
 
-            return std::make_shared<FileContent>(file_path, content);
+            if (ascii) {
+                // Every byte is a code point, widen without the decoder
+                return std::make_shared<FileContent>(file_path, text_t(data.begin(), data.begin() + len));
+            }
+            text_t content;
+            utf8::decode(std::string_view(data.data(), len), content);
+            return std::make_shared<FileContent>(file_path, std::move(content));
 
         } catch (const std::exception &e) {
             return nullptr;
@@ -233,7 +753,7 @@ namespace punp {
                 interval_idx++; // Move to next protected interval
             } else {
                 // Create a regular page
-                size_t end_pos = std::min(start_pos + PageConfig::SIZE, content_size);
+                size_t end_pos = std::min(start_pos + _page_size, content_size);
 
                 // Ensure we don't cross into a protected region
                 if (has_protected_ahead && end_pos > next_interval->start_first) {
@@ -267,89 +787,32 @@ namespace punp {
             }
         }
 
-        fc_ptr->ref_cnt = static_cast<int>(pages.size());
         fc_ptr->processed_pages.resize(pages.size());
 
         return pages;
     }
 
-    std::pair<std::shared_ptr<FileContent>, std::vector<Page>> FileProcessor::preprocess_file(const std::string &file_path) const {
-        auto file_content = load_file_content(file_path);
-        if (file_content) {
-            // Build global protected intervals for the entire file
-            file_content->protected_interval = build_protected_intervals(file_content->content);
-
-            auto pages = create_pages(file_content);
-            return std::make_pair(file_content, std::move(pages));
-        } else {
-            return std::make_pair(nullptr, std::vector<Page>{});
+    std::vector<Page> FileProcessor::preprocess_file(std::shared_ptr<FileContent> file_content) const {
+        if (!file_content) {
+            return {};
         }
+        // Build global protected intervals for the entire file
+        file_content->protected_interval = build_protected_intervals(file_content->content);
+        return create_pages(std::move(file_content));
     }
 
-    /// Build global protected intervals for entire file content
-    /// This function scans the text and identifies all protected regions based on
-    /// start/end marker pairs. It's part of the file processing logic, not AC automaton.
+    /// Build global protected intervals for entire file content, see `next_protected_interval`
     ProtectedIntervals FileProcessor::build_protected_intervals(const text_t &text) const {
-        ProtectedIntervals intervals;
-
-        if (_protected_regions.empty() || text.empty()) {
-            return intervals;
-        }
-
-        // Single-pass scan through text
-        size_t pos = 0, text_len = text.length();
-        while (pos < text_len) {
-            // Early exit if remaining text is shorter than shortest start marker
-            if (text_len - pos < _protected_regions.front().first.length()) {
-                break;
-            }
-
-            // Try to match any start marker at current position
-            bool found_start = false;
-            const text_t *matched_start = nullptr;
-            const text_t *matched_end = nullptr;
-            size_t start_pos = pos;
-
-            for (const auto &region_ptrs : _protected_regions) {
-                const text_t &start_marker = region_ptrs.first;
-
-                if (pos + start_marker.length() <= text_len) {
-                    if (view_t(text.data() + pos, start_marker.length()) == view_t(start_marker)) {
-                        matched_start = &start_marker;
-                        matched_end = &region_ptrs.second;
-                        found_start = true;
-                        break;
-                    }
-                }
-            }
-
-            if (found_start) {
-                // Found a start marker, now search for corresponding end marker
-                size_t end_search_pos = start_pos + matched_start->length();
-                size_t end_begin = text.find(*matched_end, end_search_pos);
-
-                if (end_begin == text_t::npos) {
-                    break;
-                }
-
-                size_t end_last = end_begin + matched_end->length() - 1;
-                intervals.emplace_back(start_pos, end_last,
-                                       matched_start->length(), matched_end->length());
-                pos = end_begin + matched_end->length();
-            } else {
-                // No start marker at current position, move forward
-                ++pos;
+        ProtectedIntervals intervals = find_protected_intervals(text, _rules->protected_regions);
+        if constexpr (telemetry::ENABLED) {
+            telemetry::Tally tally;
+            tally.add(telemetry::Counter::PROTECTED_SCANS);
+            tally.add(telemetry::Counter::PROTECTED_CHARS, text.length());
+            tally.add(telemetry::Counter::PROTECTED_FOUND, intervals.size());
+            for (const auto &interval : intervals) {
+                tally.add(telemetry::Counter::PROTECTED_COVERED, interval.skip_to() - interval.start_first);
             }
         }
-
-        // Sort intervals by start position for efficient lookup
-        // Note: We don't merge overlapping intervals here because we need
-        // to preserve the exact marker positions for skipping logic
-        std::sort(intervals.begin(), intervals.end(),
-                  [](const ProtectedInterval &a, const ProtectedInterval &b) {
-                      return a.start_first < b.start_first;
-                  });
-
         return intervals;
     }
 
@@ -363,33 +826,23 @@ namespace punp {
         try {
             // Extract page content
             const auto &full_content = page.f_ptr->content;
-            result.processed_content = full_content.substr(page.start_pos, page.end_pos - page.start_pos);
-
-            // If this page is protected, just return the original content
-            if (page.is_protected) {
-                page.f_ptr->processed_pages[page.pid] = result.processed_content;
-
-                int remaining = page.f_ptr->ref_cnt.fetch_sub(1) - 1;
-                if (remaining == 0) {
-                    size_t total_reps = page.f_ptr->total_replacements.load();
-                    const_cast<FileProcessor *>(this)->notify_writeback(page.f_ptr, total_reps);
+            if (_count_only) {
+                if (!page.is_protected) {
+                    view_t content(full_content);
+                    result.n_rep = _rules->automaton.count_matches(content.substr(page.start_pos, page.end_pos - page.start_pos));
                 }
                 return result;
             }
 
-            // Apply replacements (no need to pass protected intervals anymore)
-            result.n_rep = apply_replace(result.processed_content);
-
-            page.f_ptr->total_replacements.fetch_add(result.n_rep);
+            text_t processed = full_content.substr(page.start_pos, page.end_pos - page.start_pos);
 
-            page.f_ptr->processed_pages[page.pid] = result.processed_content;
-
-            int remaining = page.f_ptr->ref_cnt.fetch_sub(1) - 1;
-            if (remaining == 0) {
-                size_t total_reps = page.f_ptr->total_replacements.load();
-                const_cast<FileProcessor *>(this)->notify_writeback(page.f_ptr, total_reps);
+            // Protected pages keep the original content
+            if (!page.is_protected) {
+                result.n_rep = apply_replace(processed);
             }
 
+            page.f_ptr->processed_pages[page.pid] = std::move(processed);
+
         } catch (const std::exception &e) {
             result.ok = false;
             result.err_msg = std::string("Page processing exception: ") + e.what();
@@ -398,103 +851,281 @@ namespace punp {
         return result;
     }
 
-    void FileProcessor::writeback_worker() {
-        while (true) {
-            std::unique_lock<std::mutex> lock(_writeback_mtx);
-
-            _writeback_cv.wait(lock, [this] {
-                return !_writeback_queue.empty() || _writeback_stop;
-            });
+    /// State of a streamed file carried between windows. The load of the next window
+    /// and the match of the current one run together, and touch disjoint members
+    struct FileProcessor::StreamState {
+        // Input side, `load_window` only
+        std::ifstream input;
+        std::string bytes;      // Undecoded input, at most one partial UTF-8 sequence between windows
+        size_t read_offset = 0; // File offset of `bytes[0]`
+        bool eof = false;
+
+        // Output side, `match_window` only
+        std::ofstream output;
+        std::string tmp_path;
+        size_t hold = 0; // Chars held back until the next window decides them
+        const ProtectedRegion *open_region = nullptr;
+        size_t n_rep = 0;
+    };
+
+    coro::Task<ProcessingResult> FileProcessor::process_large_file(std::string file_path, FileClock &clock) {
+        ProcessingResult result;
+        result.file_path = file_path;
+        result.ok = false;
+
+        StreamState state;
+        state.input.open(file_path, std::ios::binary);
+        if (!state.input) {
+            result.err_msg = "Failed to load file content";
+            co_return result;
+        }
 
-            if (_writeback_stop && _writeback_queue.empty()) {
-                break;
+        std::string target = file_path;
+        if (!_count_only && !prepare_target(file_path, target, result.err_msg)) {
+            co_return result;
+        }
+        state.tmp_path = target + StreamConfig::TMP_SUFFIX;
+        if (!_count_only) {
+            state.output.open(state.tmp_path, std::ios::binary | std::ios::trunc);
+            if (!state.output) {
+                result.err_msg = "Cannot open temp file for writing: " + state.tmp_path;
+                co_return result;
             }
+        }
 
-            // If thread pool is available and has idle threads, try to batch process
-            if (_thread_pool.has_idle_threads() && !_writeback_queue.empty()) {
-                std::vector<WritebackNotification> batch;
+        // Undecided text is held back until every match starting before it is
+        // settled and any start marker such a match could run into is complete
+        size_t max_start_len = 0;
+        for (const auto &region : _rules->protected_regions) {
+            max_start_len = std::max(max_start_len, region.first.length());
+        }
+        state.hold = _rules->automaton.max_pattern_len() + max_start_len;
 
-                // Extract up to idle_count items from queue
-                while (!_writeback_queue.empty() && batch.size() < _thread_pool.idle_threads()) {
-                    batch.emplace_back(_writeback_queue.front());
-                    _writeback_queue.pop();
+        std::string err;
+        try {
+            text_t window; // Decoded text not written yet
+            text_t next;   // Decoded while `window` is matched
+            clock.enter(FileStage::LOAD);
+            auto first_job = load_window(state, window);
+            co_await std::move(first_job);
+
+            // Window N is matched, encoded and written while window N + 1 is read and decoded
+            clock.enter(FileStage::MATCH);
+            while (true) {
+                // Same as `load_file_content`: the last newline is dropped and re-added on write
+                const bool last = state.eof;
+                if (last && !window.empty() && window.back() == L'\n') {
+                    window.pop_back();
                 }
 
-                lock.unlock();
+                std::vector<coro::Task<size_t>> steps;
+                steps.emplace_back(match_window(state, window, last));
+                if (!last) {
+                    steps.emplace_back(load_window(state, next));
+                }
+                auto steps_job = coro::when_all(_thread_pool, std::move(steps));
+                const auto done = co_await std::move(steps_job);
+                window.erase(0, done[0]);
+                if (last) {
+                    break;
+                }
+                window += next;
+                next.clear();
+            }
 
-                // Submit batch to thread pool
-                for (const auto &notification : batch) {
-                    _thread_pool.submit([this, notification]() {
-                        writeback(notification.file_content, notification.total_replacements);
-                    });
+            if (!_count_only) {
+                clock.enter(FileStage::WRITE);
+                state.output << '\n';
+                state.output.close();
+                if (!state.output) {
+                    throw std::runtime_error("write error on " + state.tmp_path);
                 }
-            } else if (!_writeback_queue.empty()) {
-                // Process single item locally
-                auto notification = _writeback_queue.front();
-                _writeback_queue.pop();
-                lock.unlock();
+            }
+        } catch (const std::exception &e) {
+            err = e.what();
+        }
+        result.n_rep = state.n_rep;
+        if (!err.empty()) {
+            std::error_code ec;
+            if (!_count_only) {
+                state.output.close();
+                fs::remove(state.tmp_path, ec);
+            }
+            result.err_msg = "Streaming failed: " + err;
+            co_return result;
+        }
+        if (_count_only) {
+            result.ok = true;
+            co_return result;
+        }
 
-                writeback(notification.file_content, notification.total_replacements);
+        std::error_code ec;
+        if (result.n_rep == 0) {
+            fs::remove(state.tmp_path, ec);
+            if (target != file_path && _mirror_unchanged && !link_unchanged(file_path, target, result.err_msg)) {
+                co_return result;
+            }
+        } else {
+            fs::permissions(state.tmp_path, fs::status(file_path, ec).permissions(), ec);
+            fs::rename(state.tmp_path, target, ec);
+            if (ec) {
+                fs::remove(state.tmp_path);
+                result.err_msg = "Cannot replace file: " + ec.message();
+                co_return result;
             }
         }
+
+        result.ok = true;
+        co_return result;
+    }
+
+    coro::Task<size_t> FileProcessor::load_window(StreamState &state, text_t &dst) {
+        auto read_job = _io.run([&state]() {
+            const size_t have = state.bytes.size();
+            state.bytes.resize(have + StreamConfig::CHUNK_SIZE);
+            state.input.read(state.bytes.data() + have, static_cast<std::streamsize>(StreamConfig::CHUNK_SIZE));
+            state.bytes.resize(have + static_cast<size_t>(state.input.gcount()));
+            state.eof = state.input.eof();
+            return !state.input.bad();
+        });
+        if (!co_await read_job) {
+            throw std::runtime_error("read error");
+        }
+
+        const size_t complete = state.eof ? state.bytes.size() : utf8_complete_prefix(state.bytes);
+        const std::string_view chunk(state.bytes.data(), complete);
+        // Every window is checked for NUL bytes too, a binary tail is caught where it starts
+        const auto chunk_scan = utf8::scan(chunk);
+        if (chunk_scan.kind == utf8::TextKind::BINARY) {
+            throw std::runtime_error("binary file, skipped at byte offset " + std::to_string(state.read_offset));
+        }
+        if (chunk_scan.kind == utf8::TextKind::INVALID) {
+            throw std::runtime_error("invalid UTF-8 at byte offset " +
+                                     std::to_string(state.read_offset + chunk_scan.error_offset));
+        }
+
+        const size_t before = dst.size();
+        auto decode_job = decode_append(chunk, chunk_scan.kind == utf8::TextKind::ASCII, dst);
+        if (!co_await std::move(decode_job)) {
+            throw std::runtime_error("invalid UTF-8 at byte offset " + std::to_string(state.read_offset));
+        }
+        state.bytes.erase(0, complete);
+        state.read_offset += complete;
+        co_return dst.size() - before;
     }
 
-    void FileProcessor::notify_writeback(std::shared_ptr<FileContent> file_content, size_t replacements) {
-        std::lock_guard<std::mutex> lock(_writeback_mtx);
-        _writeback_queue.emplace(file_content, replacements);
-        _writeback_cv.notify_one();
+    coro::Task<size_t> FileProcessor::match_window(StreamState &state, const text_t &window, bool eof) {
+        text_t out;
+        const size_t consumed = process_window(window, eof, state.hold, state.open_region, out, state.n_rep);
+        if (_count_only || out.empty()) {
+            co_return consumed;
+        }
+
+        // Encoded in parallel runs, written in order
+        const view_t text(out);
+        std::vector<coro::Task<std::string>> encode_tasks;
+        for (size_t pos = 0; pos < text.length(); pos += IntraFileConfig::CHUNK_SIZE) {
+            encode_tasks.emplace_back(encode_chunk(text.substr(pos, IntraFileConfig::CHUNK_SIZE)));
+        }
+        auto encode_job = coro::when_all(_thread_pool, std::move(encode_tasks));
+        const auto encoded = co_await std::move(encode_job);
+
+        auto write_job = _io.run([&state, &encoded]() {
+            for (const auto &run : encoded) {
+                state.output.write(run.data(), static_cast<std::streamsize>(run.size()));
+            }
+            return static_cast<bool>(state.output);
+        });
+        if (!co_await write_job) {
+            throw std::runtime_error("write error on " + state.tmp_path);
+        }
+        co_return consumed;
     }
 
-    bool FileProcessor::writeback(const std::shared_ptr<FileContent> &file_content, size_t total_replacements) const {
-        try {
-            if (total_replacements == 0) {
-                return true;
+    /// Process as much of `window` as can be decided, returning the consumed length
+    ///
+    /// Protected regions are tracked across windows via `open_region`. Unlike the
+    /// in-memory path, a start marker whose end marker never shows up protects the
+    /// rest of the file, since finding that out would need unbounded buffering.
+    size_t FileProcessor::process_window(const text_t &window, bool eof, size_t hold,
+                                         const ProtectedRegion *&open_region, text_t &out, size_t &n_rep) const {
+        const view_t text(window);
+        const size_t len = text.length();
+        size_t pos = 0;
+
+        // `--count` takes the counting scan and builds no output
+        auto copy = [this, &out](view_t part) {
+            if (!_count_only) {
+                out.append(part);
+            }
+        };
+        auto match = [this, &out](view_t part, size_t limit, size_t &resume) {
+            if (_count_only) {
+                return _rules->automaton.count_matches(part, limit, resume);
             }
+            return _rules->automaton.apply_replace(part, limit, out, resume);
+        };
 
-            std::wofstream output_file(file_content->filename);
-            if (!output_file) {
-                error("Cannot open file for writing: ", file_content->filename);
-                return false;
+        while (true) {
+            if (open_region) {
+                const text_t &end_marker = open_region->second;
+                size_t end_begin = window.find(end_marker, pos);
+                if (end_begin != text_t::npos) {
+                    size_t end = end_begin + end_marker.length();
+                    copy(text.substr(pos, end - pos));
+                    pos = end;
+                    open_region = nullptr;
+                    continue;
+                }
+
+                // Keep what could be the beginning of the end marker
+                size_t keep = (eof || end_marker.empty()) ? 0 : std::min(len - pos, end_marker.length() - 1);
+                copy(text.substr(pos, len - keep - pos));
+                return len - keep;
             }
 
-            output_file.imbue(std::locale(std::locale(), new char_convert_t));
-            for (const auto &page_content : file_content->processed_pages) {
-                output_file << page_content;
+            size_t safe = eof ? len : (len > hold ? len - hold : 0);
+            if (pos >= safe) {
+                return pos;
             }
-            output_file << '\n';
-            output_file.close();
 
-            return true;
+            const ProtectedRegion *region = nullptr;
+            size_t marker = find_start_marker(text, pos, region);
+            size_t resume = 0;
+            if (marker < safe) {
+                // Like a page, the text before the region is matched on its own
+                n_rep += match(text.substr(pos, marker - pos), marker - pos, resume);
+                copy(region->first);
+                pos = marker + region->first.length();
+                open_region = region;
+                continue;
+            }
 
-        } catch (const std::exception &e) {
-            error("Writing file ", file_content->filename, ": ", e.what());
-            return false;
+            size_t end = (marker == text_t::npos) ? len : marker;
+            n_rep += match(text.substr(pos, end - pos), safe - pos, resume);
+            pos += resume;
         }
     }
 
-    size_t FileProcessor::apply_replace(text_t &text) const {
-        return _ac_automaton.apply_replace(text);
-    }
-
-    bool FileProcessor::is_text_file(const std::string &filePath) const {
-        std::ifstream file(filePath, std::ios::binary);
-        if (!file) {
-            return false;
+    size_t FileProcessor::find_start_marker(view_t text, size_t pos, const ProtectedRegion *&region) const {
+        if (_rules->protected_regions.empty()) {
+            return text_t::npos;
         }
 
-        // Read first 1KB to check for binary content
-        constexpr size_t sample_size = 1024;
-        std::vector<char> buffer(sample_size);
-        file.read(buffer.data(), sample_size);
-
-        size_t bytes_read = static_cast<size_t>(file.gcount());
-        file.close();
-
-        // Check for null bytes (common in binary files)
-        size_t null_bytes = std::count(buffer.begin(), buffer.begin() + bytes_read, '\0');
+        for (; pos < text.length(); ++pos) {
+            for (const auto &candidate : _rules->protected_regions) {
+                const text_t &start_marker = candidate.first;
+                if (!start_marker.empty() && text.substr(pos, start_marker.length()) == view_t(start_marker)) {
+                    region = &candidate;
+                    return pos;
+                }
+            }
+        }
+        return text_t::npos;
+    }
 
-        // If more than 1% null bytes, likely binary
-        return (null_bytes * 100 / std::max(bytes_read, size_t(1))) < 1;
+    size_t FileProcessor::apply_replace(text_t &text) const {
+        return _rules->automaton.apply_replace(text);
     }
 
-} // namespace punp << std::endl
+} // namespace punp
@@ -1,14 +1,23 @@
 #pragma once
 
 #include "algorithm/ac_automaton.h"
+#include "base/common.h"
+#include "base/coro/task.h"
 #include "base/thread_pool/thread_pool.h"
 #include "base/types.h"
+#include "core/async_io.h"
+#include "core/progress.h"
 
+#include <array>
 #include <atomic>
-#include <condition_variable>
-#include <queue>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
-#include <thread>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 
 namespace punp {
@@ -17,43 +26,137 @@ namespace punp {
 
     class FileProcessor {
     public:
-        explicit FileProcessor(const ConfigManager &config_manager);
+        // Everything matching depends on, built once and shared by processors with the same rules
+        struct Rules {
+            ACAutomaton automaton;               // Pattern matching engine
+            ProtectedRegions protected_regions; // Protected region rules (start/end markers)
+        };
+        static std::shared_ptr<const Rules> build_rules(const ConfigManager &config_manager,
+                                                        bool minimize_automaton = false);
+
+        explicit FileProcessor(const ConfigManager &config_manager, bool minimize_automaton = false);
+        explicit FileProcessor(std::shared_ptr<const Rules> rules);
         ~FileProcessor();
 
         std::vector<ProcessingResult> process_files(const FileProcessorConfig &config);
 
-    private:
-        ACAutomaton _ac_automaton;           // Pattern matching engine
-        ThreadPool _thread_pool;             // Thread pool for parallel processing
-        ProtectedRegions _protected_regions; // Protected region rules (start/end markers)
+        // Run later `process_files` calls with other rules, the pools are kept
+        void set_rules(std::shared_ptr<const Rules> rules) noexcept { _rules = std::move(rules); }
+
+        const ACAutomaton &automaton() const noexcept { return _rules->automaton; }
 
-        std::queue<WritebackNotification> _writeback_queue;
-        std::mutex _writeback_mtx;
-        std::condition_variable _writeback_cv;
-        std::atomic<bool> _writeback_stop{false};
-        std::thread _writeback_thread;
+        // Effective settings `process_files` runs `config` with
+        static size_t worker_threads(const FileProcessorConfig &config, size_t num_files);
+        static uint64_t memory_budget(const FileProcessorConfig &config);
+        static size_t stream_threshold(const FileProcessorConfig &config);
+
+    private:
+        /// Stage clock of one in-flight file, also read by the slow-file watchdog
+        class FileClock {
+        public:
+            using clock_type = std::chrono::steady_clock;
+
+            explicit FileClock(std::string path)
+                : _path(std::move(path)), _start(clock_type::now()), _stage_start(_start) {}
+
+            // Close the current stage and start `next`
+            void enter(FileStage next);
+            // Close the current stage and store the timings in `result`
+            void finish(ProcessingResult &result);
+
+            const std::string &path() const noexcept { return _path; }
+            clock_type::time_point start() const noexcept { return _start; }
+            FileStage stage() const noexcept { return _stage.load(std::memory_order_relaxed); }
+
+            bool reported = false; // Watchdog only, under `_active_mtx`
+            uint64_t bytes = 0;    // Size once loaded, counted in flight until the file is done
+
+        private:
+            std::string _path;
+            clock_type::time_point _start;
+            clock_type::time_point _stage_start;
+            std::atomic<FileStage> _stage{FileStage::LOAD};
+            std::array<uint64_t, FILE_STAGE_COUNT> _stage_us{};
+        };
+
+        std::shared_ptr<const Rules> _rules; // Automaton and protected regions
+        ThreadPool _thread_pool;             // Thread pool for the CPU stages
+        AsyncIo _io;                         // Awaitable file I/O on its own pool
+        std::shared_ptr<FileCache> _file_cache; // Contents already read during discovery
+        bool _count_only = false;               // Count matches, leave files untouched
+        size_t _page_size = PageConfig::SIZE;   // Chars per page
+        size_t _memory_limit = 0;               // Bytes all files in flight may take together
+        std::filesystem::path _output_dir;      // Mirror root, empty when writing in place
+        std::filesystem::path _output_base;     // Inputs are mirrored relative to this directory
+        bool _mirror_unchanged = true;          // Files without replacements are linked into the mirror
+
+        std::mutex _active_mtx;
+        std::unordered_set<FileClock *> _active; // Files in flight, for the watchdog
+        ProgressCounters _progress;              // Of the current run, for the ticker
+
+        // Warn once about every in-flight file running longer than `threshold`
+        void report_slow_files(std::chrono::milliseconds threshold);
+
+        // Move the cached contents of `file_path` out of the cache, if present
+        std::optional<std::string> take_cached(const std::string &file_path);
 
         size_t apply_replace(text_t &text) const;
-        bool is_text_file(const std::string &file_path) const;
 
         // Build global protected intervals for entire file content
         ProtectedIntervals build_protected_intervals(const text_t &text) const;
 
-        // Load file content into FileContent structure
-        std::shared_ptr<FileContent> load_file_content(const std::string &file_path) const;
+        // Decode raw file bytes (already validated by `utf8::scan`) into a FileContent structure
+        std::shared_ptr<FileContent> load_file_content(const std::string &file_path, const std::string &data, bool ascii) const;
 
         // Create pages from file content
         std::vector<Page> create_pages(std::shared_ptr<FileContent> file_content) const;
 
-        // Pre-process: load file + create pages
-        std::pair<std::shared_ptr<FileContent>, std::vector<Page>> preprocess_file(const std::string &file_path) const;
+        // Decode a big file in chunks split at character boundaries, counted in parallel
+        // and then decoded in parallel into place at their prefix-sum offsets
+        coro::Task<std::shared_ptr<FileContent>> decode_parallel(const std::string &file_path, const std::string &data, bool ascii);
+        // Same for validated `bytes` appended to `dst`, false if they turn out malformed
+        coro::Task<bool> decode_append(std::string_view bytes, bool ascii, text_t &dst);
+
+        // Pre-process decoded content: build protected intervals + create pages
+        std::vector<Page> preprocess_file(std::shared_ptr<FileContent> file_content) const;
 
         // Process a single page
         PageResult process_page(const Page &page) const;
 
-        void notify_writeback(std::shared_ptr<FileContent> file_content, size_t replacements);
-        void writeback_worker();
-        bool writeback(const std::shared_ptr<FileContent> &file_content, size_t total_replacements) const;
+        // Pipeline per file: load -> pages in parallel -> write
+        coro::Task<ProcessingResult> process_file(std::string file_path, size_t stream_threshold,
+                                                  coro::AsyncSemaphore &inflight, coro::AsyncSemaphore &memory);
+        coro::Task<PageResult> page_task(Page page) const;
+        coro::Task<ProcessingResult> run_pipeline(const std::string &file_path, size_t stream_threshold, FileClock &clock);
+
+        // Where the output of `file_path` goes: the file itself, or its mirror under `_output_dir`
+        // with the parent directories created and any old file (maybe a hardlink) removed
+        bool prepare_target(const std::string &file_path, std::string &target, std::string &err) const;
+        // Mirror a file without replacements: hardlink, else reflink, else copy
+        bool link_unchanged(const std::string &file_path, const std::string &target, std::string &err) const;
+
+        // Encode processed pages back to UTF-8
+        std::string encode_file_content(const FileContent &file_content) const;
+
+        // Write the processed pages of a big file without a whole-file buffer: runs of pages
+        // are encoded in parallel and each lands with `pwrite` at its prefix-sum offset
+        coro::Task<std::string> write_parallel(std::string target, std::shared_ptr<const FileContent> file_content);
+        coro::Task<std::string> write_run(int fd, const FileContent *file_content, size_t first, size_t last,
+                                          uint64_t offset);
+
+        // Bounded-memory path for files above the stream threshold: the file is read in
+        // fixed-size windows and the output goes to a sibling temp file renamed at the end.
+        // Each window is decoded and encoded in parallel chunks, and the next one is loaded
+        // while the current one is matched
+        struct StreamState;
+        coro::Task<ProcessingResult> process_large_file(std::string file_path, FileClock &clock);
+        // Read, validate and decode the next window into `dst`, returning the chars added
+        coro::Task<size_t> load_window(StreamState &state, text_t &dst);
+        // Match `window` and write out what it decides, returning the consumed length
+        coro::Task<size_t> match_window(StreamState &state, const text_t &window, bool eof);
+        size_t process_window(const text_t &window, bool eof, size_t hold,
+                              const ProtectedRegion *&open_region, text_t &out, size_t &n_rep) const;
+        size_t find_start_marker(view_t text, size_t pos, const ProtectedRegion *&region) const;
     };
 
 } // namespace punp
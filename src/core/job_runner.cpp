@@ -0,0 +1,306 @@
+#include "core/job_runner.h"
+
+#include "base/color_print.h"
+#include "config/config_manager.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace punp {
+
+    namespace {
+        // Optional members of a job; absent leaves `out` as is, a wrong type is an error
+        bool get_string(const json::Value &job, const char *key, std::string &out, std::string &err) {
+            const json::Value &value = job[key];
+            if (value.is_null()) {
+                return true;
+            }
+            if (!value.is_string()) {
+                err = std::string("\"") + key + "\" must be a string";
+                return false;
+            }
+            out = value.as_string();
+            return true;
+        }
+
+        bool get_bool(const json::Value &job, const char *key, bool &out, std::string &err) {
+            const json::Value &value = job[key];
+            if (value.is_null()) {
+                return true;
+            }
+            if (!value.is_bool()) {
+                err = std::string("\"") + key + "\" must be true or false";
+                return false;
+            }
+            out = value.as_bool();
+            return true;
+        }
+
+        // A string or an array of strings, replacing `out`
+        bool get_strings(const json::Value &job, const char *key, std::vector<std::string> &out, std::string &err) {
+            const json::Value &value = job[key];
+            if (value.is_null()) {
+                return true;
+            }
+            if (value.is_string()) {
+                out = {value.as_string()};
+                return true;
+            }
+            if (value.is_array()) {
+                std::vector<std::string> strings;
+                for (const auto &item : value.as_array()) {
+                    if (!item.is_string()) {
+                        break;
+                    }
+                    strings.push_back(item.as_string());
+                }
+                if (strings.size() == value.as_array().size()) {
+                    out = std::move(strings);
+                    return true;
+                }
+            }
+            err = std::string("\"") + key + "\" must be a string or an array of strings";
+            return false;
+        }
+
+        bool same_rules(const ConfigManager &a, const ConfigManager &b) {
+            return *a.replacement_map() == *b.replacement_map() && *a.fold_map() == *b.fold_map() &&
+                   *a.range_rules() == *b.range_rules() && *a.protected_regions() == *b.protected_regions();
+        }
+
+        bool same_sources(const RuleConfig &a, const RuleConfig &b) {
+            return a.ignore_global_rule_file == b.ignore_global_rule_file && a.rule_file_path == b.rule_file_path &&
+                   a.console_rule == b.console_rule;
+        }
+    } // namespace
+
+    JobRunner::JobRunner(const ProcessingConfig &defaults, bool verbose, bool dry_run)
+        : _defaults(defaults), _verbose(verbose), _dry_run(dry_run) {
+        _defaults.finder_config.patterns.clear(); // Every job brings its own
+    }
+
+    int JobRunner::run(const std::string &manifest_path) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        std::vector<Job> jobs;
+        if (!parse_manifest(manifest_path, jobs)) {
+            return 1;
+        }
+
+        size_t n_ok = 0;
+        size_t n_rep_total = 0;
+        for (const auto &job : jobs) {
+            size_t n_rep = 0;
+            if (run_job(job, n_rep)) {
+                n_ok++;
+            }
+            n_rep_total += n_rep;
+        }
+        if (_dry_run) {
+            return n_ok == jobs.size() ? 0 : 1;
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+        println_green("All jobs complete:");
+        println_blue("  Jobs succeeded: ", n_ok, "/", jobs.size());
+        const size_t n_sources = std::count_if(_loaded.begin(), _loaded.end(),
+                                               [](const LoadedRules &entry) { return entry.config_manager != nullptr; });
+        println_blue("  Automata built: ", _built.size(), " for ", n_sources, " rule sources");
+        println_blue("  Total replacements: ", n_rep_total);
+        println_blue("  Time taken: ", duration.count(), " ms");
+        return n_ok == jobs.size() ? 0 : 1;
+    }
+
+    // NOTE: the manifest is `{"jobs": [...]}` or the bare array, every job an object:
+    //   name, rule_file, console, ignore_global_rule_file, patterns, recursive, extension,
+    //   exclude, hidden, enable_latex_jumping, count, output_dir, minimize_automaton
+    bool JobRunner::parse_manifest(const std::string &manifest_path, std::vector<Job> &jobs) const {
+        std::ifstream file(manifest_path, std::ios::binary);
+        if (!file) {
+            error("Cannot read job manifest: ", manifest_path);
+            return false;
+        }
+        std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        std::string err;
+        auto manifest = json::Value::parse(text, err);
+        if (!manifest) {
+            error("Invalid job manifest ", manifest_path, ": ", err);
+            return false;
+        }
+        const json::Value &list = manifest->is_array() ? *manifest : (*manifest)["jobs"];
+        if (!list.is_array() || list.as_array().empty()) {
+            error("Job manifest ", manifest_path, " has no jobs, expected {\"jobs\": [...]}");
+            return false;
+        }
+
+        for (size_t i = 0; i < list.as_array().size(); ++i) {
+            Job job;
+            if (!parse_job(list.as_array()[i], i, job, err)) {
+                error("Job ", i + 1, " in ", manifest_path, ": ", err);
+                return false;
+            }
+            jobs.push_back(std::move(job));
+        }
+        return true;
+    }
+
+    bool JobRunner::parse_job(const json::Value &value, size_t index, Job &job, std::string &err) const {
+        if (!value.is_object()) {
+            err = "must be an object";
+            return false;
+        }
+        static const char *const KEYS[] = {
+            "name", "rule_file", "console", "ignore_global_rule_file", "patterns", "recursive", "extension",
+            "exclude", "hidden", "enable_latex_jumping", "count", "output_dir", "minimize_automaton",
+        };
+        for (const auto &[key, member] : value.as_object()) {
+            if (std::find(std::begin(KEYS), std::end(KEYS), key) == std::end(KEYS)) {
+                err = "unknown option \"" + key + "\"";
+                return false;
+            }
+        }
+
+        job.name = "#" + std::to_string(index + 1);
+        job.config = _defaults;
+        auto &rule_config = job.config.rule_config;
+        auto &finder_config = job.config.finder_config;
+        auto &processor_config = job.config.processor_config;
+        std::vector<std::string> excludes;
+        if (!get_string(value, "name", job.name, err) ||
+            !get_string(value, "rule_file", rule_config.rule_file_path, err) ||
+            !get_string(value, "console", rule_config.console_rule, err) ||
+            !get_bool(value, "ignore_global_rule_file", rule_config.ignore_global_rule_file, err) ||
+            !get_strings(value, "patterns", finder_config.patterns, err) ||
+            !get_bool(value, "recursive", finder_config.recursive, err) ||
+            !get_strings(value, "extension", finder_config.extensions, err) ||
+            !get_strings(value, "exclude", excludes, err) ||
+            !get_bool(value, "hidden", finder_config.process_hidden, err) ||
+            !get_bool(value, "enable_latex_jumping", finder_config.enable_latex_jumping, err) ||
+            !get_bool(value, "count", processor_config.count_only, err) ||
+            !get_string(value, "output_dir", processor_config.output_dir, err) ||
+            !get_bool(value, "minimize_automaton", processor_config.minimize_automaton, err)) {
+            return false;
+        }
+        if (finder_config.patterns.empty()) {
+            err = "\"patterns\" is required";
+            return false;
+        }
+
+        // Same handling as the command line options
+        for (auto &ext : finder_config.extensions) {
+            if (!ext.empty() && ext.front() == '.') {
+                ext = ext.substr(1);
+            }
+        }
+        finder_config.exclude_paths.insert(finder_config.exclude_paths.end(), excludes.begin(), excludes.end());
+        if (value.contains("output_dir")) {
+            finder_config.exclude_paths.emplace_back(
+                std::filesystem::absolute(processor_config.output_dir).lexically_normal().string());
+        }
+        return true;
+    }
+
+    std::shared_ptr<const FileProcessor::Rules> JobRunner::rules_for(const ProcessingConfig &config) {
+        // Parse each set of rule sources once
+        auto loaded = std::find_if(_loaded.begin(), _loaded.end(), [&config](const LoadedRules &entry) {
+            return same_sources(entry.rule_config, config.rule_config);
+        });
+        if (loaded == _loaded.end()) {
+            auto config_manager = std::make_shared<ConfigManager>();
+            bool ok = config_manager->load(config.rule_config, _verbose);
+            if (!ok) {
+                error("Failed to load configuration");
+            } else if (config_manager->empty()) {
+                error("No replacement rules found in configuration");
+                ok = false;
+            }
+            _loaded.push_back({config.rule_config, ok ? std::move(config_manager) : nullptr});
+            loaded = std::prev(_loaded.end());
+        }
+        if (!loaded->config_manager) {
+            return nullptr;
+        }
+
+        // Different sources may still end up with the same rules
+        const bool minimize = config.processor_config.minimize_automaton;
+        for (const auto &built : _built) {
+            if (built.minimize_automaton == minimize &&
+                (built.config_manager == loaded->config_manager ||
+                 same_rules(*built.config_manager, *loaded->config_manager))) {
+                if (_verbose) {
+                    println_blue("Reusing the automaton of identical rules");
+                }
+                return built.rules;
+            }
+        }
+        auto rules = FileProcessor::build_rules(*loaded->config_manager, minimize);
+        _built.push_back({loaded->config_manager, minimize, rules});
+        return rules;
+    }
+
+    bool JobRunner::run_job(const Job &job, size_t &n_rep) {
+        auto start = std::chrono::high_resolution_clock::now();
+        println_green("Job ", job.name, ":");
+
+        auto rules = rules_for(job.config);
+        if (!rules) {
+            error("Job ", job.name, " skipped");
+            return false;
+        }
+
+        auto file_cache = std::make_shared<FileCache>();
+        auto file_paths = _finder.find_files(job.config.finder_config, file_cache.get());
+        if (file_paths.empty()) {
+            error("No files found to process");
+            return false;
+        }
+
+        if (_dry_run) {
+            println_yellow("These files will be processed (dry run, no changes will be made):");
+            for (const auto &file : file_paths) {
+                println("  ", file);
+            }
+            return true;
+        }
+
+        FileProcessorConfig processor_config = job.config.processor_config;
+        processor_config.file_paths = std::move(file_paths);
+        processor_config.file_cache = std::move(file_cache);
+        if (!_processor) {
+            _processor = std::make_unique<FileProcessor>(rules);
+        } else {
+            _processor->set_rules(rules);
+        }
+        auto results = _processor->process_files(processor_config);
+
+        size_t n_ok = 0;
+        for (const auto &result : results) {
+            if (result.ok) {
+                n_ok++;
+                n_rep += result.n_rep;
+                if (_verbose) {
+                    println_blue("- Processed: ", result.file_path);
+                    if (result.n_rep > 0) {
+                        println_blue(" (", result.n_rep, " replacements)");
+                    }
+                }
+            } else {
+                error("Failed to process ", result.file_path, ": ", result.err_msg);
+            }
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+        println_blue("  Files processed: ", n_ok, "/", results.size());
+        println_blue("  Replacements: ", n_rep, processor_config.count_only ? " (count only)" : "");
+        println_blue("  Time taken: ", duration.count(), " ms");
+        return n_ok == results.size();
+    }
+
+} // namespace punp
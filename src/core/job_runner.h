@@ -0,0 +1,66 @@
+#pragma once
+
+#include "base/json/json.h"
+#include "base/types.h"
+#include "core/file_finder.h"
+#include "core/file_processor.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace punp {
+
+    class ConfigManager;
+
+    /// `--jobs`: run the jobs of a JSON manifest in one process.
+    ///
+    /// Every job names its rule sources, patterns and options, on top of the options
+    /// given on the command line. Jobs run one after another on a single processor,
+    /// so the thread pools are created once. Rules are loaded once per distinct set
+    /// of rule sources, jobs ending up with identical rules share one automaton, and
+    /// directory listings are reused between jobs while a directory is unchanged.
+    class JobRunner {
+    public:
+        JobRunner(const ProcessingConfig &defaults, bool verbose, bool dry_run);
+        ~JobRunner() = default;
+
+        // Run every job of the manifest at `manifest_path`, returns the process exit code
+        int run(const std::string &manifest_path);
+
+    private:
+        struct Job {
+            std::string name;
+            ProcessingConfig config;
+        };
+
+        // Rules loaded from one set of rule sources
+        struct LoadedRules {
+            RuleConfig rule_config;
+            std::shared_ptr<const ConfigManager> config_manager; // Null if loading failed
+        };
+
+        // Automaton built for one set of rules
+        struct BuiltRules {
+            std::shared_ptr<const ConfigManager> config_manager;
+            bool minimize_automaton = false;
+            std::shared_ptr<const FileProcessor::Rules> rules;
+        };
+
+        ProcessingConfig _defaults;
+        bool _verbose = false;
+        bool _dry_run = false;
+        FileFinder _finder{true};
+        std::unique_ptr<FileProcessor> _processor; // Created with the first job's rules
+        std::vector<LoadedRules> _loaded;
+        std::vector<BuiltRules> _built;
+
+        bool parse_manifest(const std::string &manifest_path, std::vector<Job> &jobs) const;
+        bool parse_job(const json::Value &value, size_t index, Job &job, std::string &err) const;
+
+        // Rules of `config`, loaded and built on first use; null if they cannot be loaded
+        std::shared_ptr<const FileProcessor::Rules> rules_for(const ProcessingConfig &config);
+        bool run_job(const Job &job, size_t &n_rep);
+    };
+
+} // namespace punp
@@ -0,0 +1,140 @@
+#include "core/progress.h"
+
+#include "base/color_print.h"
+#include "base/common.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace punp {
+
+    namespace {
+        volatile std::sig_atomic_t run_active = 0;
+        volatile std::sig_atomic_t dump_requested = 0;
+
+        void on_stats_signal(int) {
+            if (run_active) {
+                dump_requested = 1; // Picked up by the ticker
+                return;
+            }
+#ifndef _WIN32
+            // Only async-signal-safe calls here
+            static const char MESSAGE[] = "Stats: no run in progress\n";
+            [[maybe_unused]] ssize_t n = ::write(STDERR_FILENO, MESSAGE, sizeof(MESSAGE) - 1);
+#endif
+        }
+
+        std::string format_bytes(double bytes) {
+            static const char *const UNITS[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+            size_t unit = 0;
+            while (bytes >= 1024 && unit + 1 < std::size(UNITS)) {
+                bytes /= 1024;
+                unit++;
+            }
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), unit ? "%.1f %s" : "%.0f %s", bytes, UNITS[unit]);
+            return buf;
+        }
+
+        std::string format_duration(uint64_t seconds) {
+            char buf[32];
+            if (seconds >= 3600) {
+                std::snprintf(buf, sizeof(buf), "%lluh%02llum", static_cast<unsigned long long>(seconds / 3600),
+                              static_cast<unsigned long long>(seconds % 3600 / 60));
+            } else if (seconds >= 60) {
+                std::snprintf(buf, sizeof(buf), "%llum%02llus", static_cast<unsigned long long>(seconds / 60),
+                              static_cast<unsigned long long>(seconds % 60));
+            } else {
+                std::snprintf(buf, sizeof(buf), "%llus", static_cast<unsigned long long>(seconds));
+            }
+            return buf;
+        }
+    } // namespace
+
+    void install_stats_signal() {
+#ifdef SIGUSR1
+        std::signal(SIGUSR1, on_stats_signal);
+#endif
+    }
+
+    void ProgressCounters::reset(size_t num_files) {
+        files_total.store(num_files, std::memory_order_relaxed);
+        files_done.store(0, std::memory_order_relaxed);
+        files_failed.store(0, std::memory_order_relaxed);
+        bytes_done.store(0, std::memory_order_relaxed);
+        bytes_inflight.store(0, std::memory_order_relaxed);
+        n_rep.store(0, std::memory_order_relaxed);
+    }
+
+    ProgressTicker::ProgressTicker(const ProgressCounters &counters, bool show_line)
+        : _counters(counters),
+          _show_line(show_line && is_terminal(std::cout)),
+          _start(std::chrono::steady_clock::now()) {
+        dump_requested = 0;
+        run_active = 1;
+        _thread = std::thread(&ProgressTicker::run, this);
+    }
+
+    ProgressTicker::~ProgressTicker() {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _done = true;
+        }
+        _cv.notify_one();
+        _thread.join();
+        run_active = 0;
+    }
+
+    void ProgressTicker::run() {
+        const std::chrono::milliseconds tick(ProgressConfig::TICK_MS);
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (!_cv.wait_for(lock, tick, [this]() { return _done; })) {
+            if (dump_requested) {
+                dump_requested = 0;
+                colored_println_err(Colors::CYAN, "Stats: ", snapshot());
+            }
+            if (_show_line) {
+                print("\r", snapshot(), "\033[K");
+            }
+        }
+        if (_show_line) {
+            print("\r\033[K"); // The summary follows on a clean line
+        }
+    }
+
+    std::string ProgressTicker::snapshot() const {
+        const size_t total = _counters.files_total.load(std::memory_order_relaxed);
+        const size_t done = _counters.files_done.load(std::memory_order_relaxed);
+        const size_t failed = _counters.files_failed.load(std::memory_order_relaxed);
+        const uint64_t bytes = _counters.bytes_done.load(std::memory_order_relaxed);
+        const uint64_t inflight = _counters.bytes_inflight.load(std::memory_order_relaxed);
+        const uint64_t n_rep = _counters.n_rep.load(std::memory_order_relaxed);
+
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+        std::string line = std::to_string(done) + "/" + std::to_string(total) + " files";
+        if (failed) {
+            line += " (" + std::to_string(failed) + " failed)";
+        }
+        line += ", " + format_bytes(static_cast<double>(bytes));
+        if (elapsed > 0) {
+            char rate[32];
+            std::snprintf(rate, sizeof(rate), "%.1f", static_cast<double>(bytes) / (1000.0 * 1000.0) / elapsed);
+            line += std::string(", ") + rate + " MB/s";
+        }
+        line += ", " + format_bytes(static_cast<double>(inflight)) + " in flight";
+        line += ", " + std::to_string(n_rep) + " replacements";
+        line += ", elapsed " + format_duration(static_cast<uint64_t>(elapsed));
+        // Files vary in size, the ETA assumes the rest take as long on average as those done
+        if (done > 0 && done < total) {
+            line += ", ETA " + format_duration(static_cast<uint64_t>(elapsed * static_cast<double>(total - done) / done));
+        }
+        return line;
+    }
+
+} // namespace punp
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace punp {
+
+    // Handle SIGUSR1 for the life of the process: during a run the ticker dumps the stats,
+    // outside one the handler only says so on stderr. Without it the signal would kill
+    // the process
+    void install_stats_signal();
+
+    /// Counters of one `process_files` run. File tasks update them with relaxed
+    /// atomics, once when a file is loaded and once when it is done; only the
+    /// ticker reads them, so they add no synchronization to the pipeline.
+    struct ProgressCounters {
+        std::atomic<size_t> files_total{0};
+        std::atomic<size_t> files_done{0};
+        std::atomic<size_t> files_failed{0};
+        std::atomic<uint64_t> bytes_done{0};
+        std::atomic<uint64_t> bytes_inflight{0}; // Files loaded and not done yet
+        std::atomic<uint64_t> n_rep{0};
+
+        void reset(size_t num_files);
+    };
+
+    /// Low-rate reporter of a run, on its own thread from construction to destruction.
+    ///
+    /// Redraws a progress line (files, throughput, ETA, bytes in flight) on stdout when
+    /// asked to and stdout is a terminal, and dumps the same snapshot to stderr when the
+    /// process receives SIGUSR1, see `install_stats_signal`.
+    class ProgressTicker {
+    public:
+        ProgressTicker(const ProgressCounters &counters, bool show_line);
+        ~ProgressTicker();
+        ProgressTicker(const ProgressTicker &) = delete;
+        ProgressTicker &operator=(const ProgressTicker &) = delete;
+
+    private:
+        const ProgressCounters &_counters;
+        bool _show_line = false;
+        std::chrono::steady_clock::time_point _start;
+        std::mutex _mtx;
+        std::condition_variable _cv;
+        bool _done = false;
+        std::thread _thread;
+
+        void run();
+        // The counters right now, on one line
+        std::string snapshot() const;
+    };
+
+} // namespace punp
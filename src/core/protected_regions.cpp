@@ -0,0 +1,54 @@
+#include "core/protected_regions.h"
+
+#include <algorithm>
+
+namespace punp {
+
+    std::optional<ProtectedInterval> next_protected_interval(view_t text, size_t &pos, size_t limit,
+                                                             const ProtectedRegions &regions, bool &open) {
+        open = false;
+        const size_t text_len = text.length();
+        limit = std::min(limit, text_len);
+        if (regions.empty()) {
+            pos = text_len;
+            return std::nullopt;
+        }
+
+        for (; pos < limit; ++pos) {
+            // Early exit if remaining text is shorter than the first start marker
+            if (text_len - pos < regions.front().first.length()) {
+                pos = text_len;
+                return std::nullopt;
+            }
+
+            for (const auto &[start_marker, end_marker] : regions) {
+                if (pos + start_marker.length() > text_len ||
+                    text.substr(pos, start_marker.length()) != view_t(start_marker)) {
+                    continue;
+                }
+
+                // Found a start marker, the interval ends with the nearest end marker
+                size_t end_begin = text.find(end_marker, pos + start_marker.length());
+                if (end_begin == view_t::npos) {
+                    open = true;
+                    return std::nullopt;
+                }
+                return ProtectedInterval(pos, end_begin + end_marker.length() - 1,
+                                         start_marker.length(), end_marker.length());
+            }
+        }
+        return std::nullopt;
+    }
+
+    ProtectedIntervals find_protected_intervals(view_t text, const ProtectedRegions &regions) {
+        ProtectedIntervals intervals;
+        size_t pos = 0;
+        bool open = false;
+        while (auto interval = next_protected_interval(text, pos, text.length(), regions, open)) {
+            intervals.push_back(*interval);
+            pos = interval->skip_to();
+        }
+        return intervals;
+    }
+
+} // namespace punp
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "base/types.h"
+
+#include <optional>
+
+namespace punp {
+
+    /// Find the next protected interval whose start marker begins in `[pos, limit)`.
+    ///
+    /// Start markers are tried in rule order at each position, and the first one
+    /// found claims the nearest following end marker. On success `pos` is the start
+    /// of the interval. Otherwise `pos` is `limit`, or the text length once no further
+    /// interval can exist; a start marker without an end marker stops the search for
+    /// good, then `open` is set and `pos` is left on that marker.
+    std::optional<ProtectedInterval> next_protected_interval(view_t text, size_t &pos, size_t limit,
+                                                             const ProtectedRegions &regions, bool &open);
+
+    // All protected intervals of `text`, in order
+    ProtectedIntervals find_protected_intervals(view_t text, const ProtectedRegions &regions);
+
+} // namespace punp
@@ -0,0 +1,210 @@
+#include "core/tuning_profile.h"
+
+#include "base/color_print.h"
+#include "base/common.h"
+#include "core/file_processor.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace punp {
+    namespace fs = std::filesystem;
+
+    namespace {
+        // Evict the sample from the page cache, so every run reads it from disk like a first run would
+        void drop_cached(const std::vector<std::string> &files) {
+#ifdef __linux__
+            for (const auto &file : files) {
+                const int fd = ::open(file.c_str(), O_RDONLY);
+                if (fd >= 0) {
+                    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                    ::close(fd);
+                }
+            }
+#else
+            (void)files;
+#endif
+        }
+
+        // Fastest of `TuningConfig::RUNS` runs, in microseconds
+        uint64_t time_runs(const ConfigManager &config_manager, const FileProcessorConfig &config) {
+            // Pools never shrink, so every candidate gets a processor of its own
+            FileProcessor processor(config_manager, config.minimize_automaton);
+            uint64_t best = std::numeric_limits<uint64_t>::max();
+            for (size_t run = 0; run < TuningConfig::RUNS; ++run) {
+                drop_cached(config.file_paths);
+                const auto start = std::chrono::steady_clock::now();
+                processor.process_files(config);
+                const auto end = std::chrono::steady_clock::now();
+                best = std::min<uint64_t>(best, std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+            }
+            return best;
+        }
+
+        std::string setting(size_t value, size_t unit = 1) {
+            return value ? std::to_string(value / unit) : "auto";
+        }
+
+        std::string describe(const FileProcessorConfig &config) {
+            return "threads " + setting(config.max_threads) + ", page " + setting(config.page_size, 1024) +
+                   (config.page_size ? " Ki chars" : "") + ", I/O threads " + setting(config.io_threads);
+        }
+    } // namespace
+
+    // NOTE: on-disk format, one record per line, 0 means auto:
+    //   punp-profile <version> <hardware threads>
+    //   threads <n> | page_size <n> | io_threads <n>
+    std::optional<TuningProfile> TuningProfile::load(const std::string &path) {
+        std::ifstream input(path);
+        if (!input) {
+            return std::nullopt;
+        }
+
+        std::string line;
+        if (!std::getline(input, line)) {
+            return std::nullopt;
+        }
+        std::istringstream header(line);
+        std::string magic;
+        uint32_t version = 0;
+        size_t hw_threads = 0;
+        header >> magic >> version >> hw_threads;
+        if (magic != TuningConfig::MAGIC || version != TuningConfig::VERSION || hw_threads != Hardware::HW_MAX_THREADS) {
+            return std::nullopt; // Measured elsewhere, or by another version
+        }
+
+        TuningProfile profile;
+        while (std::getline(input, line)) {
+            std::istringstream record(line);
+            std::string key;
+            size_t value = 0;
+            if (!(record >> key >> value)) {
+                continue;
+            }
+            if (key == "threads") {
+                profile.threads = value;
+            } else if (key == "page_size") {
+                profile.page_size = value;
+            } else if (key == "io_threads") {
+                profile.io_threads = value;
+            }
+        }
+        return profile;
+    }
+
+    bool TuningProfile::save(const std::string &path) const {
+        std::error_code ec;
+        fs::create_directories(fs::path(path).parent_path(), ec);
+
+        // Write a private sibling file and rename it, concurrent runs never see a torn profile
+        const std::string tmp_path = unique_tmp_path(path);
+        {
+            std::ofstream output(tmp_path, std::ios::trunc);
+            if (!output) {
+                return false;
+            }
+            output << TuningConfig::MAGIC << ' ' << TuningConfig::VERSION << ' ' << Hardware::HW_MAX_THREADS << '\n'
+                   << "threads " << threads << '\n'
+                   << "page_size " << page_size << '\n'
+                   << "io_threads " << io_threads << '\n';
+            if (!output.flush()) {
+                output.close();
+                std::remove(tmp_path.c_str());
+                return false;
+            }
+        }
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void TuningProfile::apply(FileProcessorConfig &config) const {
+        if (config.auto_threads == 0) {
+            config.auto_threads = threads;
+        }
+        if (config.page_size == 0) {
+            config.page_size = page_size;
+        }
+        if (config.io_threads == 0) {
+            config.io_threads = io_threads;
+        }
+    }
+
+    TuningProfile calibrate(const ConfigManager &config_manager, const FileProcessorConfig &base,
+                            const std::string &sample_dir, const std::vector<std::string> &files) {
+        // Time the full rewrite, changed files are mirrored into a scratch directory removed afterwards.
+        // It sits next to the sample, so results land on the same filesystem as a real run
+        const fs::path sample_root = fs::is_directory(sample_dir) ? fs::path(sample_dir) : fs::path(sample_dir).parent_path();
+        std::error_code ec;
+        const fs::path scratch = unique_tmp_path((fs::weakly_canonical(sample_root, ec).parent_path() / ".punp-calibrate").string());
+
+        // Start from the defaults, each setting only moves off them for a measurable gain
+        FileProcessorConfig config = base;
+        config.file_paths = files;
+        config.file_cache.reset();
+        config.count_only = false;
+        config.output_dir = scratch.string();
+        config.output_base = sample_root.string();
+        config.mirror_unchanged = false;
+        config.max_threads = 0;
+        config.auto_threads = 0;
+        config.page_size = 0;
+        config.io_threads = 0;
+
+        uint64_t best_us = time_runs(config_manager, config);
+        println_blue("  ", describe(config), ": ", best_us / 1000, " ms");
+
+        auto tune = [&](size_t FileProcessorConfig::*field, const std::vector<size_t> &candidates) {
+            size_t best = config.*field;
+            for (size_t value : candidates) {
+                FileProcessorConfig trial = config;
+                trial.*field = value;
+                const uint64_t us = time_runs(config_manager, trial);
+                const bool faster = us < best_us * (1.0 - TuningConfig::MIN_GAIN);
+                println_blue("  ", describe(trial), ": ", us / 1000, " ms", faster ? " *" : "");
+                if (faster) {
+                    best_us = us;
+                    best = value;
+                }
+            }
+            config.*field = best;
+        };
+
+        std::vector<size_t> thread_counts;
+        for (size_t n = 1; n < Hardware::AUTO_NUM_THREADS; n *= 2) {
+            thread_counts.push_back(n);
+        }
+        if ((thread_counts.empty() || Hardware::HW_MAX_THREADS > thread_counts.back()) &&
+            Hardware::HW_MAX_THREADS < Hardware::AUTO_NUM_THREADS) {
+            thread_counts.push_back(Hardware::HW_MAX_THREADS);
+        }
+        thread_counts.push_back(Hardware::AUTO_NUM_THREADS);
+        tune(&FileProcessorConfig::max_threads, thread_counts);
+
+        tune(&FileProcessorConfig::page_size,
+             std::vector<size_t>(std::begin(TuningConfig::PAGE_SIZES), std::end(TuningConfig::PAGE_SIZES)));
+
+        std::vector<size_t> io_counts;
+        for (size_t n = 1; n <= TuningConfig::MAX_IO_THREADS; n *= 2) {
+            io_counts.push_back(n);
+        }
+        tune(&FileProcessorConfig::io_threads, io_counts);
+
+        fs::remove_all(scratch, ec);
+
+        println_green("Best: ", describe(config), ", ", best_us / 1000, " ms");
+        return TuningProfile{config.max_threads, config.page_size, config.io_threads};
+    }
+
+} // namespace punp
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "base/types.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace punp {
+
+    class ConfigManager;
+
+    /// Processing settings found by `--calibrate`, applied to later runs.
+    ///
+    /// The profile is tied to the number of hardware threads it was measured with,
+    /// so a home directory shared between different machines does not carry one
+    /// machine's settings over to another.
+    struct TuningProfile {
+        size_t threads = 0;    // Replaces the auto-detected thread count
+        size_t page_size = 0;  // Chars per page
+        size_t io_threads = 0; // Size of the I/O pool
+
+        // Profile saved at `path` on this machine, `std::nullopt` if missing or stale
+        static std::optional<TuningProfile> load(const std::string &path);
+        bool save(const std::string &path) const;
+
+        // Fill in the settings `config` leaves on auto
+        void apply(FileProcessorConfig &config) const;
+    };
+
+    /// `--calibrate`: time processing of `files` with the rules of `config_manager`,
+    /// one setting at a time (threads, then page size, then I/O threads), and return
+    /// the fastest combination. Every run reads `files` uncached and writes the results
+    /// into a scratch mirror of `sample_dir`, the files themselves are left untouched.
+    TuningProfile calibrate(const ConfigManager &config_manager, const FileProcessorConfig &base,
+                            const std::string &sample_dir, const std::vector<std::string> &files);
+
+} // namespace punp
@@ -0,0 +1,835 @@
+#include "lsp/lsp_server.h"
+#include "base/color_print.h"
+#include "base/common.h"
+#include "base/logging/logging.h"
+#include "base/utf8/utf8.h"
+#include "config/config_manager.h"
+#include "core/protected_regions.h"
+#include "version.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <poll.h>
+#include <unistd.h>
+
+namespace punp {
+
+    namespace {
+        // JSON-RPC error codes
+        constexpr int PARSE_ERROR = -32700;
+        constexpr int INVALID_PARAMS = -32602;
+        constexpr int METHOD_NOT_FOUND = -32601;
+
+        // LSP enums
+        constexpr int SYNC_INCREMENTAL = 2;
+        constexpr int SEVERITY_WARNING = 2;
+
+        text_t to_text(const std::string &s) {
+            text_t text;
+            utf8::decode(s, text);
+            return text;
+        }
+
+        std::string to_utf8(view_t text) {
+            std::string s;
+            utf8::encode(text, s);
+            return s;
+        }
+
+        // UTF-16 code units of a code point
+        size_t utf16_units(wchar_t c) {
+            return static_cast<uint32_t>(c) > 0xFFFF ? 2 : 1;
+        }
+
+        // Old offset at or after the edit, in new coordinates
+        size_t shift(size_t old_pos, size_t last, size_t hi) {
+            return old_pos - last + hi;
+        }
+
+        // Local path of a `file://` URI, empty for other schemes
+        std::string uri_to_path(const std::string &uri) {
+            constexpr std::string_view scheme = "file://";
+            if (uri.compare(0, scheme.size(), scheme) != 0) {
+                return {};
+            }
+            std::string path;
+            for (size_t i = scheme.size(); i < uri.size(); ++i) {
+                if (uri[i] == '%' && i + 2 < uri.size() && std::isxdigit(static_cast<unsigned char>(uri[i + 1])) &&
+                    std::isxdigit(static_cast<unsigned char>(uri[i + 2]))) {
+                    path += static_cast<char>(std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+                    i += 2;
+                } else {
+                    path += uri[i];
+                }
+            }
+            return path;
+        }
+
+        std::string absolute_path(const std::string &path) {
+            std::error_code ec;
+            auto abs = std::filesystem::weakly_canonical(path, ec);
+            return ec ? std::filesystem::absolute(path).lexically_normal().string() : abs.string();
+        }
+    } // namespace
+
+    LspServer::LspServer(const ConfigManager &config_manager, const RuleConfig &rule_config, bool minimize_automaton)
+        : _rule_config(rule_config),
+          _rules(*config_manager.replacement_map()),
+          _range_rules(*config_manager.range_rules()),
+          _fold_rules(*config_manager.fold_map()),
+          _minimize(minimize_automaton) {
+        // Same build as `FileProcessor`, so the editor sees what a run would replace
+        auto engine = std::make_shared<Engine>();
+        engine->automaton.build_from_map(_rules, _range_rules, _fold_rules, _minimize, true);
+        engine->protected_regions = *config_manager.protected_regions();
+        for (const auto &[start_marker, end_marker] : engine->protected_regions) {
+            engine->max_marker_len = std::max({engine->max_marker_len, start_marker.length(), end_marker.length()});
+        }
+        _scanned = engine;
+        _latest = engine;
+        _engine.store(std::move(engine));
+
+        for (const auto &file : config_manager.find_files(rule_config)) {
+            _rule_files.emplace_back(absolute_path(file));
+        }
+        if (pipe2(_wake_fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+            _wake_fds[0] = _wake_fds[1] = -1;
+        }
+    }
+
+    LspServer::~LspServer() {
+        // The worker may still publish and wake us
+        _reload_pool.shutdown();
+        for (int fd : _wake_fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    int LspServer::run() {
+        std::string body;
+        while (read_message(body)) {
+            if (utf8::validate(body).kind == utf8::TextKind::INVALID) {
+                reply_error(nullptr, PARSE_ERROR, "Message is not valid UTF-8");
+                continue;
+            }
+            std::string err;
+            auto message = json::Value::parse(body, err);
+            if (!message) {
+                reply_error(nullptr, PARSE_ERROR, err);
+                continue;
+            }
+            if (!handle(*message)) {
+                return _shutdown ? 0 : 1;
+            }
+        }
+        // Stdin closed without `exit`
+        return 1;
+    }
+
+    bool LspServer::read_message(std::string &body) {
+        size_t content_length = 0;
+        bool has_length = false;
+        std::string line;
+        for (;;) {
+            char c = 0;
+            if (!read_byte(c)) {
+                return false;
+            }
+            if (c != '\n') {
+                if (line.size() >= LspConfig::MAX_HEADER_LEN) {
+                    error("LSP header line too long");
+                    return false;
+                }
+                line.push_back(c);
+                continue;
+            }
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                // End of the headers
+                if (has_length) {
+                    break;
+                }
+                continue;
+            }
+            constexpr std::string_view key = "Content-Length:";
+            if (line.compare(0, key.size(), key) == 0) {
+                try {
+                    content_length = std::stoull(line.substr(key.size()));
+                    has_length = true;
+                } catch (const std::exception &) {
+                    error("Invalid LSP header: ", line);
+                    return false;
+                }
+            }
+            line.clear();
+        }
+
+        if (content_length > LspConfig::MAX_MESSAGE_SIZE) {
+            error("LSP message too large: ", content_length, " bytes");
+            return false;
+        }
+        body.clear();
+        body.reserve(content_length);
+        while (body.size() < content_length) {
+            char c = 0;
+            if (!read_byte(c)) {
+                return false;
+            }
+            body.push_back(c);
+            // Take the rest of the buffer at once
+            const size_t n = std::min(content_length - body.size(), _input.size() - _input_pos);
+            body.append(_input, _input_pos, n);
+            _input_pos += n;
+        }
+        return true;
+    }
+
+    bool LspServer::read_byte(char &c) {
+        while (_input_pos == _input.size()) {
+            pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {_wake_fds[0], POLLIN, 0}};
+            if (poll(fds, _wake_fds[0] >= 0 ? 2 : 1, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            if (_wake_fds[0] >= 0 && (fds[1].revents & POLLIN)) {
+                char drain[64];
+                while (read(_wake_fds[0], drain, sizeof(drain)) > 0) {
+                }
+                refresh();
+            }
+            if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buffer[64 * 1024];
+                ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                _input.assign(buffer, static_cast<size_t>(n));
+                _input_pos = 0;
+            }
+        }
+        c = _input[_input_pos++];
+        return true;
+    }
+
+    void LspServer::send(const json::Value &message) {
+        std::string body = message.dump();
+        logging::write_now(logging::Stream::OUT, "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body);
+    }
+
+    void LspServer::reply(const json::Value &id, json::Value result) {
+        json::Value message;
+        message.set("jsonrpc", "2.0");
+        message.set("id", id);
+        message.set("result", std::move(result));
+        send(message);
+    }
+
+    void LspServer::reply_error(const json::Value &id, int code, std::string text) {
+        json::Value err;
+        err.set("code", code);
+        err.set("message", std::move(text));
+        json::Value message;
+        message.set("jsonrpc", "2.0");
+        message.set("id", id);
+        message.set("error", std::move(err));
+        send(message);
+    }
+
+    bool LspServer::handle(const json::Value &message) {
+        // Responses to our own requests, like `client/registerCapability`
+        if (!message.contains("method")) {
+            return true;
+        }
+        refresh();
+
+        const std::string &method = message["method"].as_string();
+        const json::Value &params = message["params"];
+        const bool is_request = message.contains("id");
+        const json::Value &id = message["id"];
+
+        if (method == "initialize") {
+            reply(id, initialize(params));
+        } else if (method == "initialized") {
+            register_watchers();
+        } else if (method == "shutdown") {
+            _shutdown = true;
+            reply(id, nullptr);
+        } else if (method == "exit") {
+            return false;
+        } else if (method == "textDocument/didOpen") {
+            did_open(params);
+        } else if (method == "textDocument/didChange") {
+            did_change(params);
+        } else if (method == "textDocument/didClose") {
+            did_close(params);
+        } else if (method == "textDocument/didSave") {
+            if (is_rule_file(params["textDocument"]["uri"].as_string())) {
+                queue_reload();
+            }
+        } else if (method == "workspace/didChangeWatchedFiles") {
+            const auto &changes = params["changes"].as_array();
+            if (std::any_of(changes.begin(), changes.end(),
+                            [this](const json::Value &change) { return is_rule_file(change["uri"].as_string()); })) {
+                queue_reload();
+            }
+        } else if (method == "textDocument/codeAction") {
+            if (!_documents.count(params["textDocument"]["uri"].as_string())) {
+                reply_error(id, INVALID_PARAMS, "Unknown document");
+            } else {
+                reply(id, code_action(params));
+            }
+        } else if (is_request) {
+            // Notifications we don't know, like `$/cancelRequest`, are ignored
+            reply_error(id, METHOD_NOT_FOUND, "Unsupported method: " + method);
+        }
+        return true;
+    }
+
+    json::Value LspServer::initialize(const json::Value &params) {
+        // Code points are our offsets, so take UTF-32 whenever the client offers it
+        _utf16 = true;
+        for (const auto &encoding : params["capabilities"]["general"]["positionEncodings"].as_array()) {
+            if (encoding.as_string() == "utf-32") {
+                _utf16 = false;
+            }
+        }
+        _watch_dynamic = params["capabilities"]["workspace"]["didChangeWatchedFiles"]["dynamicRegistration"].as_bool();
+
+        json::Value sync;
+        sync.set("openClose", true);
+        sync.set("change", SYNC_INCREMENTAL);
+        sync.set("save", true);
+        json::Value code_actions;
+        code_actions.set("codeActionKinds", json::Array{"quickfix", "source.fixAll"});
+        json::Value capabilities;
+        capabilities.set("positionEncoding", _utf16 ? "utf-16" : "utf-32");
+        capabilities.set("textDocumentSync", std::move(sync));
+        capabilities.set("codeActionProvider", std::move(code_actions));
+
+        json::Value info;
+        info.set("name", punp::name);
+        info.set("version", punp::version);
+        json::Value result;
+        result.set("capabilities", std::move(capabilities));
+        result.set("serverInfo", std::move(info));
+        return result;
+    }
+
+    void LspServer::did_open(const json::Value &params) {
+        const json::Value &item = params["textDocument"];
+        const std::string &uri = item["uri"].as_string();
+        Document &doc = _documents[uri];
+        doc.text = to_text(item["text"].as_string());
+        scan_document(doc);
+        publish_diagnostics(uri, doc);
+    }
+
+    void LspServer::did_change(const json::Value &params) {
+        const std::string &uri = params["textDocument"]["uri"].as_string();
+        auto it = _documents.find(uri);
+        if (it == _documents.end()) {
+            return;
+        }
+        Document &doc = it->second;
+        for (const auto &change : params["contentChanges"].as_array()) {
+            text_t text = to_text(change["text"].as_string());
+            if (!change.contains("range")) {
+                doc.text = std::move(text);
+                scan_document(doc);
+                continue;
+            }
+            const json::Value &range = change["range"];
+            size_t first = offset_of(doc, range["start"]);
+            size_t last = std::max(first, offset_of(doc, range["end"]));
+            apply_edit(doc, first, last, text);
+        }
+        publish_diagnostics(uri, doc);
+    }
+
+    void LspServer::did_close(const json::Value &params) {
+        const std::string &uri = params["textDocument"]["uri"].as_string();
+        if (_documents.erase(uri)) {
+            // Clear what we published for it
+            publish_diagnostics(uri, Document{});
+        }
+    }
+
+    void LspServer::register_watchers() {
+        if (!_watch_dynamic) {
+            return;
+        }
+        json::Array watchers;
+        for (const auto &file : _rule_files) {
+            json::Value watcher;
+            watcher.set("globPattern", file);
+            watchers.push_back(std::move(watcher));
+        }
+        json::Value options;
+        options.set("watchers", std::move(watchers));
+        json::Value registration;
+        registration.set("id", "punp-rule-files");
+        registration.set("method", "workspace/didChangeWatchedFiles");
+        registration.set("registerOptions", std::move(options));
+        json::Value params;
+        params.set("registrations", json::Array{std::move(registration)});
+
+        json::Value message;
+        message.set("jsonrpc", "2.0");
+        message.set("id", "punp-register-watchers");
+        message.set("method", "client/registerCapability");
+        message.set("params", std::move(params));
+        send(message);
+    }
+
+    bool LspServer::is_rule_file(const std::string &uri) const {
+        std::string path = uri_to_path(uri);
+        return !path.empty() && std::find(_rule_files.begin(), _rule_files.end(), absolute_path(path)) != _rule_files.end();
+    }
+
+    void LspServer::queue_reload() {
+        // One pending reload is enough, it reads the files when it runs
+        if (!_reload_queued.exchange(true)) {
+            _reload_pool.post([this]() { reload_rules(); });
+        }
+    }
+
+    void LspServer::reload_rules() {
+        _reload_queued = false;
+        ConfigManager config_manager;
+        if (!config_manager.load(_rule_config)) {
+            warn("Failed to reload rules, keeping the previous ones");
+            return;
+        }
+        const ReplacementMap &rules = *config_manager.replacement_map();
+        const ProtectedRegions &protected_regions = *config_manager.protected_regions();
+        const RangeRules &range_rules = *config_manager.range_rules();
+        const ReplacementMap &fold_rules = *config_manager.fold_map();
+
+        // Patch when only `REPLACE` rules changed, scans of the current version go on meanwhile
+        std::shared_ptr<Engine> next;
+        ReplacementMap added;
+        std::vector<text_t> removed;
+        if (range_rules == _range_rules && fold_rules == _fold_rules && _latest->automaton.patchable()) {
+            for (const auto &[from, to] : _rules) {
+                if (rules.find(from) == rules.end()) {
+                    removed.emplace_back(from);
+                }
+            }
+            for (const auto &[from, to] : rules) {
+                auto it = _rules.find(from);
+                if (it == _rules.end() || it->second != to) {
+                    added.emplace(from, to);
+                }
+            }
+            if (added.empty() && removed.empty() && protected_regions == _latest->protected_regions) {
+                return;
+            }
+
+            // Only this thread holds the spare once the scans that used it are done, it can't be
+            // loaded any more. Otherwise the latest version is copied.
+            if (_spare && _spare.use_count() == 1) {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                next = std::move(_spare);
+                if (!next->automaton.patch(_spare_added, _spare_removed)) {
+                    next.reset();
+                }
+            } else {
+                next = std::make_shared<Engine>(*_latest);
+            }
+            if (next && !next->automaton.patch(added, removed)) {
+                next.reset();
+            }
+        }
+        if (next) {
+            _spare = std::move(_latest);
+            _spare_added = std::move(added);
+            _spare_removed = std::move(removed);
+        } else {
+            next = std::make_shared<Engine>();
+            next->automaton.build_from_map(rules, range_rules, fold_rules, _minimize, true);
+            _spare.reset();
+        }
+        next->protected_regions = protected_regions;
+        next->max_marker_len = 0;
+        for (const auto &[start_marker, end_marker] : protected_regions) {
+            next->max_marker_len = std::max({next->max_marker_len, start_marker.length(), end_marker.length()});
+        }
+
+        _rules = rules;
+        _range_rules = range_rules;
+        _fold_rules = fold_rules;
+        _latest = next;
+        _engine.store(std::move(next));
+        if (_wake_fds[1] >= 0) {
+            [[maybe_unused]] ssize_t n = write(_wake_fds[1], "", 1);
+        }
+    }
+
+    void LspServer::refresh() {
+        std::shared_ptr<const Engine> engine = _engine.load();
+        if (engine == _scanned) {
+            return;
+        }
+        _scanned = std::move(engine);
+        for (auto &[uri, doc] : _documents) {
+            scan_document(doc);
+            publish_diagnostics(uri, doc);
+        }
+    }
+
+    json::Value LspServer::code_action(const json::Value &params) const {
+        const std::string &uri = params["textDocument"]["uri"].as_string();
+        const Document &doc = _documents.at(uri);
+        const size_t first = offset_of(doc, params["range"]["start"]);
+        const size_t last = offset_of(doc, params["range"]["end"]);
+
+        auto make_action = [&](std::string title, const char *kind, json::Array edits) {
+            json::Value changes;
+            changes.set(uri, std::move(edits));
+            json::Value workspace_edit;
+            workspace_edit.set("changes", std::move(changes));
+            json::Value action;
+            action.set("title", std::move(title));
+            action.set("kind", kind);
+            action.set("edit", std::move(workspace_edit));
+            return action;
+        };
+
+        json::Array actions;
+        // Matches touching the requested range, matches are sorted by start
+        auto it = std::lower_bound(doc.matches.begin(), doc.matches.end(), first,
+                                   [](const Match &m, size_t pos) { return m.start + m.length < pos; });
+        for (; it != doc.matches.end() && it->start <= last; ++it) {
+            view_t found = view_t(doc.text).substr(it->start, it->length);
+            actions.push_back(make_action("Replace \"" + to_utf8(found) + "\" with \"" +
+                                              to_utf8(replacement_of(found)) + "\"",
+                                          "quickfix", json::Array{fix_of(doc, *it)}));
+        }
+        if (!doc.matches.empty()) {
+            json::Array edits;
+            edits.reserve(doc.matches.size());
+            for (const auto &match : doc.matches) {
+                edits.push_back(fix_of(doc, match));
+            }
+            actions.push_back(make_action("Fix all punctuation (" + std::to_string(doc.matches.size()) + ")",
+                                          "source.fixAll", std::move(edits)));
+        }
+        return actions;
+    }
+
+    void LspServer::publish_diagnostics(const std::string &uri, const Document &doc) {
+        json::Array diagnostics;
+        diagnostics.reserve(doc.matches.size());
+        for (const auto &match : doc.matches) {
+            view_t found = view_t(doc.text).substr(match.start, match.length);
+            json::Value diagnostic;
+            diagnostic.set("range", range_of(doc, match.start, match.start + match.length));
+            diagnostic.set("severity", SEVERITY_WARNING);
+            diagnostic.set("source", punp::name);
+            diagnostic.set("message", "Replace \"" + to_utf8(found) + "\" with \"" + to_utf8(replacement_of(found)) + "\"");
+            diagnostics.push_back(std::move(diagnostic));
+        }
+
+        json::Value params;
+        params.set("uri", uri);
+        params.set("diagnostics", std::move(diagnostics));
+        json::Value message;
+        message.set("jsonrpc", "2.0");
+        message.set("method", "textDocument/publishDiagnostics");
+        message.set("params", std::move(params));
+        send(message);
+    }
+
+    void LspServer::scan_document(Document &doc) const {
+        doc.line_starts.assign(1, 0);
+        for (size_t i = 0; i < doc.text.length(); ++i) {
+            if (doc.text[i] == L'\n') {
+                doc.line_starts.push_back(i + 1);
+            }
+        }
+
+        doc.protected_intervals.clear();
+        doc.open_marker = text_t::npos;
+        size_t pos = 0;
+        bool open = false;
+        while (auto interval = next_protected_interval(doc.text, pos, doc.text.length(), _scanned->protected_regions, open)) {
+            doc.protected_intervals.push_back(*interval);
+            pos = interval->skip_to();
+        }
+        if (open) {
+            doc.open_marker = pos;
+        }
+
+        doc.matches.clear();
+        scan_segments(doc, 0, doc.text.length(), doc.matches);
+    }
+
+    void LspServer::scan_segments(const Document &doc, size_t pos, size_t end, std::vector<Match> &out) const {
+        const view_t text = doc.text;
+        const auto &intervals = doc.protected_intervals;
+        auto it = std::upper_bound(intervals.begin(), intervals.end(), pos,
+                                   [](size_t p, const ProtectedInterval &interval) { return p < interval.skip_to(); });
+        while (pos < end) {
+            if (it != intervals.end() && it->start_first <= pos) {
+                pos = it->skip_to();
+                ++it;
+                continue;
+            }
+            const size_t seg_end = std::min(end, it != intervals.end() ? it->start_first : text.length());
+            for (const auto &match : _scanned->automaton.find_matches(text.substr(pos, seg_end - pos))) {
+                out.push_back({match.start + pos, match.length});
+            }
+            pos = seg_end;
+        }
+    }
+
+    void LspServer::apply_edit(Document &doc, size_t first, size_t last, const text_t &replacement) const {
+        update_line_starts(doc, first, last, replacement);
+        doc.text.replace(first, last - first, replacement);
+
+        // `[first, hi)` is the new text, anything from `hi` on was at `last` before
+        const size_t hi = first + replacement.length();
+        size_t sync = 0;
+        size_t changed = rescan_protected(doc, first, last, hi, sync);
+        rescan_matches(doc, std::min(first, changed), last, hi, sync);
+    }
+
+    void LspServer::update_line_starts(Document &doc, size_t first, size_t last, const text_t &replacement) const {
+        auto &starts = doc.line_starts;
+        // Lines starting inside `(first, last]` are gone, the ones after move
+        auto lo = std::upper_bound(starts.begin(), starts.end(), first);
+        auto hi = std::upper_bound(lo, starts.end(), last);
+        std::vector<size_t> inserted;
+        for (size_t i = 0; i < replacement.length(); ++i) {
+            if (replacement[i] == L'\n') {
+                inserted.push_back(first + i + 1);
+            }
+        }
+        for (auto it = hi; it != starts.end(); ++it) {
+            *it = shift(*it, last, first + replacement.length());
+        }
+        auto pos = starts.erase(lo, hi);
+        starts.insert(pos, inserted.begin(), inserted.end());
+    }
+
+    size_t LspServer::rescan_protected(Document &doc, size_t first, size_t last, size_t hi, size_t &sync) const {
+        const view_t text = doc.text;
+        const size_t text_len = text.length();
+        if (_scanned->protected_regions.empty()) {
+            sync = 0;
+            return text_t::npos;
+        }
+
+        ProtectedIntervals old = std::move(doc.protected_intervals);
+        const size_t old_open = doc.open_marker;
+        const size_t reach = _scanned->max_marker_len;
+
+        // Intervals ending well before the edit stay as they are
+        size_t kept = 0;
+        while (kept < old.size() && old[kept].end_last + reach < first) {
+            ++kept;
+        }
+        ProtectedIntervals intervals(old.begin(), old.begin() + kept);
+
+        // No start marker was found between the last kept interval and the next old
+        // one, the open marker, or the edit, where a marker may begin to differ
+        size_t pos = first > reach ? first - reach : 0;
+        if (kept < old.size()) {
+            pos = std::min(pos, old[kept].start_first);
+        }
+        pos = std::min(pos, old_open);
+        if (kept) {
+            pos = std::max(pos, old[kept - 1].skip_to());
+        }
+
+        // The scan only looks ahead, so from `hi` on it sees the old text. A position
+        // the old scan also went through outside any interval resumes it, the old
+        // intervals from there on are then taken over.
+        size_t open = text_t::npos;
+        size_t limit = hi;
+        for (;;) {
+            if (pos >= text_len) {
+                sync = text_len;
+                break;
+            }
+            if (pos >= limit) {
+                const size_t old_pos = pos - hi + last;
+                if (old_pos > old_open) {
+                    limit = text_len;
+                } else {
+                    auto next = std::lower_bound(old.begin(), old.end(), old_pos,
+                                                 [](const ProtectedInterval &interval, size_t p) { return interval.start_first < p; });
+                    if (next == old.begin() || std::prev(next)->end_last < old_pos) {
+                        for (; next != old.end(); ++next) {
+                            intervals.emplace_back(shift(next->start_first, last, hi), shift(next->end_last, last, hi),
+                                                   next->start_marker_len, next->end_marker_len);
+                        }
+                        if (old_open != text_t::npos) {
+                            open = shift(old_open, last, hi);
+                        }
+                        sync = pos;
+                        break;
+                    }
+                    // Inside an old interval, try again where it ended
+                    limit = shift(std::prev(next)->skip_to(), last, hi);
+                }
+            }
+            bool is_open = false;
+            if (auto interval = next_protected_interval(text, pos, limit, _scanned->protected_regions, is_open)) {
+                intervals.push_back(*interval);
+                pos = interval->skip_to();
+            } else if (is_open) {
+                open = pos;
+                sync = text_len;
+                break;
+            }
+        }
+        doc.protected_intervals = std::move(intervals);
+        doc.open_marker = open;
+
+        // First position where the intervals differ from the old ones
+        const auto &now = doc.protected_intervals;
+        for (size_t i = kept;; ++i) {
+            if (i >= now.size() && i >= old.size()) {
+                return text_t::npos;
+            }
+            if (i >= now.size() || i >= old.size()) {
+                return i < now.size() ? now[i].start_first : std::min(first, old[i].start_first);
+            }
+            const ProtectedInterval &o = old[i];
+            const ProtectedInterval &n = now[i];
+            bool same = n.start_marker_len == o.start_marker_len && n.end_marker_len == o.end_marker_len;
+            if (o.end_last < first) {
+                same = same && n.start_first == o.start_first && n.end_last == o.end_last;
+            } else if (o.start_first >= last) {
+                same = same && n.start_first == shift(o.start_first, last, hi) && n.end_last == shift(o.end_last, last, hi);
+            } else {
+                same = false;
+            }
+            if (!same) {
+                return std::min({n.start_first, o.start_first, first});
+            }
+        }
+    }
+
+    void LspServer::rescan_matches(Document &doc, size_t changed, size_t last, size_t hi, size_t sync) const {
+        const view_t text = doc.text;
+        const size_t text_len = text.length();
+        const size_t reach = std::max<size_t>(_scanned->automaton.max_pattern_len(), 1);
+
+        std::vector<Match> old = std::move(doc.matches);
+        // A match ending `reach` before the change was decided without seeing it
+        size_t kept = 0;
+        while (kept < old.size() && old[kept].start + reach <= changed) {
+            ++kept;
+        }
+        std::vector<Match> matches(old.begin(), old.begin() + kept);
+
+        size_t pos = changed > reach ? changed - reach : 0;
+        if (kept) {
+            pos = std::max(pos, old[kept - 1].start + old[kept - 1].length);
+        }
+
+        // Text and protection are as before from `max(hi, sync)`, there a position
+        // outside the old matches resumes the old scan
+        const size_t resync = std::max(hi, sync);
+        const auto &intervals = doc.protected_intervals;
+        auto it = std::upper_bound(intervals.begin(), intervals.end(), pos,
+                                   [](size_t p, const ProtectedInterval &interval) { return p < interval.skip_to(); });
+        while (pos < text_len) {
+            if (pos >= resync) {
+                const size_t old_pos = pos - hi + last;
+                auto next = std::lower_bound(old.begin(), old.end(), old_pos,
+                                             [](const Match &m, size_t p) { return m.start < p; });
+                if (next == old.begin() || std::prev(next)->start + std::prev(next)->length <= old_pos) {
+                    for (; next != old.end(); ++next) {
+                        matches.push_back({shift(next->start, last, hi), next->length});
+                    }
+                    break;
+                }
+            }
+            if (it != intervals.end() && it->start_first <= pos) {
+                pos = it->skip_to();
+                ++it;
+                continue;
+            }
+            const size_t seg_end = it != intervals.end() ? it->start_first : text_len;
+            size_t resume = 0;
+            auto found = _scanned->automaton.find_matches(text.substr(pos, seg_end - pos),
+                                                 std::min(LspConfig::RESCAN_CHUNK, seg_end - pos), resume);
+            for (const auto &match : found) {
+                matches.push_back({match.start + pos, match.length});
+            }
+            pos += resume;
+        }
+        doc.matches = std::move(matches);
+    }
+
+    size_t LspServer::offset_of(const Document &doc, const json::Value &position) const {
+        const auto &starts = doc.line_starts;
+        const size_t line = static_cast<size_t>(std::max<int64_t>(position["line"].as_int(), 0));
+        if (line >= starts.size()) {
+            return doc.text.length();
+        }
+        const size_t line_start = starts[line];
+        const size_t line_end = line + 1 < starts.size() ? starts[line + 1] - 1 : doc.text.length();
+        const size_t character = static_cast<size_t>(std::max<int64_t>(position["character"].as_int(), 0));
+        if (!_utf16) {
+            return std::min(line_start + character, line_end);
+        }
+        size_t pos = line_start;
+        for (size_t units = 0; pos < line_end && units < character; ++pos) {
+            units += utf16_units(doc.text[pos]);
+        }
+        return pos;
+    }
+
+    json::Value LspServer::position_of(const Document &doc, size_t offset) const {
+        const auto &starts = doc.line_starts;
+        const size_t line = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+        size_t character = offset - starts[line];
+        if (_utf16) {
+            character = 0;
+            for (size_t i = starts[line]; i < offset; ++i) {
+                character += utf16_units(doc.text[i]);
+            }
+        }
+        json::Value position;
+        position.set("line", line);
+        position.set("character", character);
+        return position;
+    }
+
+    json::Value LspServer::range_of(const Document &doc, size_t first, size_t last) const {
+        json::Value range;
+        range.set("start", position_of(doc, first));
+        range.set("end", position_of(doc, last));
+        return range;
+    }
+
+    json::Value LspServer::fix_of(const Document &doc, const Match &match) const {
+        json::Value edit;
+        edit.set("range", range_of(doc, match.start, match.start + match.length));
+        edit.set("newText", to_utf8(replacement_of(view_t(doc.text).substr(match.start, match.length))));
+        return edit;
+    }
+
+    text_t LspServer::replacement_of(view_t match) const {
+        text_t text(match);
+        _scanned->automaton.apply_replace(text);
+        return text;
+    }
+
+} // namespace punp
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "algorithm/ac_automaton.h"
+#include "base/json/json.h"
+#include "base/thread_pool/thread_pool.h"
+#include "base/types.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace punp {
+
+    class ConfigManager;
+
+    /// `--lsp`: Language Server Protocol over stdio.
+    ///
+    /// Every open document keeps its text, protected intervals and matches. An edit
+    /// rescans from a little before the changed span, by the longest pattern or
+    /// marker, and stops as soon as the scan is back in step with the previous
+    /// results; everything after that is shifted instead of recomputed. Diagnostics
+    /// and quick fixes are published from the cached matches.
+    ///
+    /// Saving a rule file reloads the rules on a worker thread. The automaton is
+    /// patched when only `REPLACE` rules changed, and the result is published RCU
+    /// style: scans hold the version they started with, the new one is picked up
+    /// between messages and every open document is rescanned with it. The version
+    /// before the latest is kept and, once no scan holds it, patched up to date as
+    /// the next one, so a reload does not copy the automaton.
+    class LspServer {
+    public:
+        LspServer(const ConfigManager &config_manager, const RuleConfig &rule_config, bool minimize_automaton = false);
+        ~LspServer();
+
+        // Serve until `exit`, returns the process exit code
+        int run();
+
+    private:
+        using Match = ACAutomaton::Match;
+
+        struct Document {
+            text_t text;
+            std::vector<size_t> line_starts; // Offset of the first char of every line
+            ProtectedIntervals protected_intervals;
+            size_t open_marker = text_t::npos; // Start marker without end marker, stops the interval scan
+            std::vector<Match> matches;        // Sorted, outside protected intervals
+        };
+
+        // Everything scanning depends on, replaced as a whole when the rules change
+        struct Engine {
+            ACAutomaton automaton;
+            ProtectedRegions protected_regions;
+            size_t max_marker_len = 0;
+        };
+
+        std::atomic<std::shared_ptr<const Engine>> _engine; // Latest rules
+        std::shared_ptr<const Engine> _scanned;             // Rules the open documents were scanned with
+        std::unordered_map<std::string, Document> _documents;
+        bool _utf16 = true;          // Position encoding, UTF-32 if the client supports it
+        bool _watch_dynamic = false; // Client takes file watchers registered at runtime
+        bool _shutdown = false;      // `shutdown` received, so `exit` is clean
+
+        // Input buffer, read with `poll` so a published reload wakes the loop
+        std::string _input;
+        size_t _input_pos = 0;
+        int _wake_fds[2] = {-1, -1};
+
+        // Owned by the reload worker: the rules `_engine` was built from
+        RuleConfig _rule_config;
+        std::vector<std::string> _rule_files; // Absolute paths
+        ReplacementMap _rules;
+        RangeRules _range_rules;
+        ReplacementMap _fold_rules;
+        std::shared_ptr<Engine> _latest;     // What `_engine` holds
+        std::shared_ptr<Engine> _spare;      // The version before, null after a rebuild
+        ReplacementMap _spare_added;         // The patch `_spare` is behind by
+        std::vector<text_t> _spare_removed;
+        bool _minimize = false;
+        std::atomic<bool> _reload_queued{false};
+        ThreadPool _reload_pool{1};
+
+        // JSON-RPC framing
+        bool read_byte(char &c);
+        bool read_message(std::string &body);
+        void send(const json::Value &message);
+        void reply(const json::Value &id, json::Value result);
+        void reply_error(const json::Value &id, int code, std::string message);
+
+        // Dispatch one message, returns false on `exit`
+        bool handle(const json::Value &message);
+        json::Value initialize(const json::Value &params);
+        void did_open(const json::Value &params);
+        void did_change(const json::Value &params);
+        void did_close(const json::Value &params);
+        void register_watchers();
+        bool is_rule_file(const std::string &uri) const;
+        json::Value code_action(const json::Value &params) const;
+        void publish_diagnostics(const std::string &uri, const Document &doc);
+
+        // Rules: `reload_rules` runs on the worker, `refresh` rescans once it published
+        void queue_reload();
+        void reload_rules();
+        void refresh();
+
+        // Full scan of a document
+        void scan_document(Document &doc) const;
+        // Replace `text[first, last)` and rescan incrementally
+        void apply_edit(Document &doc, size_t first, size_t last, const text_t &replacement) const;
+        void update_line_starts(Document &doc, size_t first, size_t last, const text_t &replacement) const;
+        // Returns where the intervals first differ, `sync` is where they are back in step
+        size_t rescan_protected(Document &doc, size_t first, size_t last, size_t hi, size_t &sync) const;
+        void rescan_matches(Document &doc, size_t changed, size_t last, size_t hi, size_t sync) const;
+        void scan_segments(const Document &doc, size_t pos, size_t end, std::vector<Match> &out) const;
+
+        size_t offset_of(const Document &doc, const json::Value &position) const;
+        json::Value position_of(const Document &doc, size_t offset) const;
+        json::Value range_of(const Document &doc, size_t first, size_t last) const;
+        json::Value fix_of(const Document &doc, const Match &match) const;
+        text_t replacement_of(view_t match) const;
+    };
+
+} // namespace punp
@@ -1,20 +1,140 @@
+#include "algorithm/ac_automaton.h"
 #include "base/color_print.h"
+#include "base/common.h"
+#include "base/hardware/hardware.h"
+#include "base/telemetry/telemetry.h"
 #include "config/argument_parser.h"
 #include "config/config_manager.h"
+#include "config/rule_analyzer.h"
 #include "core/file_finder.h"
 #include "core/file_processor.h"
+#include "core/job_runner.h"
+#include "core/progress.h"
+#include "core/tuning_profile.h"
+#include "lsp/lsp_server.h"
 #include "updater/updater.h"
 
+#include <algorithm>
 #include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using namespace punp;
 
+namespace {
+    // The `n` slowest files with their size and time per stage
+    void print_slowest_files(const std::vector<ProcessingResult> &results, size_t n) {
+        std::vector<const ProcessingResult *> slowest;
+        slowest.reserve(results.size());
+        for (const auto &result : results) {
+            slowest.push_back(&result);
+        }
+        n = std::min(n, slowest.size());
+        std::partial_sort(slowest.begin(), slowest.begin() + n, slowest.end(),
+                          [](const ProcessingResult *a, const ProcessingResult *b) { return a->total_us > b->total_us; });
+
+        println_green("Slowest files:");
+        for (size_t i = 0; i < n; ++i) {
+            const ProcessingResult &result = *slowest[i];
+            std::ostringstream stages;
+            for (size_t s = 0; s < FILE_STAGE_COUNT; ++s) {
+                stages << (s ? ", " : "") << stage_name(static_cast<FileStage>(s)) << ' ' << result.stage_us[s] / 1000 << " ms";
+            }
+            println_blue("  ", result.total_us / 1000, " ms, ", result.bytes / 1024, " KiB: ", result.file_path,
+                         " (", stages.str(), ")");
+        }
+    }
+
+    // `--stats`: what the matcher did, summed over all threads
+    void print_matcher_stats() {
+        if constexpr (!telemetry::ENABLED) {
+            warn("--stats needs a build with -DPUNP_TELEMETRY=ON, no counters were collected");
+            return;
+        }
+        using telemetry::Counter;
+        const auto stats = telemetry::snapshot();
+        auto get = [&stats](Counter counter) { return telemetry::get(stats, counter); };
+        auto ratio = [](uint64_t part, uint64_t whole) {
+            std::ostringstream out;
+            out.setf(std::ios::fixed);
+            out.precision(2);
+            out << (whole ? static_cast<double>(part) / static_cast<double>(whole) : 0.0);
+            return out.str();
+        };
+        auto percent = [](uint64_t part, uint64_t whole) {
+            std::ostringstream out;
+            out.setf(std::ios::fixed);
+            out.precision(1);
+            out << (whole ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0) << '%';
+            return out.str();
+        };
+
+        const uint64_t scanned = get(Counter::CHARS_SCANNED);
+        const uint64_t skipped = get(Counter::CHARS_SKIPPED);
+        println_green("Matcher stats:");
+        println_blue("  Scans: ", get(Counter::SCANS));
+        println_blue("  Chars scanned: ", scanned, " (", percent(skipped, scanned), " skipped by the prefilter)");
+        println_blue("  Transitions: ", get(Counter::TRANSITIONS), " (", ratio(get(Counter::TRANSITIONS), scanned),
+                     " per char scanned)");
+        println_blue("  Failed partial matches: ", get(Counter::FAILED_PARTIALS), " (",
+                     ratio(get(Counter::FAILED_PARTIALS), get(Counter::TRANSITIONS)), " per transition)");
+        println_blue("  Matches: ", get(Counter::MATCHES));
+        println_blue("  Chars replaced: ", get(Counter::CHARS_REPLACED), " -> ", get(Counter::CHARS_EMITTED),
+                     " emitted, ", get(Counter::CHARS_COPIED), " copied unchanged");
+        println_blue("  Protected regions: ", get(Counter::PROTECTED_FOUND), " in ", get(Counter::PROTECTED_CHARS),
+                     " chars searched (", percent(get(Counter::PROTECTED_COVERED), get(Counter::PROTECTED_CHARS)),
+                     " protected)");
+    }
+
+    // Settings from `--calibrate` fill in what the command line leaves on auto
+    void apply_profile(const ArgumentParser &parser, FileProcessorConfig &config) {
+        if (parser.ignore_profile()) {
+            return;
+        }
+        if (auto profile = TuningProfile::load(TuningConfig::PATH)) {
+            profile->apply(config);
+            if (parser.verbose()) {
+                println_blue("Using calibrated profile: ", TuningConfig::PATH);
+            }
+        }
+    }
+
+    // What the run is sized by: usable CPUs and memory, and the settings derived from them
+    void print_resources(const FileProcessorConfig &config, size_t num_files) {
+        constexpr uint64_t MiB = 1024 * 1024;
+        const auto &res = hardware::resources();
+
+        std::ostringstream cpus;
+        cpus << res.cpus << " usable (" << res.affinity_cpus << " in affinity mask";
+        if (res.cpu_quota > 0) {
+            cpus << ", cgroup quota " << res.cpu_quota;
+        }
+        cpus << "), " << FileProcessor::worker_threads(config, num_files) << " worker threads";
+        println_blue("CPUs: ", cpus.str());
+
+        std::ostringstream memory;
+        if (res.memory > 0) {
+            memory << res.memory / MiB << " MiB usable (" << (res.memory_limit ? "cgroup limit" : "physical") << "), ";
+        }
+        memory << "budget " << FileProcessor::memory_budget(config) / MiB << " MiB, files above "
+               << FileProcessor::stream_threshold(config) / MiB << " MiB are streamed";
+        println_blue("Memory: ", memory.str());
+    }
+} // namespace
+
 int main(int argc, char *argv[]) {
     auto start = std::chrono::high_resolution_clock::now();
+    install_stats_signal(); // Before any long-running work, SIGUSR1 must never end the run
 
     // Parse command line arguments
     ArgumentParser parser;
-    if (!parser.parse(argc, argv)) {
+    const bool has_input = parser.parse(argc, argv);
+    if (!parser.args_ok()) {
+        return 1;
+    }
+    if (!has_input) {
         error("No input files specified");
         ArgumentParser::display_help(argv[0]);
         return 1;
@@ -43,14 +163,31 @@ int main(int argc, char *argv[]) {
 
     auto &config = parser.config();
 
-    if (!config.finder_config.extensions.empty() && config.finder_config.patterns.empty()) {
+    if (!config.finder_config.extensions.empty() && config.finder_config.patterns.empty() &&
+        parser.calibrate_dir().empty() && parser.jobs_file().empty()) {
         error("When using `-e`/`--extension`, you must specify files or directories to process");
         return 1;
     }
 
-    // Load configuration
+    // Workers log through per-thread buffers from here on, drained when `main` returns
+    logging::AsyncScope async_logging;
+
+    if (!parser.jobs_file().empty()) {
+        // Every job loads its own rules, command line options are the defaults of all jobs
+        apply_profile(parser, config.processor_config);
+        JobRunner runner(config, parser.verbose(), parser.dry_run());
+        const int code = runner.run(parser.jobs_file());
+        if (parser.stats()) {
+            print_matcher_stats();
+        }
+        return code;
+    }
+
+    // Load configuration. With `--emit-cpp` and `--lsp` stdout carries data, so the
+    // verbose loading report is left out there
     ConfigManager config_manager;
-    if (!config_manager.load(config.rule_config, parser.verbose())) {
+    const bool stdout_is_data = parser.emit_cpp() || parser.lsp();
+    if (!config_manager.load(config.rule_config, parser.verbose() && !stdout_is_data)) {
         error("Failed to load configuration");
         return 1;
     }
@@ -60,9 +197,57 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (parser.explain_rules()) {
+        explain_rules(config_manager, config.processor_config.minimize_automaton);
+        return 0;
+    }
+
+    if (!parser.calibrate_dir().empty()) {
+        // The sample goes through the same filters as a normal run, recursively
+        FileFinderConfig sample_config = config.finder_config;
+        sample_config.patterns = {parser.calibrate_dir()};
+        sample_config.recursive = true;
+        FileFinder file_finder;
+        auto sample = file_finder.find_files(sample_config);
+        if (sample.empty()) {
+            error("No files found to calibrate on");
+            return 1;
+        }
+
+        println_green("Calibrating on ", sample.size(), " files (results go to a scratch directory):");
+        TuningProfile profile = calibrate(config_manager, config.processor_config, parser.calibrate_dir(), sample);
+        if (!profile.save(TuningConfig::PATH)) {
+            error("Cannot save profile: ", TuningConfig::PATH);
+            return 1;
+        }
+        println_green("Saved to ", TuningConfig::PATH, ", used by later runs unless --ignore-profile is given");
+        return 0;
+    }
+
+    if (parser.emit_cpp()) {
+        // Same build as `FileProcessor`, so the runtime automaton gets the same fingerprint
+        ACAutomaton automaton;
+        automaton.build_from_map(*config_manager.replacement_map(), *config_manager.range_rules(),
+                                 *config_manager.fold_map(), config.processor_config.minimize_automaton);
+        std::string source;
+        if (!automaton.emit_cpp(source)) {
+            error("Rule set too large for `--emit-cpp`");
+            return 1;
+        }
+        logging::write(logging::Stream::OUT, source);
+        return 0;
+    }
+
+    if (parser.lsp()) {
+        LspServer server(config_manager, config.rule_config, config.processor_config.minimize_automaton);
+        return server.run();
+    }
+
     // Find files to process
+    // Files already read while following LaTeX includes are handed to the processor
+    auto file_cache = std::make_shared<FileCache>();
     FileFinder file_finder;
-    auto file_paths = file_finder.find_files(config.finder_config);
+    auto file_paths = file_finder.find_files(config.finder_config, file_cache.get());
 
     if (file_paths.empty()) {
         error("No files found to process");
@@ -81,9 +266,20 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    apply_profile(parser, config.processor_config);
+    if (parser.verbose()) {
+        print_resources(config.processor_config, file_paths.size());
+    }
+
     // Process files
     config.processor_config.file_paths = file_paths;
-    FileProcessor processor(config_manager);
+    config.processor_config.file_cache = std::move(file_cache);
+    FileProcessor processor(config_manager, config.processor_config.minimize_automaton);
+    if (parser.verbose()) {
+        const auto &automaton = processor.automaton();
+        println_blue("Automaton: ", automaton.state_count(), " states, ", automaton.memory_bytes() / 1024, " KiB",
+                     automaton.compiled() ? " (compiled matcher)" : "");
+    }
     auto results = processor.process_files(config.processor_config);
 
     // Report results
@@ -106,6 +302,16 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // Outliers, always listed once some file got past the slow threshold
+    const size_t slow_file_ms = config.processor_config.slow_file_ms ? config.processor_config.slow_file_ms
+                                                                     : WatchdogConfig::SLOW_FILE_MS;
+    bool has_slow_file = std::any_of(results.begin(), results.end(), [&](const ProcessingResult &result) {
+        return result.total_us >= slow_file_ms * 1000;
+    });
+    if (parser.verbose() || has_slow_file) {
+        print_slowest_files(results, WatchdogConfig::TOP_N);
+    }
+
     // Summary
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
@@ -114,6 +320,12 @@ int main(int argc, char *argv[]) {
     println_blue("  Files processed: ", n_ok, "/", results.size());
     println_blue("  Total replacements: ", n_rep_total);
     println_blue("  Time taken: ", duration.count(), " ms");
+    if (config.processor_config.count_only) {
+        println_yellow("Count only, no files were modified");
+    }
+    if (parser.stats()) {
+        print_matcher_stats();
+    }
 
     return (n_ok == results.size()) ? 0 : 1;
 }